@@ -0,0 +1,24 @@
+# - find liburing (io_uring)
+# LIBURING_INCLUDE_DIR - Where to find liburing.h (directory)
+# LIBURING_LIBRARIES - liburing library
+# LIBURING_FOUND - Set to TRUE if we found the library and the header
+
+FIND_PATH( LIBURING_INCLUDE_DIR liburing.h )
+FIND_LIBRARY( LIBURING_LIBRARIES NAMES uring )
+
+IF( LIBURING_INCLUDE_DIR AND LIBURING_LIBRARIES )
+        SET( LIBURING_FOUND TRUE )
+ENDIF( LIBURING_INCLUDE_DIR AND LIBURING_LIBRARIES )
+
+IF( LIBURING_FOUND )
+        IF( NOT LIBURING_FIND_QUIETLY )
+                MESSAGE( STATUS "Found liburing header file in ${LIBURING_INCLUDE_DIR}")
+                MESSAGE( STATUS "Found liburing libraries: ${LIBURING_LIBRARIES}")
+        ENDIF( NOT LIBURING_FIND_QUIETLY )
+ELSE( LIBURING_FOUND )
+        IF( LIBURING_FIND_REQUIRED )
+                MESSAGE( FATAL_ERROR "Could not find liburing" )
+        ELSE( LIBURING_FIND_REQUIRED )
+                MESSAGE( STATUS "Optional package liburing was not found, --ioMode uring reads with fadvise instead" )
+        ENDIF( LIBURING_FIND_REQUIRED )
+ENDIF( LIBURING_FOUND )
@@ -0,0 +1,196 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include "sageingest_error.h"
+#include "Sage_Affinity.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+using namespace std;
+
+namespace Sage {
+
+    SageAffinity::SageAffinity(string ioCpuList, string transformCpuList, string ingestCpuList) {
+        ioCpus = parseCpuList(ioCpuList);
+        transformCpus = parseCpuList(transformCpuList);
+        ingestCpus = parseCpuList(ingestCpuList);
+        startCpus = getThreadCpus();
+
+#ifndef __linux__
+        if (!ioCpus.empty() || !transformCpus.empty() || !ingestCpus.empty()) {
+            printf("WARNING: thread affinity is only supported on Linux, the CPU lists are ignored.\n");
+        }
+#endif
+    }
+
+    // pin the calling thread (the one reading the files); threads inherit
+    // the CPUs of the thread creating them, so without a list the CPUs of
+    // the start are set again
+    bool SageAffinity::pinIO() const {
+        return pinThread(ioCpus.empty() ? startCpus : ioCpus);
+    }
+
+    // pin the calling thread to the CPU of transform thread number worker
+    bool SageAffinity::pinTransform(int worker) const {
+        if (transformCpus.empty()) {
+            return pinThread(startCpus);
+        }
+        return pinThread(vector<int>(1, transformCpus[worker % transformCpus.size()]));
+    }
+
+    // pin the calling thread (the one writing to the database)
+    bool SageAffinity::pinIngest() const {
+        return ingestCpus.empty() || pinThread(ingestCpus);
+    }
+
+    bool SageAffinity::hasTransformCpus() const {
+        return !transformCpus.empty();
+    }
+
+    // NUMA node of the CPU of transform thread number worker, 0 if unknown
+    int SageAffinity::getTransformNode(int worker) const {
+        if (transformCpus.empty()) {
+            return 0;
+        }
+        return getNodeOfCpu(transformCpus[worker % transformCpus.size()]);
+    }
+
+    // CPU numbers of a list like "0-7,16-23" (the format of taskset and /sys)
+    vector<int> SageAffinity::parseCpuList(string cpuList) {
+        vector<int> cpus;
+        istringstream list(cpuList);
+        string item;
+
+        while (getline(list, item, ',')) {
+            int first, last;
+            char dash;
+            istringstream range(item);
+
+            if (item.find_first_not_of(" \t\n") == string::npos) {
+                continue;
+            }
+            if (!(range >> first) || first < 0) {
+                SageIngest_error(("SageAffinity: Cannot parse the list of CPUs '" + cpuList + "', expected e.g. 0-7,16-23.\n").c_str());
+            }
+            last = first;
+            if (range >> dash) {
+                if (dash != '-' || !(range >> last) || last < first) {
+                    SageIngest_error(("SageAffinity: Cannot parse the list of CPUs '" + cpuList + "', expected e.g. 0-7,16-23.\n").c_str());
+                }
+            }
+            for (int cpu=first; cpu<=last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+
+        return cpus;
+    }
+
+    // NUMA node of a CPU (the nodeN entry in its /sys directory), 0 if
+    // there is no such information (a single node)
+    int SageAffinity::getNodeOfCpu(int cpu) {
+#ifdef __linux__
+        ostringstream dirName;
+        dirName << "/sys/devices/system/cpu/cpu" << cpu;
+
+        DIR * dir = opendir(dirName.str().c_str());
+        if (!dir) {
+            return 0;
+        }
+        int node = 0;
+        struct dirent * entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                node = atoi(entry->d_name + 4);
+                break;
+            }
+        }
+        closedir(dir);
+        return node;
+#else
+        return 0;
+#endif
+    }
+
+    // CPUs the calling thread may run on now, e.g. for restoring them
+    vector<int> SageAffinity::getThreadCpus() {
+        vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        if (pthread_getaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0) {
+            for (int cpu=0; cpu<CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &cpuSet)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#endif
+        return cpus;
+    }
+
+    // let the calling thread only run on the given CPUs
+    bool SageAffinity::pinThread(const vector<int> &cpus) {
+#ifdef __linux__
+        if (cpus.empty()) {
+            return false;
+        }
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (size_t i=0; i<cpus.size(); i++) {
+            if (cpus[i] < CPU_SETSIZE) {
+                CPU_SET(cpus[i], &cpuSet);
+            }
+        }
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        if (err != 0) {
+            printf("WARNING: cannot pin thread to CPUs (%s).\n", strerror(err));
+            return false;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // let the calling thread only run on the CPUs of a NUMA node, e.g. so
+    // that the memory it touches first is placed there
+    bool SageAffinity::pinThreadToNode(int node) {
+        ostringstream fileName;
+        fileName << "/sys/devices/system/node/node" << node << "/cpulist";
+
+        ifstream in(fileName.str().c_str());
+        string cpuList;
+        if (!in.is_open() || !getline(in, cpuList)) {
+            return false;
+        }
+        return pinThread(parseCpuList(cpuList));
+    }
+
+}
@@ -0,0 +1,64 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#ifndef Sage_Sage_Affinity_h
+#define Sage_Sage_Affinity_h
+
+namespace Sage {
+
+    // CPUs for the threads of the ingest: the thread reading the files (io),
+    // the transform threads of the pipeline (worker k gets the k-th CPU of
+    // the list, round robin) and the thread writing to the database
+    // (ingest, i.e. the main thread). Threads with an empty list may run on
+    // all CPUs the process had at the start. The NUMA node of each CPU is
+    // taken from /sys, so that the block buffers can be placed on the node
+    // of the transform thread that works on them (see SagePipeline). Only
+    // on Linux.
+    class SageAffinity {
+    private:
+        std::vector<int> ioCpus;
+        std::vector<int> transformCpus;
+        std::vector<int> ingestCpus;
+        std::vector<int> startCpus; // of the thread that created this, before any pinning
+
+    public:
+        SageAffinity(std::string ioCpuList, std::string transformCpuList, std::string ingestCpuList);
+
+        bool pinIO() const;
+        bool pinTransform(int worker) const;
+        bool pinIngest() const;
+
+        bool hasTransformCpus() const;
+        int getTransformNode(int worker) const;
+
+        static std::vector<int> parseCpuList(std::string cpuList);
+        static int getNodeOfCpu(int cpu);
+        static std::vector<int> getThreadCpus();
+        static bool pinThread(const std::vector<int> &cpus);
+        static bool pinThreadToNode(int node);
+    };
+
+}
+
+#endif
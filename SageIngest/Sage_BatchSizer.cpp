@@ -0,0 +1,110 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <sstream>
+#include <algorithm>
+#include "sageingest_error.h"
+#include "Sage_BatchSizer.h"
+
+using namespace std;
+
+namespace Sage {
+
+    SageBatchSizer::SageBatchSizer(long initialSize, long newMinSize, long newMaxSize, int newWindow) {
+        if (newMinSize < 1 || newMinSize > newMaxSize) {
+            ostringstream message;
+            message << "SageBatchSizer: Invalid bounds for the batch size: " << newMinSize << " to " << newMaxSize << " rows." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        minSize = newMinSize;
+        maxSize = newMaxSize;
+        size = max(minSize, min(initialSize, maxSize));
+        // about 16 steps from the lower to the upper bound
+        step = max(1L, (maxSize - minSize)/16);
+        window = max(1, newWindow);
+        tolerance = 0.05;
+
+        windowRows = 0;
+        windowMicrosec = 0;
+        windowBatches = 0;
+        lastRate = 0;
+
+        bestSize = size;
+        bestRate = 0;
+        numChanges = 0;
+    }
+
+    // number of rows for the next batch
+    long SageBatchSizer::getSize() const {
+        return size;
+    }
+
+    // for allocating the buffers
+    long SageBatchSizer::getMaxSize() const {
+        return maxSize;
+    }
+
+    // Record a batch (or a whole ingest call) of rows that took microsec,
+    // including the time for collecting the rows. Returns true if the size
+    // was changed.
+    bool SageBatchSizer::record(long rows, long microsec) {
+        windowRows += rows;
+        windowMicrosec += microsec;
+        windowBatches++;
+        if (windowBatches < window) {
+            return false;
+        }
+
+        double rate = 1.e6*windowRows/max(1L, windowMicrosec);
+        long oldSize = size;
+
+        if (rate > bestRate) {
+            bestRate = rate;
+            bestSize = size;
+        }
+
+        if (lastRate > 0 && rate < (1 - tolerance)*lastRate) {
+            size = max(minSize, size/2);
+            lastRate = 0; // start again from here, do not compare with the larger size
+        } else {
+            size = min(maxSize, size + step);
+            lastRate = rate;
+        }
+
+        windowRows = 0;
+        windowMicrosec = 0;
+        windowBatches = 0;
+
+        if (size == oldSize) {
+            return false;
+        }
+        printf("Batch size: %ld -> %ld rows (%.0f rows/s with %ld rows)\n", oldSize, size, rate, oldSize);
+        numChanges++;
+        return true;
+    }
+
+    void SageBatchSizer::report() const {
+        printf("Adaptive batch size: %ld changes, now %ld rows, best %.0f rows/s with %ld rows\n",
+            numChanges, size, bestRate, bestSize);
+    }
+
+}
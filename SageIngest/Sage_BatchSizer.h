@@ -0,0 +1,66 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include <stddef.h>
+
+#ifndef Sage_Sage_BatchSizer_h
+#define Sage_Sage_BatchSizer_h
+
+namespace Sage {
+
+    // Adapts the number of rows per insert batch to the database (or the
+    // load of the server) at runtime, AIMD-style: the rows/s are measured
+    // over a window of batches with the same size. As long as they do not
+    // get worse, the size grows by a fixed step (additive increase); as soon
+    // as they drop by more than the tolerance, the size is halved
+    // (multiplicative decrease) and grows again from there. The size thus
+    // stays close below the point from where larger batches do not pay off
+    // any more, within [minSize, maxSize]. Each change is logged.
+    class SageBatchSizer {
+    private:
+        long size;
+        long minSize;
+        long maxSize;
+        long step;
+        int window;       // batches per measurement
+        double tolerance; // relative drop of the rows/s that counts as worse
+
+        long windowRows;
+        long windowMicrosec;
+        int windowBatches;
+        double lastRate;  // rows/s of the last window, 0 after a decrease
+
+        long bestSize;
+        double bestRate;
+        long numChanges;
+
+    public:
+        SageBatchSizer(long initialSize, long newMinSize, long newMaxSize, int newWindow);
+
+        long getSize() const;
+        long getMaxSize() const;
+
+        bool record(long rows, long microsec);
+        void report() const;
+    };
+
+}
+
+#endif
@@ -0,0 +1,204 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include "sageingest_error.h"
+#include "Sage_BlockPool.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+namespace Sage {
+
+    SageBlockPool::SageBlockPool() {
+#ifdef _WIN32
+        pageSize = 4096;
+#else
+        pageSize = (size_t) sysconf(_SC_PAGESIZE);
+#endif
+        useHugePages = false;
+        prefault = true;
+        totalBytes = 0;
+    }
+
+    SageBlockPool::~SageBlockPool() {
+        boost::mutex::scoped_lock lock(poolMutex);
+        freeUnused("at exit");
+    }
+
+    SageBlockPool & SageBlockPool::instance() {
+        // constructed on first use, lives until the end of the process
+        static SageBlockPool pool;
+        return pool;
+    }
+
+    void SageBlockPool::setUseHugePages(bool newUseHugePages) {
+        useHugePages = newUseHugePages;
+    }
+
+    void SageBlockPool::setPrefault(bool newPrefault) {
+        prefault = newPrefault;
+    }
+
+    size_t SageBlockPool::roundUpSize(size_t nbytes) {
+        // transparent huge pages can only be used for 2 MB aligned chunks
+        size_t unit = useHugePages ? 2*1024*1024 : pageSize;
+        return ((nbytes + unit - 1)/unit)*unit;
+    }
+
+    void * SageBlockPool::allocateBuffer(size_t nbytes, bool touch) {
+        void * buffer;
+
+#ifdef _WIN32
+        buffer = _aligned_malloc(nbytes, pageSize);
+        if (!buffer) {
+            SageIngest_error("SageBlockPool: Error in allocating memory.\n");
+        }
+        if (touch) {
+            memset(buffer, 0, nbytes);
+        }
+#else
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+        // with huge pages, the pages must be faulted in after madvise
+        if (touch && !useHugePages) {
+            flags |= MAP_POPULATE;
+        }
+#endif
+        buffer = mmap(NULL, nbytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (buffer == MAP_FAILED) {
+            SageIngest_error("SageBlockPool: Error in mapping memory for block buffer.\n");
+        }
+
+        if (useHugePages) {
+#ifdef MADV_HUGEPAGE
+            if (madvise(buffer, nbytes, MADV_HUGEPAGE) != 0) {
+                printf("WARNING: transparent huge pages not available for block buffers.\n");
+            }
+#else
+            printf("WARNING: transparent huge pages not supported on this system.\n");
+#endif
+            if (touch) {
+                // touch one byte per page, this also places the pages on
+                // the NUMA node of the calling thread
+                for (size_t i=0; i<nbytes; i+=pageSize) {
+                    ((volatile char *) buffer)[i] = 0;
+                }
+            }
+        }
+#endif
+
+        totalBytes += nbytes;
+
+        return buffer;
+    }
+
+    void SageBlockPool::freeBuffer(void * buffer, size_t nbytes) {
+#ifdef _WIN32
+        _aligned_free(buffer);
+#else
+        munmap(buffer, nbytes);
+#endif
+        totalBytes -= nbytes;
+    }
+
+    // Get a buffer of at least nbytes, aligned to the page size (and thus
+    // to cache lines). A free buffer is reused if one is large enough.
+    void * SageBlockPool::borrow(size_t nbytes) {
+        return borrow(nbytes, -1);
+    }
+
+    // Same for a buffer on the given NUMA node: the calling thread must run
+    // on that node, new buffers are always pre-faulted then, so that their
+    // pages are placed there (first touch).
+    void * SageBlockPool::borrow(size_t nbytes, int node) {
+        boost::mutex::scoped_lock lock(poolMutex);
+
+        void * buffer;
+        size_t size = roundUpSize(nbytes);
+
+        multimap<pair<int, size_t>, void*>::iterator it = freeBuffers.lower_bound(make_pair(node, size));
+        if (it != freeBuffers.end() && it->first.first == node) {
+            buffer = it->second;
+            freeBuffers.erase(it);
+            borrowed.insert(buffer);
+            return buffer;
+        }
+
+        buffer = allocateBuffer(size, prefault || node >= 0);
+        bufferSizes[buffer] = size;
+        bufferNodes[buffer] = node;
+        borrowed.insert(buffer);
+
+        return buffer;
+    }
+
+    void SageBlockPool::giveBack(void * buffer) {
+        boost::mutex::scoped_lock lock(poolMutex);
+
+        map<void*, size_t>::iterator it = bufferSizes.find(buffer);
+        if (it == bufferSizes.end()) {
+            SageIngest_error("SageBlockPool: Buffer given back was not borrowed from this pool.\n");
+        }
+        // a second giveBack would hand out the same buffer to two borrowers
+        if (borrowed.erase(buffer) == 0) {
+            SageIngest_error("SageBlockPool: Buffer given back twice.\n");
+        }
+
+        freeBuffers.insert(make_pair(make_pair(bufferNodes[buffer], it->second), buffer));
+    }
+
+    // unmap all buffers that are not borrowed
+    void SageBlockPool::release() {
+        boost::mutex::scoped_lock lock(poolMutex);
+        freeUnused("on release");
+    }
+
+    // Unmap the free buffers; borrowed ones are reported and kept (they are
+    // still known, so they can be given back and freed later). The pool
+    // mutex must be held.
+    void SageBlockPool::freeUnused(const char * when) {
+        if (!borrowed.empty()) {
+            printf("WARNING: %ld block buffers are still borrowed %s, they are not freed.\n",
+                (long) borrowed.size(), when);
+        }
+
+        for (multimap<pair<int, size_t>, void*>::iterator it = freeBuffers.begin(); it != freeBuffers.end(); ++it) {
+            freeBuffer(it->second, bufferSizes[it->second]);
+            bufferSizes.erase(it->second);
+            bufferNodes.erase(it->second);
+        }
+        freeBuffers.clear();
+    }
+
+    size_t SageBlockPool::getTotalBytes() {
+        boost::mutex::scoped_lock lock(poolMutex);
+        return totalBytes;
+    }
+
+}
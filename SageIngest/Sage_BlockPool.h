@@ -0,0 +1,80 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <map>
+#include <set>
+#include <boost/thread/mutex.hpp>
+
+#ifndef Sage_Sage_BlockPool_h
+#define Sage_Sage_BlockPool_h
+
+namespace Sage {
+
+    // Process-wide pool of page-aligned block buffers.
+    // Readers borrow their block buffers here and give them back when they
+    // are done, so that the memory stays mapped (and its pages stay faulted
+    // in) when ingesting many files one after another. Buffers are pre-faulted
+    // by the thread that first allocates them, which places them on that
+    // thread's NUMA node (first touch). Buffers borrowed for a given node are
+    // only reused for that node.
+    class SageBlockPool {
+    private:
+        boost::mutex poolMutex;
+
+        std::multimap<std::pair<int, size_t>, void*> freeBuffers; // (node, size) -> buffer, for buffers not in use
+        std::map<void*, size_t> bufferSizes; // all buffers ever allocated, with their mapped size
+        std::map<void*, int> bufferNodes;    // NUMA node each buffer was borrowed for, -1 for any
+        std::set<void*> borrowed;            // buffers in use, not given back yet
+
+        size_t pageSize;
+        bool useHugePages;
+        bool prefault;
+
+        size_t totalBytes;
+
+        SageBlockPool();
+        SageBlockPool(const SageBlockPool &);
+        SageBlockPool & operator=(const SageBlockPool &);
+
+        size_t roundUpSize(size_t nbytes);
+        void * allocateBuffer(size_t nbytes, bool touch);
+        void freeBuffer(void * buffer, size_t nbytes);
+        void freeUnused(const char * when);
+
+    public:
+        ~SageBlockPool();
+
+        static SageBlockPool & instance();
+
+        void setUseHugePages(bool newUseHugePages);
+        void setPrefault(bool newPrefault);
+
+        void * borrow(size_t nbytes);
+        void * borrow(size_t nbytes, int node);
+        void giveBack(void * buffer);
+
+        void release();
+
+        size_t getTotalBytes();
+    };
+
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <SchemaItem.h>
+#include <DataObjDesc.h>
+#include "sageingest_error.h"
+#include "Sage_BulkIngest.h"
+#include "Sage_BatchSizer.h"
+
+namespace Sage {
+
+    SageBulkIngestor::SageBulkIngestor(DBDataSchema::Schema * newSchema, SageReader * newReader, DBServer::DBAbstractor * newAdaptor) {
+        vector<DBDataSchema::SchemaItem *> schemaItems;
+
+        if (newAdaptor == NULL) {
+            SageIngest_error("SageBulkIngestor: No database adaptor for this database system.\n");
+        }
+
+        schema = newSchema;
+        reader = newReader;
+        adaptor = newAdaptor;
+        batchSizer = NULL;
+        outputFreq = 0;
+        lastOutputRows = 0;
+
+        schemaItems = schema->getArrSchemaItems();
+        rowBytes = 0;
+        for (size_t j=0; j<schemaItems.size(); j++) {
+            DBDataSchema::DataObjDesc * item = schemaItems[j]->getDataDesc();
+            items.push_back(item);
+            offsets.push_back(rowBytes);
+            rowBytes += DBDataSchema::getByteLenOfDType(item->getDataObjDType());
+        }
+        offsets.push_back(rowBytes);
+    }
+
+    // the settings given to the adaptor's connect, as DBIngestor would
+    void SageBulkIngestor::setConnection(string newUser, string newPwd, string newHost, string newPort, string newSocket) {
+        user = newUser;
+        pwd = newPwd;
+        host = newHost;
+        port = newPort;
+        socket = newSocket;
+    }
+
+    void SageBulkIngestor::setPerformanceMeter(uint32_t newOutputFreq) {
+        outputFreq = newOutputFreq;
+    }
+
+    // Adapt the number of rows per batch with the given sizer (instead of
+    // the bufferSize given to ingestData), measuring each batch from getting
+    // its first row until it is inserted.
+    void SageBulkIngestor::setBatchSizer(SageBatchSizer * newBatchSizer) {
+        batchSizer = newBatchSizer;
+    }
+
+    // bind numRows rows (row-major, as from getRows) to the statement and
+    // execute it; the adaptor gets a pointer to each value, NULL for NULL
+    void SageBulkIngestor::insertRows(void * statement, const vector<char> &values, const vector<char> &nulls, long numRows) {
+        vector<void *> rowData(items.size());
+
+        for (long i=0; i<numRows; i++) {
+            for (size_t j=0; j<items.size(); j++) {
+                rowData[j] = nulls[i*items.size() + j] ? NULL : (void *) &values[i*rowBytes + offsets[j]];
+            }
+            if (!adaptor->bindOneRowToStmt(schema, &rowData[0], statement, i)) {
+                SageIngest_error("SageBulkIngestor: Cannot bind a row to the insert statement.\n");
+            }
+        }
+        if (!adaptor->executeStmt(statement)) {
+            SageIngest_error("SageBulkIngestor: Cannot execute the insert statement.\n");
+        }
+    }
+
+    // all rows of the reader, returns their number
+    long SageBulkIngestor::ingestData(uint32_t bufferSize) {
+        long numBuffered = 0;
+        long numRows = 0;
+        long batchSize = max(bufferSize, (uint32_t) 1);
+
+        if (batchSizer) {
+            batchSize = batchSizer->getSize();
+        }
+        long capacity = batchSizer ? batchSizer->getMaxSize() : batchSize;
+        vector<char> values(capacity*rowBytes);
+        vector<char> nulls(capacity*items.size());
+
+        if (!adaptor->connect(user, pwd, host, port, socket)) {
+            SageIngest_error("SageBulkIngestor: Cannot connect to the database.\n");
+        }
+
+        // one prepared statement per batch size; the last batch of the file
+        // is usually smaller and gets its own
+        long statementRows = batchSize;
+        void * statement = adaptor->prepareMultiRowStmt(schema, statementRows);
+
+        lastOutput = boost::posix_time::microsec_clock::universal_time();
+        boost::posix_time::ptime batchStart = lastOutput;
+
+        reader->bindColumns(items);
+        while ((numBuffered = reader->getRows(batchSize, &values[0], &nulls[0], SAGE_ROW_MAJOR)) > 0) {
+            if (numBuffered != statementRows) {
+                adaptor->finalizeStmt(statement);
+                statementRows = numBuffered;
+                statement = adaptor->prepareMultiRowStmt(schema, statementRows);
+            }
+            insertRows(statement, values, nulls, numBuffered);
+
+            reportRows(numRows, numRows + numBuffered);
+            numRows += numBuffered;
+            if (batchSizer) {
+                boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+                batchSizer->record(numBuffered, (now-batchStart).total_microseconds());
+                batchSize = batchSizer->getSize();
+                batchStart = now;
+            }
+        }
+
+        adaptor->finalizeStmt(statement);
+        adaptor->disconnect();
+
+        return numRows;
+    }
+
+    // performance output each outputFreq rows
+    void SageBulkIngestor::reportRows(long numRowsBefore, long numRowsAfter) {
+        if (outputFreq == 0 || numRowsBefore/outputFreq == numRowsAfter/outputFreq) {
+            return;
+        }
+
+        boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+        printf("Rows ingested: %ld, time for the last %ld rows: %lld ms\n", numRowsAfter, numRowsAfter - lastOutputRows,
+            (long long int) (now-lastOutput).total_milliseconds());
+        lastOutput = now;
+        lastOutputRows = numRowsAfter;
+    }
+
+}
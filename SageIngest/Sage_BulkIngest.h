@@ -0,0 +1,77 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <Schema.h>
+#include <DBAbstractor.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "Sage_Reader.h"
+
+#ifndef Sage_Sage_BulkIngest_h
+#define Sage_Sage_BulkIngest_h
+
+using namespace std;
+
+namespace Sage {
+
+    class SageBatchSizer;
+
+    // Ingest loop for --batchRows: gets the values of a whole batch of rows
+    // from the reader at once (SageReader::getRows) and binds them to the
+    // prepared multi-row statements of the database adaptor, one statement
+    // execution per batch, instead of DBIngestor reading value by value.
+    // The batch size is bufferSize or adapted per batch by a SageBatchSizer.
+    class SageBulkIngestor {
+    private:
+        DBDataSchema::Schema * schema;
+        SageReader * reader;
+        DBServer::DBAbstractor * adaptor;
+        SageBatchSizer * batchSizer; // if the batch size is adapted
+
+        string user;
+        string pwd;
+        string host;
+        string port;
+        string socket;
+
+        vector<DBDataSchema::DataObjDesc *> items;
+        vector<int> offsets; // of each value within a row, and the row size at the end
+        long rowBytes;
+        uint32_t outputFreq;
+        boost::posix_time::ptime lastOutput;
+        long lastOutputRows;
+
+        void insertRows(void * statement, const vector<char> &values, const vector<char> &nulls, long numRows);
+        void reportRows(long numRowsBefore, long numRowsAfter);
+
+    public:
+        SageBulkIngestor(DBDataSchema::Schema * newSchema, SageReader * newReader, DBServer::DBAbstractor * newAdaptor);
+
+        void setConnection(string newUser, string newPwd, string newHost, string newPort, string newSocket);
+        void setPerformanceMeter(uint32_t newOutputFreq);
+        void setBatchSizer(SageBatchSizer * newBatchSizer);
+        long ingestData(uint32_t bufferSize);
+    };
+
+}
+
+#endif
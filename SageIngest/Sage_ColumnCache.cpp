@@ -0,0 +1,321 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sstream>
+#include "sageingest_error.h"
+#include "Sage_ColumnCache.h"
+#include "Sage_Reader.h"
+#include "Sage_Hash.h"
+
+namespace Sage {
+
+    // at the start of the cache file, followed by the column table and the key
+    typedef struct {
+        char magic[8];
+        int32_t numColumns;
+        int32_t complete;
+        int32_t hasCrc;
+        uint32_t crc;
+        int64_t numRows;
+        int64_t keyLength;
+    } SageCacheHeader;
+
+    static const char cacheMagic[8] = {'S', 'A', 'G', 'E', 'C', 'O', 'L', '1'};
+    static const long cachePageSize = 4096;
+
+    static long pageAlign(long n) {
+        return (n + cachePageSize - 1)/cachePageSize*cachePageSize;
+    }
+
+    static void writeAll(int fd, const char * data, long n, long offset) {
+        while (n > 0) {
+            ssize_t written = pwrite(fd, data, n, offset);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                ostringstream message;
+                message << "SageColumnCache: Error writing the cache file (" << strerror(errno) << ")." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            data += written;
+            n -= written;
+            offset += written;
+        }
+    }
+
+    // the columns of the schema computed by the reader, i.e. without the
+    // constant ones
+    static vector<DBDataSchema::DataObjDesc *> getCacheItems(DBDataSchema::Schema * schema) {
+        vector<DBDataSchema::SchemaItem *> schemaItems = schema->getArrSchemaItems();
+        vector<DBDataSchema::DataObjDesc *> items;
+        for (size_t j=0; j<schemaItems.size(); j++) {
+            DBDataSchema::DataObjDesc * item = schemaItems[j]->getDataDesc();
+            if (!item->getIsConstItem() && !item->getIsHeaderItem()) {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    // The cache file of a data file is named after the data file and a
+    // checksum of its full path, so that files with the same name in
+    // different directories get different caches.
+    SageColumnCache::SageColumnCache(string cacheDir, string dataFile, string newKey) {
+        key = newKey;
+        fd = -1;
+        map = NULL;
+        mapSize = 0;
+        numRows = 0;
+        complete = false;
+        hasCrc = false;
+        crc = 0;
+
+        char * fullPath = realpath(dataFile.c_str(), NULL);
+        string path = fullPath ? fullPath : dataFile;
+        free(fullPath);
+
+        SageCrc32c pathHash;
+        pathHash.update(path.c_str(), path.length());
+        char hashStr[16];
+        snprintf(hashStr, sizeof(hashStr), "%08x", pathHash.value());
+
+        size_t slash = path.find_last_of('/');
+        string baseName = slash == string::npos ? path : path.substr(slash + 1);
+        cacheFile = cacheDir + "/" + baseName + "." + hashStr + ".sagecache";
+    }
+
+    SageColumnCache::~SageColumnCache() {
+        unmap();
+    }
+
+    void SageColumnCache::unmap() {
+        if (map) {
+            munmap(map, mapSize);
+            map = NULL;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        columns.clear();
+    }
+
+    // Map the cache file, if there is one for the key and the columns of the
+    // schema; returns false otherwise.
+    bool SageColumnCache::load(DBDataSchema::Schema * schema) {
+        unmap();
+
+        fd = open(cacheFile.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat status;
+        fstat(fd, &status);
+        mapSize = status.st_size;
+        if (mapSize < (long) sizeof(SageCacheHeader)) {
+            printf("Column cache %s is incomplete, writing it again\n", cacheFile.c_str());
+            unmap();
+            return false;
+        }
+        map = (char *) mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+            printf("WARNING: cannot map column cache %s (%s)\n", cacheFile.c_str(), strerror(errno));
+            unmap();
+            return false;
+        }
+
+        SageCacheHeader header;
+        memcpy(&header, map, sizeof(header));
+        long tableEnd = sizeof(header) + header.numColumns*sizeof(SageCacheColumn);
+        if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.numColumns < 0
+            || tableEnd + header.keyLength > mapSize) {
+            printf("Column cache %s is not valid, writing it again\n", cacheFile.c_str());
+            unmap();
+            return false;
+        }
+        if (string(map + tableEnd, header.keyLength) != key) {
+            printf("Column cache %s is for another version of the data file or other options, writing it again\n", cacheFile.c_str());
+            unmap();
+            return false;
+        }
+
+        columns.resize(header.numColumns);
+        memcpy(&columns[0], map + sizeof(header), header.numColumns*sizeof(SageCacheColumn));
+        numRows = header.numRows;
+        complete = header.complete;
+        hasCrc = header.hasCrc;
+        crc = header.crc;
+
+        for (size_t j=0; j<columns.size(); j++) {
+            if (columns[j].valueOffset + numRows*columns[j].size > mapSize || columns[j].nullOffset + numRows > mapSize) {
+                printf("Column cache %s is incomplete, writing it again\n", cacheFile.c_str());
+                unmap();
+                return false;
+            }
+        }
+
+        vector<DBDataSchema::DataObjDesc *> items = getCacheItems(schema);
+        bool sameColumns = items.size() == columns.size();
+        for (size_t j=0; sameColumns && j<columns.size(); j++) {
+            sameColumns = items[j]->getDataObjName() == columns[j].name && items[j]->getDataObjDType() == columns[j].dtype;
+        }
+        if (!sameColumns) {
+            printf("Column cache %s has other columns, writing it again\n", cacheFile.c_str());
+            unmap();
+            return false;
+        }
+
+        madvise(map, mapSize, MADV_SEQUENTIAL);
+        printf("Column cache %s: %ld rows, %ld columns\n", cacheFile.c_str(), numRows, (long) columns.size());
+        return true;
+    }
+
+    // Read all rows of the reader, with the columns of the schema, and write
+    // them into the cache file. The file is written under a temporary name
+    // and renamed when it is complete.
+    void SageColumnCache::write(SageReader * reader, DBDataSchema::Schema * schema) {
+        unmap();
+
+        vector<DBDataSchema::DataObjDesc *> items = getCacheItems(schema);
+        long maxRows = reader->getTotalRows(); // at least the number of selected rows
+        long numItems = items.size();
+
+        SageCacheColumn noColumn;
+        memset(&noColumn, 0, sizeof(noColumn));
+        columns.assign(numItems, noColumn);
+        vector<long> bufferOffsets(numItems);
+        long rowBytes = 0;
+        long offset = pageAlign(sizeof(SageCacheHeader) + numItems*sizeof(SageCacheColumn) + key.length());
+        for (long j=0; j<numItems; j++) {
+            string name = items[j]->getDataObjName();
+            if (name.length() >= sizeof(columns[j].name)) {
+                SageIngest_error(("SageColumnCache: Column name " + name + " is too long for the cache.\n").c_str());
+            }
+            strcpy(columns[j].name, name.c_str());
+            columns[j].dtype = items[j]->getDataObjDType();
+            columns[j].size = DBDataSchema::getByteLenOfDType(items[j]->getDataObjDType());
+            columns[j].valueOffset = offset;
+            offset += pageAlign(maxRows*columns[j].size);
+            columns[j].nullOffset = offset;
+            offset += pageAlign(maxRows);
+
+            bufferOffsets[j] = rowBytes;
+            rowBytes += columns[j].size;
+        }
+
+        string tmpFile = cacheFile + ".tmp";
+        int tmpFd = open(tmpFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (tmpFd < 0 || ftruncate(tmpFd, offset) != 0) {
+            ostringstream message;
+            message << "SageColumnCache: Cannot create " << tmpFile << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        // the values come column by column, as they are written
+        const long chunkRows = 65536;
+        vector<char> values(chunkRows*rowBytes);
+        vector<char> nulls(chunkRows*numItems);
+        long n;
+        numRows = 0;
+        reader->bindColumns(items);
+        while ((n = reader->getRows(chunkRows, &values[0], &nulls[0], SAGE_COLUMN_MAJOR)) > 0) {
+            if (numRows + n > maxRows) {
+                SageIngest_error("SageColumnCache: More rows than in the header of the data file.\n");
+            }
+            for (long j=0; j<numItems; j++) {
+                writeAll(tmpFd, &values[chunkRows*bufferOffsets[j]], n*columns[j].size, columns[j].valueOffset + numRows*columns[j].size);
+                writeAll(tmpFd, &nulls[j*chunkRows], n, columns[j].nullOffset + numRows);
+            }
+            numRows += n;
+        }
+
+        complete = reader->isComplete();
+        hasCrc = reader->getHash(crc);
+
+        SageCacheHeader header;
+        memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+        header.numColumns = numItems;
+        header.complete = complete;
+        header.hasCrc = hasCrc;
+        header.crc = crc;
+        header.numRows = numRows;
+        header.keyLength = key.length();
+        writeAll(tmpFd, (const char *) &header, sizeof(header), 0);
+        writeAll(tmpFd, (const char *) &columns[0], numItems*sizeof(SageCacheColumn), sizeof(header));
+        writeAll(tmpFd, key.c_str(), key.length(), sizeof(header) + numItems*sizeof(SageCacheColumn));
+        close(tmpFd);
+
+        if (rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+            ostringstream message;
+            message << "SageColumnCache: Cannot rename " << tmpFile << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+        printf("Column cache %s: wrote %ld rows, %ld columns\n", cacheFile.c_str(), numRows, numItems);
+    }
+
+    long SageColumnCache::getNumRows() const {
+        return numRows;
+    }
+
+    // index of the column with the name, -1 if it is not in the cache
+    int SageColumnCache::findColumn(const string &name) const {
+        for (size_t j=0; j<columns.size(); j++) {
+            if (name == columns[j].name) {
+                return j;
+            }
+        }
+        return -1;
+    }
+
+    int SageColumnCache::getValueSize(int column) const {
+        return columns[column].size;
+    }
+
+    const char * SageColumnCache::getValues(int column) const {
+        return map + columns[column].valueOffset;
+    }
+
+    const char * SageColumnCache::getNulls(int column) const {
+        return map + columns[column].nullOffset;
+    }
+
+    bool SageColumnCache::isComplete() const {
+        return complete;
+    }
+
+    bool SageColumnCache::getHash(uint32_t &dataCrc) const {
+        dataCrc = crc;
+        return hasCrc;
+    }
+
+    string SageColumnCache::getFileName() const {
+        return cacheFile;
+    }
+
+}
@@ -0,0 +1,88 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <Schema.h>
+
+#ifndef Sage_Sage_ColumnCache_h
+#define Sage_Sage_ColumnCache_h
+
+using namespace std;
+
+namespace Sage {
+
+    class SageReader;
+
+    // one column in the cache file
+    typedef struct {
+        char name[48];
+        int32_t dtype;       // DBDataSchema::DType of the values
+        int32_t size;        // bytes per value
+        int64_t valueOffset; // of the values in the file, page aligned
+        int64_t nullOffset;  // of the null flags (one byte per row)
+    } SageCacheColumn;
+
+    // Local cache of the database columns of one data file, as computed by
+    // the reader (decoded, selected, derived columns like spin or SFR
+    // included): one native-endian array per column at a page-aligned
+    // offset, with the null flags, after a small header. The key describes
+    // everything the values depend on (data file, format, h, fileNum,
+    // filter, ...); a cache with another key or other columns is not used.
+    // Later runs map the file and copy the values from there into the
+    // insert buffers, without reading or decoding the data file.
+    class SageColumnCache {
+    private:
+        string cacheFile;
+        string key;
+
+        int fd;
+        char * map;
+        long mapSize;
+
+        vector<SageCacheColumn> columns;
+        long numRows;
+        bool complete;  // the data file was read completely when writing
+        bool hasCrc;
+        uint32_t crc;   // of the data file, see SageReader::getHash
+
+        void unmap();
+
+    public:
+        SageColumnCache(string cacheDir, string dataFile, string newKey);
+        ~SageColumnCache();
+
+        bool load(DBDataSchema::Schema * schema);
+        void write(SageReader * reader, DBDataSchema::Schema * schema);
+
+        long getNumRows() const;
+        int findColumn(const string &name) const;
+        int getValueSize(int column) const;
+        const char * getValues(int column) const;
+        const char * getNulls(int column) const;
+        bool isComplete() const;
+        bool getHash(uint32_t &dataCrc) const;
+        string getFileName() const;
+    };
+
+}
+
+#endif
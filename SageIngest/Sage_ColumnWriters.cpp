@@ -0,0 +1,173 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>   // sqrt
+#include <sstream>
+#include <boost/type_traits/is_floating_point.hpp>
+#include "sageingest_error.h"
+#include "Sage_Reader.h"
+#include "Sage_ColumnWriters.h"
+
+namespace Sage {
+
+    // The value of each column in its natural type, computed from the row
+    // (rowNum is the row number in the file, starting at 1) and the values
+    // that are the same for the whole file. Only reads the reader, so the
+    // writers can be called from the transform threads of the pipeline.
+    // Columns: id, natural type, always NULL, value
+#define SAGE_COLUMNS(COLUMN) \
+    COLUMN(SCOL_DBID,           long,  false, (row.SnapNum * r.snapnumfactor + r.fileNum) * r.rowfactor + rowNum) \
+    COLUMN(SCOL_SNAPNUM,        int,   false, checkSnapnum(r, row)) \
+    COLUMN(SCOL_REDSHIFT,       float, false, (row.SnapNum >= 0 && row.SnapNum < (int) r.snapRedshifts.size()) ? r.snapRedshifts[row.SnapNum] : r.redshift) \
+    COLUMN(SCOL_ROCKSTARID,     long,  false, labs(row.CtreesHaloID)) /* should be the same as HostHaloId, except for the sign */ \
+    COLUMN(SCOL_DEPTHFIRSTID,   long,  false, r.depthFirstId) \
+    COLUMN(SCOL_FORESTID,       long,  false, r.forestId) \
+    COLUMN(SCOL_GALAXYID,       long,  false, row.GalaxyIndex) \
+    COLUMN(SCOL_HOSTHALOID,     long,  false, row.CtreesHaloID) \
+    COLUMN(SCOL_MAINHALOID,     long,  false, row.CtreesCentralID) \
+    COLUMN(SCOL_GALAXYTYPE,     int,   false, row.Type) \
+    COLUMN(SCOL_HALOMASS,       float, false, row.Mvir*1.e10) \
+    COLUMN(SCOL_VMAX,           float, false, row.Vmax) \
+    COLUMN(SCOL_SPIN,           float, false, sqrt( row.Spin[0]*row.Spin[0] + row.Spin[1]*row.Spin[1] + row.Spin[2]*row.Spin[2] ) / (sqrt(2)*row.Rvir*row.Vvir)) \
+    COLUMN(SCOL_X,              float, false, row.Pos[0]) \
+    COLUMN(SCOL_Y,              float, false, row.Pos[1]) \
+    COLUMN(SCOL_Z,              float, false, row.Pos[2]) \
+    COLUMN(SCOL_VX,             float, false, row.Vel[0]) \
+    COLUMN(SCOL_VY,             float, false, row.Vel[1]) \
+    COLUMN(SCOL_VZ,             float, false, row.Vel[2]) \
+    COLUMN(SCOL_MSTARSPHEROID,  float, false, row.BulgeMass*1.e10) \
+    COLUMN(SCOL_MSTARDISK,      float, false, (row.StellarMass - row.BulgeMass)*1.e10) \
+    COLUMN(SCOL_MCOLDDISK,      float, false, row.ColdGas*1.e10) \
+    COLUMN(SCOL_MHOT,           float, false, row.HotGas*1.e10) \
+    COLUMN(SCOL_MBH,            float, false, row.BlackHoleMass*1.e10) \
+    COLUMN(SCOL_SFRSPHEROID,    float, false, row.SfrBulge*r.h*1.e9) \
+    COLUMN(SCOL_SFRDISK,        float, false, row.SfrDisk*r.h*1.e9) \
+    COLUMN(SCOL_SFR,            float, false, (row.SfrBulge + row.SfrDisk)*r.h*1.e9) \
+    COLUMN(SCOL_MZGASDISK,      float, false, row.MetalsColdGas*1e10) \
+    COLUMN(SCOL_MZHOTHALO,      float, false, row.MetalsHotGas*1.e10) \
+    COLUMN(SCOL_MZSTARSPHEROID, float, false, row.MetalsBulgeMass*1.e10) \
+    COLUMN(SCOL_MZSTARDISK,     float, false, (row.MetalsStellarMass - row.MetalsBulgeMass)*1.e10) \
+    COLUMN(SCOL_MEANAGESTARS,   float, false, row.MeanStarAge/r.h/1.e3) \
+    COLUMN(SCOL_NINFILE,        long,  false, rowNum) \
+    COLUMN(SCOL_FILENUM,        int,   false, row.SnapNum * r.snapnumfactor + r.fileNum) \
+    COLUMN(SCOL_IX,             int,   false, 0) /* if box size and ngrid was provided, we could calculate it here directly */ \
+    COLUMN(SCOL_IY,             int,   false, 0) \
+    COLUMN(SCOL_IZ,             int,   false, 0) \
+    COLUMN(SCOL_PHKEY,          long,  true,  0) \
+    COLUMN(SCOL_GLOBALROW,      long,  false, r.rowOffset + rowNum) /* unique over all files of a manifest */
+
+    // one struct per column, for the template parameter of writeColumn
+    // (a friend of SageReader)
+    struct SageColumns {
+
+        static int checkSnapnum(const SageReader &r, const GalaxyData &row) {
+            if (row.SnapNum != r.snapnum) {
+                ostringstream message;
+                message << "SageReader: Value for snapnum in this row ("
+                    << row.SnapNum << ") is not the same as in first row ("
+                    << r.snapnum << ")." << endl
+                    << "Please check the data reader! (Possible issues with little/big endian (byteswap) or 32/64-bit architecture or byte-alignment?)"
+                    << endl;
+                SageIngest_error(message.str().c_str());
+                exit(EXIT_FAILURE);
+            }
+            return row.SnapNum;
+        }
+
+#define SAGE_COLUMN_STRUCT(id, naturalType, null, expr) \
+        struct Column_##id { \
+            typedef naturalType type; \
+            static const bool isNull = null; \
+            static inline naturalType value(const SageReader &r, const GalaxyData &row, long rowNum) { \
+                return expr; \
+            } \
+        };
+        SAGE_COLUMNS(SAGE_COLUMN_STRUCT)
+#undef SAGE_COLUMN_STRUCT
+    };
+
+    template<class Column>
+    static SageColumnWriter writerForDType(DBDataSchema::DType dtype) {
+        switch (dtype) {
+            case DBDataSchema::DT_INT1:  return &writeColumn<Column, DBDataSchema::DT_INT1>;
+            case DBDataSchema::DT_INT2:  return &writeColumn<Column, DBDataSchema::DT_INT2>;
+            case DBDataSchema::DT_INT4:  return &writeColumn<Column, DBDataSchema::DT_INT4>;
+            case DBDataSchema::DT_INT8:  return &writeColumn<Column, DBDataSchema::DT_INT8>;
+            case DBDataSchema::DT_UINT1: return &writeColumn<Column, DBDataSchema::DT_UINT1>;
+            case DBDataSchema::DT_UINT2: return &writeColumn<Column, DBDataSchema::DT_UINT2>;
+            case DBDataSchema::DT_UINT4: return &writeColumn<Column, DBDataSchema::DT_UINT4>;
+            case DBDataSchema::DT_UINT8: return &writeColumn<Column, DBDataSchema::DT_UINT8>;
+            case DBDataSchema::DT_REAL4: return &writeColumn<Column, DBDataSchema::DT_REAL4>;
+            case DBDataSchema::DT_REAL8: return &writeColumn<Column, DBDataSchema::DT_REAL8>;
+            default:                     return NULL;
+        }
+    }
+
+    // Floats written into integer columns lose their fraction, and the 64 bit
+    // ids and row numbers may not fit into smaller types. Small integers
+    // (snapnum, type) are narrowed without a warning.
+    template<class Column>
+    static void checkConversion(DBDataSchema::DType dtype, string columnName) {
+        bool isFloatType = (dtype == DBDataSchema::DT_REAL4 || dtype == DBDataSchema::DT_REAL8);
+
+        if (boost::is_floating_point<typename Column::type>::value) {
+            if (!isFloatType) {
+                printf("WARNING: column %s has an integer type, its values are truncated.\n", columnName.c_str());
+            }
+        } else if (sizeof(typename Column::type) == 8) {
+            if (DBDataSchema::getByteLenOfDType(dtype) < 8 || dtype == DBDataSchema::DT_REAL4) {
+                printf("WARNING: column %s has a type with less than 64 bits, large values do not fit.\n", columnName.c_str());
+            }
+        }
+    }
+
+    SageColumnWriter findColumnWriter(int columnId, DBDataSchema::DType dtype, string columnName) {
+        switch (columnId) {
+#define SAGE_COLUMN_CASE(id, naturalType, null, expr) \
+            case id: \
+                if (!columnName.empty()) { \
+                    checkConversion<SageColumns::Column_##id>(dtype, columnName); \
+                } \
+                return writerForDType<SageColumns::Column_##id>(dtype);
+            SAGE_COLUMNS(SAGE_COLUMN_CASE)
+#undef SAGE_COLUMN_CASE
+            default:
+                return NULL;
+        }
+    }
+
+    SageValueWriter findValueWriter(DBDataSchema::DType dtype) {
+        switch (dtype) {
+            case DBDataSchema::DT_INT1:  return &writeValue<DBDataSchema::DT_INT1>;
+            case DBDataSchema::DT_INT2:  return &writeValue<DBDataSchema::DT_INT2>;
+            case DBDataSchema::DT_INT4:  return &writeValue<DBDataSchema::DT_INT4>;
+            case DBDataSchema::DT_INT8:  return &writeValue<DBDataSchema::DT_INT8>;
+            case DBDataSchema::DT_UINT1: return &writeValue<DBDataSchema::DT_UINT1>;
+            case DBDataSchema::DT_UINT2: return &writeValue<DBDataSchema::DT_UINT2>;
+            case DBDataSchema::DT_UINT4: return &writeValue<DBDataSchema::DT_UINT4>;
+            case DBDataSchema::DT_UINT8: return &writeValue<DBDataSchema::DT_UINT8>;
+            case DBDataSchema::DT_REAL4: return &writeValue<DBDataSchema::DT_REAL4>;
+            case DBDataSchema::DT_REAL8: return &writeValue<DBDataSchema::DT_REAL8>;
+            default:                     return NULL;
+        }
+    }
+
+}
@@ -0,0 +1,81 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <DType.h>
+
+#ifndef Sage_Sage_ColumnWriters_h
+#define Sage_Sage_ColumnWriters_h
+
+namespace Sage {
+
+    class SageReader;
+    struct GalaxyData;
+
+    // Writes the value of one database column for one row into result, with
+    // the exact C type of the column's DType; returns true if the value is
+    // NULL. There is one writer per column and DType (see findColumnWriter),
+    // chosen once when the schema is bound, so that no type or name has to
+    // be looked at per value.
+    typedef bool (*SageColumnWriter)(const SageReader &reader, const GalaxyData &row, long rowNum, void * result);
+
+    // C type for each DType
+    template<DBDataSchema::DType D> struct SageDTypeOf {};
+    template<> struct SageDTypeOf<DBDataSchema::DT_INT1> { typedef int8_t type; };
+    template<> struct SageDTypeOf<DBDataSchema::DT_INT2> { typedef int16_t type; };
+    template<> struct SageDTypeOf<DBDataSchema::DT_INT4> { typedef int32_t type; };
+    template<> struct SageDTypeOf<DBDataSchema::DT_INT8> { typedef int64_t type; };
+    template<> struct SageDTypeOf<DBDataSchema::DT_UINT1> { typedef uint8_t type; };
+    template<> struct SageDTypeOf<DBDataSchema::DT_UINT2> { typedef uint16_t type; };
+    template<> struct SageDTypeOf<DBDataSchema::DT_UINT4> { typedef uint32_t type; };
+    template<> struct SageDTypeOf<DBDataSchema::DT_UINT8> { typedef uint64_t type; };
+    template<> struct SageDTypeOf<DBDataSchema::DT_REAL4> { typedef float type; };
+    template<> struct SageDTypeOf<DBDataSchema::DT_REAL8> { typedef double type; };
+
+    // Column is one of the column structs in Sage_ColumnWriters.cpp, with
+    // the value in its natural type
+    template<class Column, DBDataSchema::DType D>
+    bool writeColumn(const SageReader &reader, const GalaxyData &row, long rowNum, void * result) {
+        typedef typename SageDTypeOf<D>::type Type;
+        *(Type *) result = (Type) Column::value(reader, row, rowNum);
+        return Column::isNull;
+    }
+
+    // NULL for unknown columns or unsupported DTypes (strings); warns if the
+    // values may be truncated by the DType, unless columnName is empty
+    SageColumnWriter findColumnWriter(int columnId, DBDataSchema::DType dtype, std::string columnName);
+
+    // Writes a value computed by an expression of the mapping file (see
+    // SageMapping) with the C type of the DType
+    typedef void (*SageValueWriter)(double value, void * result);
+
+    template<DBDataSchema::DType D>
+    void writeValue(double value, void * result) {
+        typedef typename SageDTypeOf<D>::type Type;
+        *(Type *) result = (Type) value;
+    }
+
+    // NULL for unsupported DTypes (strings)
+    SageValueWriter findValueWriter(DBDataSchema::DType dtype);
+
+}
+
+#endif
@@ -0,0 +1,409 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <time.h>
+#include <sstream>
+#include <algorithm>
+#include "sageingest_error.h"
+#include "Sage_Duplicates.h"
+
+namespace Sage {
+
+    // at the start of the filter file, the blocks start at filterHeaderSize
+    typedef struct {
+        char magic[8];
+        int64_t numBlocks;
+        int64_t expectedRows;
+    } SageFilterHeader;
+
+    static const char filterMagic[8] = {'S', 'A', 'G', 'E', 'D', 'U', 'P', '1'};
+    static const long filterHeaderSize = 4096;
+    static const long bitsPerKey = 16;  // about 0.1% false positives with 8 bits per key
+    static const int bitsPerBlock = 512;
+    static const int numProbes = 8;
+    static const size_t keyBufferSize = 65536;
+
+    // order of the sorted key logs
+    struct SageKeyLess {
+        bool operator()(const SageDuplicateKey &a, const SageDuplicateKey &b) const {
+            return a.snapnum < b.snapnum || (a.snapnum == b.snapnum && a.galaxyIndex < b.galaxyIndex);
+        }
+    };
+
+    static bool hasSuffix(const string &name, const string &suffix) {
+        return name.length() > suffix.length() && name.compare(name.length() - suffix.length(), suffix.length(), suffix) == 0;
+    }
+
+    // the pid of a key log <prefix><pid>.keys.tmp or <prefix><time>-<pid>.keys
+    static long keyLogPid(const string &name, size_t prefixLength) {
+        size_t dash = name.find('-', prefixLength);
+        return atol(name.c_str() + (dash == string::npos ? prefixLength : dash + 1));
+    }
+
+    static inline uint64_t hashKey(int snapnum, long galaxyIndex) {
+        uint64_t x = (uint64_t) galaxyIndex ^ ((uint64_t) snapnum << 48) ^ 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    SageDuplicateDetector::SageDuplicateDetector(string newFilterFile, long expectedRows) {
+        filterFile = newFilterFile;
+        size_t slash = filterFile.find_last_of('/');
+        keyDir = slash == string::npos ? "." : filterFile.substr(0, max(slash, (size_t) 1));
+        keyPrefix = filterFile.substr(slash == string::npos ? 0 : slash + 1) + ".";
+        ostringstream name;
+        name << filterFile << "." << getpid() << ".keys.tmp";
+        keyFile = name.str();
+        fileNum = 0;
+        numKeys = 0;
+
+        openFilter(expectedRows);
+
+        // the keys left by an aborted run with the same pid are kept
+        keyFd = open(keyFile.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (keyFd < 0) {
+            ostringstream message;
+            message << "SageDuplicateDetector: Cannot open " << keyFile << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+        keyBuffer.reserve(keyBufferSize);
+    }
+
+    SageDuplicateDetector::~SageDuplicateDetector() {
+        flush();
+        if (keyFd >= 0) {
+            close(keyFd);
+        }
+        munmap(map, mapSize);
+        close(filterFd);
+    }
+
+    // Create the filter file, or map the one created by another process
+    // (then its size is used); the creator writes the header last, so the
+    // others wait for it.
+    void SageDuplicateDetector::openFilter(long expectedRows) {
+        SageFilterHeader header;
+
+        filterFd = open(filterFile.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (filterFd >= 0) {
+            numBlocks = max((expectedRows*bitsPerKey + bitsPerBlock - 1)/bitsPerBlock, 1L);
+            mapSize = filterHeaderSize + numBlocks*bitsPerBlock/8;
+            if (ftruncate(filterFd, mapSize) != 0) {
+                SageIngest_error("SageDuplicateDetector: Cannot create the filter file.\n");
+            }
+            memcpy(header.magic, filterMagic, sizeof(filterMagic));
+            header.numBlocks = numBlocks;
+            header.expectedRows = expectedRows;
+            if (pwrite(filterFd, &header, sizeof(header), 0) != sizeof(header)) {
+                SageIngest_error("SageDuplicateDetector: Cannot write the filter file.\n");
+            }
+            printf("Duplicate filter %s: created for %ld rows (%ld MB)\n", filterFile.c_str(), expectedRows, mapSize >> 20);
+        } else if (errno == EEXIST) {
+            filterFd = open(filterFile.c_str(), O_RDWR);
+            for (int tries=0; ; tries++) {
+                if (filterFd >= 0 && pread(filterFd, &header, sizeof(header), 0) == sizeof(header)
+                    && memcmp(header.magic, filterMagic, sizeof(filterMagic)) == 0) {
+                    break;
+                }
+                if (filterFd < 0 || tries >= 50) {
+                    SageIngest_error(("SageDuplicateDetector: " + filterFile + " is not a duplicate filter.\n").c_str());
+                }
+                usleep(100000);
+            }
+            numBlocks = header.numBlocks;
+            mapSize = filterHeaderSize + numBlocks*bitsPerBlock/8;
+            printf("Duplicate filter %s: sized for %ld rows\n", filterFile.c_str(), (long) header.expectedRows);
+            if (expectedRows > header.expectedRows) {
+                printf("WARNING: %ld rows expected now, the filter will give more false positives (to be checked at the end)\n", expectedRows);
+            }
+        }
+        if (filterFd < 0) {
+            ostringstream message;
+            message << "SageDuplicateDetector: Cannot open " << filterFile << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        map = (char *) mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, filterFd, 0);
+        if (map == MAP_FAILED) {
+            SageIngest_error("SageDuplicateDetector: Cannot map the filter file.\n");
+        }
+        blocks = (uint64_t *) (map + filterHeaderSize);
+    }
+
+    // the fileNum recorded with the keys of the following rows
+    void SageDuplicateDetector::setFileNum(int newFileNum) {
+        fileNum = newFileNum;
+    }
+
+    void SageDuplicateDetector::add(const GalaxyData * rows, const vector<long> * selection, long n) {
+        if (selection) {
+            for (long k=0; k<n; k++) {
+                const GalaxyData & row = rows[(*selection)[k]];
+                addKey(row.SnapNum, row.GalaxyIndex);
+            }
+        } else {
+            for (long k=0; k<n; k++) {
+                addKey(rows[k].SnapNum, rows[k].GalaxyIndex);
+            }
+        }
+    }
+
+    // set the bits of the key in its block; if all of them were set
+    // already, the key is suspected to be a duplicate
+    void SageDuplicateDetector::addKey(int snapnum, long galaxyIndex) {
+        uint64_t hash = hashKey(snapnum, galaxyIndex);
+        uint64_t * block = &blocks[((hash >> 32)*(uint64_t) numBlocks >> 32)*(bitsPerBlock/64)];
+        uint32_t bit = hash & (bitsPerBlock - 1);
+        uint32_t step = ((hash >> 9) & (bitsPerBlock - 1)) | 1;
+        bool allSet = true;
+
+        for (int i=0; i<numProbes; i++) {
+            uint64_t mask = 1ULL << (bit & 63);
+            uint64_t * word = &block[bit >> 6];
+            if (!(*word & mask)) {
+                allSet = (__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask) && allSet;
+            }
+            bit = (bit + step) & (bitsPerBlock - 1);
+        }
+        if (allSet) {
+            suspects.insert(make_pair(snapnum, galaxyIndex));
+        }
+
+        SageDuplicateKey key;
+        key.snapnum = snapnum;
+        key.fileNum = fileNum;
+        key.galaxyIndex = galaxyIndex;
+        keyBuffer.push_back(key);
+        if (keyBuffer.size() >= keyBufferSize) {
+            flush();
+        }
+        numKeys++;
+    }
+
+    // append the buffered keys to the key log of this run
+    void SageDuplicateDetector::flush() {
+        if (keyBuffer.empty()) {
+            return;
+        }
+        ssize_t n = keyBuffer.size()*sizeof(SageDuplicateKey);
+        if (write(keyFd, &keyBuffer[0], n) != n) {
+            ostringstream message;
+            message << "SageDuplicateDetector: Error writing " << keyFile << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+        keyBuffer.clear();
+    }
+
+    // Sort the key log of this run and rename it, so that the runs checking
+    // after this one find it. The log may be read by other runs meanwhile,
+    // so it is not sorted in place: a sorted copy is written and replaces
+    // it under the same name before the rename.
+    void SageDuplicateDetector::finishKeyLog() {
+        flush();
+
+        struct stat status;
+        long n = 0;
+        if (fstat(keyFd, &status) == 0) {
+            n = status.st_size/sizeof(SageDuplicateKey);
+        }
+        if (n == 0) {
+            close(keyFd);
+            keyFd = -1;
+            unlink(keyFile.c_str());
+            return;
+        }
+
+        // a private mapping, the pages are copied when sorting
+        size_t logSize = n*sizeof(SageDuplicateKey);
+        SageDuplicateKey * keys = (SageDuplicateKey *) mmap(NULL, logSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, keyFd, 0);
+        if (keys == MAP_FAILED) {
+            SageIngest_error(("SageDuplicateDetector: Cannot map " + keyFile + ".\n").c_str());
+        }
+        sort(keys, keys + n, SageKeyLess());
+        close(keyFd);
+        keyFd = -1;
+
+        string sortedFile = keyFile.substr(0, keyFile.length() - 4) + ".sorting";
+        int sortedFd = open(sortedFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (sortedFd < 0 || write(sortedFd, keys, logSize) != (ssize_t) logSize || close(sortedFd) != 0 ||
+            rename(sortedFile.c_str(), keyFile.c_str()) != 0) {
+            ostringstream message;
+            message << "SageDuplicateDetector: Cannot write " << sortedFile << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+        munmap(keys, logSize);
+
+        ostringstream name;
+        name << filterFile << "." << (long) time(NULL) << "-" << getpid() << ".keys";
+        if (rename(keyFile.c_str(), name.str().c_str()) != 0) {
+            ostringstream message;
+            message << "SageDuplicateDetector: Cannot rename " << keyFile << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+    }
+
+    // the fileNums of the suspects in a sorted key log, by binary search
+    void SageDuplicateDetector::findSorted(string path, std::map<pair<int,long>, vector<int> > &fileNums) {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0) {
+            SageIngest_error(("SageDuplicateDetector: Cannot read " + path + ".\n").c_str());
+        }
+        long n = status.st_size/sizeof(SageDuplicateKey);
+        if (n == 0) {
+            close(fd);
+            return;
+        }
+        size_t logSize = n*sizeof(SageDuplicateKey);
+        const SageDuplicateKey * keys = (const SageDuplicateKey *) mmap(NULL, logSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (keys == MAP_FAILED) {
+            SageIngest_error(("SageDuplicateDetector: Cannot map " + path + ".\n").c_str());
+        }
+
+        for (set<pair<int,long> >::iterator it = suspects.begin(); it != suspects.end(); ++it) {
+            SageDuplicateKey key;
+            key.snapnum = it->first;
+            key.fileNum = 0;
+            key.galaxyIndex = it->second;
+            const SageDuplicateKey * found = lower_bound(keys, keys + n, key, SageKeyLess());
+            for (; found < keys + n && found->snapnum == key.snapnum && found->galaxyIndex == key.galaxyIndex; found++) {
+                fileNums[*it].push_back(found->fileNum);
+            }
+        }
+        munmap((void *) keys, logSize);
+    }
+
+    // the fileNums of the suspects in the key log of a run that is still
+    // going (or was aborted), which is not sorted; false if it is gone
+    // (the run finished in the meantime and renamed it)
+    bool SageDuplicateDetector::findUnsorted(string path, std::map<pair<int,long>, vector<int> > &fileNums) {
+        FILE * keyStream = fopen(path.c_str(), "rb");
+        if (keyStream == NULL) {
+            return false;
+        }
+        vector<SageDuplicateKey> keys(keyBufferSize);
+        size_t n;
+        while ((n = fread(&keys[0], sizeof(SageDuplicateKey), keys.size(), keyStream)) > 0) {
+            for (size_t k=0; k<n; k++) {
+                pair<int,long> key(keys[k].snapnum, keys[k].galaxyIndex);
+                if (suspects.count(key)) {
+                    fileNums[key].push_back(keys[k].fileNum);
+                }
+            }
+        }
+        fclose(keyStream);
+        return true;
+    }
+
+    // Check the suspected keys exactly: count how often each of them is in
+    // the key logs of all runs so far, including this one. Reports the
+    // duplicates with their fileNums and returns their number.
+    long SageDuplicateDetector::check() {
+        std::map<pair<int,long>, vector<int> > fileNums;
+        long numDuplicates = 0;
+        long numLogs = 0;
+
+        finishKeyLog();
+
+        // the directory is listed again if a log of a running process was
+        // renamed in between, to find it under its new name. A sorted log
+        // that turns up later under the pid of an unsorted one already
+        // read is that log renamed; the sorted logs of a listing are read
+        // before the unsorted ones, so that an older log of a run with the
+        // same pid is not taken for it.
+        set<string> done;
+        set<long> donePids; // of the unsorted logs read
+        bool listAgain = !suspects.empty();
+        while (listAgain) {
+            listAgain = false;
+            vector<string> names;
+            DIR * dir = opendir(keyDir.c_str());
+            if (dir) {
+                struct dirent * entry;
+                while ((entry = readdir(dir)) != NULL) {
+                    names.push_back(entry->d_name);
+                }
+                closedir(dir);
+            }
+            for (int sorted=1; sorted>=0; sorted--) {
+                for (size_t j=0; j<names.size(); j++) {
+                    if (names[j].compare(0, keyPrefix.length(), keyPrefix) != 0 || done.count(names[j]) ||
+                        !hasSuffix(names[j], sorted ? ".keys" : ".keys.tmp")) {
+                        continue;
+                    }
+                    string path = keyDir + "/" + names[j];
+                    long pid = keyLogPid(names[j], keyPrefix.length());
+                    if (sorted && donePids.count(pid)) {
+                        done.insert(names[j]);
+                        continue;
+                    }
+                    if (sorted) {
+                        findSorted(path, fileNums);
+                    } else if (!findUnsorted(path, fileNums)) {
+                        listAgain = true;
+                        continue;
+                    } else {
+                        donePids.insert(pid);
+                    }
+                    done.insert(names[j]);
+                    numLogs++;
+                }
+            }
+        }
+
+        for (std::map<pair<int,long>, vector<int> >::iterator it = fileNums.begin(); it != fileNums.end(); ++it) {
+            if (it->second.size() < 2) {
+                continue;
+            }
+            if (numDuplicates < 20) {
+                // the distinct fileNums, in the order of the logs
+                ostringstream files;
+                set<int> seen;
+                for (size_t j=0; j<it->second.size() && seen.size() < 10; j++) {
+                    if (seen.insert(it->second[j]).second) {
+                        files << (seen.size() > 1 ? ", " : "") << it->second[j];
+                    }
+                }
+                printf("WARNING: GalaxyIndex %ld of snapnum %d was ingested %ld times (fileNum %s)\n",
+                    it->first.second, it->first.first, (long) it->second.size(), files.str().c_str());
+            }
+            numDuplicates++;
+        }
+
+        printf("Duplicate check: %ld rows, %ld suspected by the filter, %ld duplicate GalaxyIndex values (%ld key logs)\n",
+            numKeys, (long) suspects.size(), numDuplicates, numLogs);
+        suspects.clear();
+
+        return numDuplicates;
+    }
+
+}
@@ -0,0 +1,98 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include "Sage_Reader.h"
+
+#ifndef Sage_Sage_Duplicates_h
+#define Sage_Sage_Duplicates_h
+
+using namespace std;
+
+namespace Sage {
+
+    // one ingested row in the key log of the duplicate detector
+    typedef struct {
+        int32_t snapnum;
+        int32_t fileNum;
+        int64_t galaxyIndex;
+    } SageDuplicateKey;
+
+    // Finds GalaxyIndex values that are ingested more than once for the
+    // same snapnum, e.g. when a file is ingested twice with different
+    // fileNums. Each (snapnum, GalaxyIndex) goes into a blocked Bloom filter
+    // (all bits of a key in one 64 byte block, i.e. one cache line) and is
+    // appended to the key log of this run; keys whose bits were all set
+    // already are only suspected duplicates, they are checked exactly at the
+    // end. The filter is a file (mapped shared, its bits set atomically), so
+    // that several processes, e.g. the parts of a manifest, share it; the
+    // first one creates it, sized for the expected number of rows.
+    //
+    // The key log of a run is <filter>.<pid>.keys.tmp while it runs; at the
+    // end a sorted copy replaces it and is renamed to
+    // <filter>.<time>-<pid>.keys, so that other runs reading the log
+    // meanwhile always see all of its keys, exactly once. The
+    // suspects are then looked up by binary search in the sorted logs of
+    // all runs, so the check costs about the same for each run, however
+    // many rows were ingested before. Only the logs of runs that are still
+    // going (or were aborted) are read completely.
+    class SageDuplicateDetector {
+    private:
+        string filterFile;
+        string keyDir;      // directory and name prefix of the key logs
+        string keyPrefix;
+        string keyFile;     // of this run
+
+        int filterFd;
+        char * map;
+        long mapSize;
+        uint64_t * blocks;  // 8 words per block
+        long numBlocks;
+
+        int keyFd;
+        vector<SageDuplicateKey> keyBuffer;
+        set<pair<int,long> > suspects;
+
+        int fileNum;
+        long numKeys;
+
+        void openFilter(long expectedRows);
+        void addKey(int snapnum, long galaxyIndex);
+        void finishKeyLog();
+        void findSorted(string path, std::map<pair<int,long>, vector<int> > &fileNums);
+        bool findUnsorted(string path, std::map<pair<int,long>, vector<int> > &fileNums);
+
+    public:
+        SageDuplicateDetector(string newFilterFile, long expectedRows);
+        ~SageDuplicateDetector();
+
+        void setFileNum(int newFileNum);
+        void add(const GalaxyData * rows, const vector<long> * selection, long n);
+        void flush();
+        long check();
+    };
+
+}
+
+#endif
@@ -0,0 +1,581 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <math.h>
+#include <sstream>
+#include <algorithm>
+#include "sageingest_error.h"
+#include "Sage_Expression.h"
+
+namespace Sage {
+
+    // number of rows evaluated at once; small enough that the stack columns
+    // stay in the cache
+    static const long chunkSize = 1024;
+
+#define SAGE_FIELD(name, type, len) { #name, offsetof(GalaxyData, name), type, len }
+
+    static const SageField galaxyFields[] = {
+        SAGE_FIELD(SnapNum, SFT_INT, 1),
+        SAGE_FIELD(Type, SFT_INT, 1),
+        SAGE_FIELD(GalaxyIndex, SFT_LONG, 1),
+        SAGE_FIELD(CentralGalaxyIndex, SFT_LONG, 1),
+        SAGE_FIELD(CtreesHaloID, SFT_LONG, 1),
+        SAGE_FIELD(TreeIndex, SFT_INT, 1),
+        SAGE_FIELD(CtreesCentralID, SFT_LONG, 1),
+        SAGE_FIELD(mergeType, SFT_INT, 1),
+        SAGE_FIELD(mergeIntoID, SFT_INT, 1),
+        SAGE_FIELD(mergeIntoSnapNum, SFT_INT, 1),
+        SAGE_FIELD(dT, SFT_FLOAT, 1),
+        SAGE_FIELD(Pos, SFT_FLOAT, 3),
+        SAGE_FIELD(Vel, SFT_FLOAT, 3),
+        SAGE_FIELD(Spin, SFT_FLOAT, 3),
+        SAGE_FIELD(Len, SFT_INT, 1),
+        SAGE_FIELD(Mvir, SFT_FLOAT, 1),
+        SAGE_FIELD(CentralMvir, SFT_FLOAT, 1),
+        SAGE_FIELD(Rvir, SFT_FLOAT, 1),
+        SAGE_FIELD(Vvir, SFT_FLOAT, 1),
+        SAGE_FIELD(Vmax, SFT_FLOAT, 1),
+        SAGE_FIELD(VelDisp, SFT_FLOAT, 1),
+        SAGE_FIELD(ColdGas, SFT_FLOAT, 1),
+        SAGE_FIELD(StellarMass, SFT_FLOAT, 1),
+        SAGE_FIELD(BulgeMass, SFT_FLOAT, 1),
+        SAGE_FIELD(HotGas, SFT_FLOAT, 1),
+        SAGE_FIELD(EjectedMass, SFT_FLOAT, 1),
+        SAGE_FIELD(BlackHoleMass, SFT_FLOAT, 1),
+        SAGE_FIELD(IntraClusterStars, SFT_FLOAT, 1),
+        SAGE_FIELD(MetalsColdGas, SFT_FLOAT, 1),
+        SAGE_FIELD(MetalsStellarMass, SFT_FLOAT, 1),
+        SAGE_FIELD(MetalsBulgeMass, SFT_FLOAT, 1),
+        SAGE_FIELD(MetalsHotGas, SFT_FLOAT, 1),
+        SAGE_FIELD(MetalsEjectedMass, SFT_FLOAT, 1),
+        SAGE_FIELD(MetalsIntraClusterStars, SFT_FLOAT, 1),
+        SAGE_FIELD(SfrDisk, SFT_FLOAT, 1),
+        SAGE_FIELD(SfrBulge, SFT_FLOAT, 1),
+        SAGE_FIELD(SfrDiskZ, SFT_FLOAT, 1),
+        SAGE_FIELD(SfrBulgeZ, SFT_FLOAT, 1),
+        SAGE_FIELD(DiskRadius, SFT_FLOAT, 1),
+        SAGE_FIELD(Cooling, SFT_FLOAT, 1),
+        SAGE_FIELD(Heating, SFT_FLOAT, 1),
+        SAGE_FIELD(QuasarModeBHaccretionMass, SFT_FLOAT, 1),
+        SAGE_FIELD(TimeOfLastMajorMerger, SFT_FLOAT, 1),
+        SAGE_FIELD(TimeOfLastMinorMerger, SFT_FLOAT, 1),
+        SAGE_FIELD(OutflowRate, SFT_FLOAT, 1),
+        SAGE_FIELD(MeanStarAge, SFT_FLOAT, 1),
+        SAGE_FIELD(infallMvir, SFT_FLOAT, 1),
+        SAGE_FIELD(infallVvir, SFT_FLOAT, 1),
+        SAGE_FIELD(infallVmax, SFT_FLOAT, 1)
+    };
+
+#undef SAGE_FIELD
+
+    // derived database columns, same formulas as in SageReader::getDataItem
+    // (note that fileNum is the variable, i.e. the file number given by the user)
+    static const char * derivedColumns[][2] = {
+        {"dbId", "(SnapNum*1000 + fileNum)*10000000 + row"},
+        {"snapnum", "SnapNum"},
+        {"rockstarId", "abs(CtreesHaloID)"},
+        {"GalaxyID", "GalaxyIndex"},
+        {"HostHaloID", "CtreesHaloID"},
+        {"MainHaloID", "CtreesCentralID"},
+        {"GalaxyType", "Type"},
+        {"HaloMass", "Mvir*1.e10"},
+        {"spin", "sqrt(Spin[0]*Spin[0] + Spin[1]*Spin[1] + Spin[2]*Spin[2])/(sqrt(2)*Rvir*Vvir)"},
+        {"x", "Pos[0]"},
+        {"y", "Pos[1]"},
+        {"z", "Pos[2]"},
+        {"vx", "Vel[0]"},
+        {"vy", "Vel[1]"},
+        {"vz", "Vel[2]"},
+        {"MstarSpheroid", "BulgeMass*1.e10"},
+        {"MstarDisk", "(StellarMass - BulgeMass)*1.e10"},
+        {"McoldDisk", "ColdGas*1.e10"},
+        {"Mhot", "HotGas*1.e10"},
+        {"Mbh", "BlackHoleMass*1.e10"},
+        {"SFRspheroid", "SfrBulge*h*1.e9"},
+        {"SFRdisk", "SfrDisk*h*1.e9"},
+        {"SFR", "(SfrBulge + SfrDisk)*h*1.e9"},
+        {"MZgasDisk", "MetalsColdGas*1.e10"},
+        {"MZhotHalo", "MetalsHotGas*1.e10"},
+        {"MZstarSpheroid", "MetalsBulgeMass*1.e10"},
+        {"MZstarDisk", "(MetalsStellarMass - MetalsBulgeMass)*1.e10"},
+        {"MeanAgeStars", "MeanStarAge/h/1.e3"},
+        {"NInFile", "row"}
+    };
+
+    const SageField * SageExpression::findField(string name) {
+        for (size_t i=0; i<sizeof(galaxyFields)/sizeof(galaxyFields[0]); i++) {
+            if (name.compare(galaxyFields[i].name) == 0) {
+                return &galaxyFields[i];
+            }
+        }
+        return NULL;
+    }
+
+    const char * SageExpression::findDerivedColumn(string name) {
+        for (size_t i=0; i<sizeof(derivedColumns)/sizeof(derivedColumns[0]); i++) {
+            if (name.compare(derivedColumns[i][0]) == 0) {
+                return derivedColumns[i][1];
+            }
+        }
+        return NULL;
+    }
+
+
+    SageExpression::SageExpression() {
+        maxDepth = 0;
+        pos = 0;
+    }
+
+    SageExpression::SageExpression(string newExpression) {
+        maxDepth = 0;
+        pos = 0;
+        compile(newExpression);
+    }
+
+    SageExpression::~SageExpression() {
+
+    }
+
+    string SageExpression::getExpression() {
+        return expression;
+    }
+
+    // names of the GalaxyData fields the expression needs
+    vector<string> SageExpression::getUsedFields() {
+        return usedFields;
+    }
+
+    void SageExpression::compile(string newExpression) {
+        expression = newExpression;
+        program.clear();
+        usedFields.clear();
+        maxDepth = 0;
+
+        text = expression;
+        pos = 0;
+        parseOr();
+        skipSpace();
+        if (pos != text.length()) {
+            parseError("unexpected characters");
+        }
+
+        // replay the program to get the needed stack depth
+        int depth = 0;
+        for (size_t k=0; k<program.size(); k++) {
+            switch (program[k].op) {
+                case OP_CONST: case OP_FIELD: case OP_H: case OP_FILENUM: case OP_ROW: case OP_GLOBALROW:
+                    depth++;
+                    break;
+                case OP_NEG: case OP_NOT: case OP_ABS: case OP_SQRT: case OP_LOG10:
+                    break;
+                default:
+                    depth--;
+            }
+            maxDepth = max(maxDepth, depth);
+        }
+    }
+
+    void SageExpression::parseError(string message) {
+        ostringstream errStr;
+        errStr << "SageExpression: Error in expression '" << text << "' at position " << pos
+            << ": " << message << "." << endl;
+        SageIngest_error(errStr.str().c_str());
+    }
+
+    void SageExpression::skipSpace() {
+        while (pos < text.length() && isspace(text[pos])) {
+            pos++;
+        }
+    }
+
+    bool SageExpression::accept(const char * token) {
+        size_t len = strlen(token);
+
+        skipSpace();
+        if (text.compare(pos, len, token) == 0) {
+            pos += len;
+            return true;
+        }
+        return false;
+    }
+
+    void SageExpression::expect(const char * token) {
+        if (!accept(token)) {
+            parseError(string("expected '") + token + "'");
+        }
+    }
+
+    void SageExpression::emit(OpCode op) {
+        Instruction instr;
+        instr.op = op;
+        instr.value = 0;
+        instr.offset = 0;
+        instr.type = SFT_FLOAT;
+        program.push_back(instr);
+    }
+
+    void SageExpression::parseOr() {
+        parseAnd();
+        while (accept("||")) {
+            parseAnd();
+            emit(OP_OR);
+        }
+    }
+
+    void SageExpression::parseAnd() {
+        parseComparison();
+        while (accept("&&")) {
+            parseComparison();
+            emit(OP_AND);
+        }
+    }
+
+    void SageExpression::parseComparison() {
+        OpCode op;
+
+        parseSum();
+        if (accept("==")) {
+            op = OP_EQ;
+        } else if (accept("!=")) {
+            op = OP_NE;
+        } else if (accept("<=")) {
+            op = OP_LE;
+        } else if (accept(">=")) {
+            op = OP_GE;
+        } else if (accept("<")) {
+            op = OP_LT;
+        } else if (accept(">")) {
+            op = OP_GT;
+        } else if (accept("=")) {
+            parseError("use == for comparisons");
+            return;
+        } else {
+            return;
+        }
+        parseSum();
+        emit(op);
+    }
+
+    void SageExpression::parseSum() {
+        parseProduct();
+        while (true) {
+            if (accept("+")) {
+                parseProduct();
+                emit(OP_ADD);
+            } else if (accept("-")) {
+                parseProduct();
+                emit(OP_SUB);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void SageExpression::parseProduct() {
+        parseUnary();
+        while (true) {
+            if (accept("*")) {
+                parseUnary();
+                emit(OP_MUL);
+            } else if (accept("/")) {
+                parseUnary();
+                emit(OP_DIV);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void SageExpression::parseUnary() {
+        if (accept("-")) {
+            parseUnary();
+            emit(OP_NEG);
+        } else if (accept("+")) {
+            parseUnary();
+        } else if (accept("!")) {
+            parseUnary();
+            emit(OP_NOT);
+        } else {
+            parsePrimary();
+        }
+    }
+
+    void SageExpression::parsePrimary() {
+        skipSpace();
+        if (pos >= text.length()) {
+            parseError("unexpected end of expression");
+        }
+
+        if (accept("(")) {
+            parseOr();
+            expect(")");
+            return;
+        }
+
+        if (isdigit(text[pos]) || text[pos] == '.') {
+            const char * start = text.c_str() + pos;
+            char * end;
+            double value = strtod(start, &end);
+            if (end == start) {
+                parseError("invalid number");
+            }
+            pos += end - start;
+            emit(OP_CONST);
+            program.back().value = value;
+            return;
+        }
+
+        if (isalpha(text[pos]) || text[pos] == '_') {
+            size_t start = pos;
+            while (pos < text.length() && (isalnum(text[pos]) || text[pos] == '_')) {
+                pos++;
+            }
+            parseIdentifier(text.substr(start, pos-start));
+            return;
+        }
+
+        parseError("unexpected character");
+    }
+
+    void SageExpression::parseIdentifier(string name) {
+        const SageField * field;
+        const char * derived;
+
+        // functions
+        if (name == "abs" || name == "sqrt" || name == "log10") {
+            expect("(");
+            parseOr();
+            expect(")");
+            emit(name == "abs" ? OP_ABS : (name == "sqrt" ? OP_SQRT : OP_LOG10));
+            return;
+        }
+
+        // variables
+        if (name == "h") {
+            emit(OP_H);
+            return;
+        }
+        if (name == "fileNum") {
+            emit(OP_FILENUM);
+            return;
+        }
+        if (name == "row") {
+            emit(OP_ROW);
+            return;
+        }
+        if (name == "globalRow") {
+            emit(OP_GLOBALROW);
+            return;
+        }
+
+        // fields of GalaxyData
+        if ((field = findField(name)) != NULL) {
+            long index = 0;
+            if (accept("[")) {
+                skipSpace();
+                char * end;
+                index = strtol(text.c_str() + pos, &end, 10);
+                if (end == text.c_str() + pos) {
+                    parseError("field " + name + " needs a number as index");
+                }
+                pos = end - text.c_str();
+                expect("]");
+            } else if (field->len > 1) {
+                parseError("field " + name + " needs an index");
+            }
+            if (index < 0 || index >= field->len) {
+                parseError("index out of range for field " + name);
+            }
+
+            emit(OP_FIELD);
+            program.back().type = field->type;
+            program.back().offset = field->offset + index*(field->type == SFT_LONG ? sizeof(long) : sizeof(int));
+            if (find(usedFields.begin(), usedFields.end(), name) == usedFields.end()) {
+                usedFields.push_back(name);
+            }
+            return;
+        }
+
+        // derived database columns: compile their formula in place
+        if ((derived = findDerivedColumn(name)) != NULL) {
+            string savedText = text;
+            size_t savedPos = pos;
+
+            text = derived;
+            pos = 0;
+            parseOr();
+
+            text = savedText;
+            pos = savedPos;
+            return;
+        }
+
+        parseError("unknown field or column " + name);
+    }
+
+    // stack must have room for maxDepth*chunkSize values; it is passed in, so
+    // that several threads can evaluate the same expression
+    void SageExpression::evaluateChunk(const GalaxyData * rows, long n, long firstRow, const SageExprContext & context, double * stack, double * result) {
+        int sp = 0;
+
+        for (size_t k=0; k<program.size(); k++) {
+            const Instruction & instr = program[k];
+            double * top = &stack[(sp > 0 ? sp-1 : 0)*chunkSize];
+            double * next = &stack[(sp < maxDepth ? sp : 0)*chunkSize];
+            double * left = &stack[(sp > 1 ? sp-2 : 0)*chunkSize];
+
+            switch (instr.op) {
+                case OP_CONST:
+                    for (long i=0; i<n; i++) next[i] = instr.value;
+                    sp++;
+                    break;
+                case OP_FIELD: {
+                    const char * base = (const char *) rows + instr.offset;
+                    if (instr.type == SFT_INT) {
+                        for (long i=0; i<n; i++) next[i] = *(const int *) (base + i*sizeof(GalaxyData));
+                    } else if (instr.type == SFT_LONG) {
+                        for (long i=0; i<n; i++) next[i] = *(const long *) (base + i*sizeof(GalaxyData));
+                    } else {
+                        for (long i=0; i<n; i++) next[i] = *(const float *) (base + i*sizeof(GalaxyData));
+                    }
+                    sp++;
+                    break;
+                }
+                case OP_H:
+                    for (long i=0; i<n; i++) next[i] = context.h;
+                    sp++;
+                    break;
+                case OP_FILENUM:
+                    for (long i=0; i<n; i++) next[i] = context.fileNum;
+                    sp++;
+                    break;
+                case OP_ROW:
+                    for (long i=0; i<n; i++) next[i] = firstRow + i + 1;
+                    sp++;
+                    break;
+                case OP_GLOBALROW:
+                    for (long i=0; i<n; i++) next[i] = context.rowOffset + firstRow + i + 1;
+                    sp++;
+                    break;
+                case OP_NEG:
+                    for (long i=0; i<n; i++) top[i] = -top[i];
+                    break;
+                case OP_NOT:
+                    for (long i=0; i<n; i++) top[i] = (top[i] == 0);
+                    break;
+                case OP_ABS:
+                    for (long i=0; i<n; i++) top[i] = fabs(top[i]);
+                    break;
+                case OP_SQRT:
+                    for (long i=0; i<n; i++) top[i] = sqrt(top[i]);
+                    break;
+                case OP_LOG10:
+                    for (long i=0; i<n; i++) top[i] = log10(top[i]);
+                    break;
+                case OP_ADD:
+                    for (long i=0; i<n; i++) left[i] = left[i] + top[i];
+                    sp--;
+                    break;
+                case OP_SUB:
+                    for (long i=0; i<n; i++) left[i] = left[i] - top[i];
+                    sp--;
+                    break;
+                case OP_MUL:
+                    for (long i=0; i<n; i++) left[i] = left[i] * top[i];
+                    sp--;
+                    break;
+                case OP_DIV:
+                    for (long i=0; i<n; i++) left[i] = left[i] / top[i];
+                    sp--;
+                    break;
+                case OP_LT:
+                    for (long i=0; i<n; i++) left[i] = (left[i] < top[i]);
+                    sp--;
+                    break;
+                case OP_LE:
+                    for (long i=0; i<n; i++) left[i] = (left[i] <= top[i]);
+                    sp--;
+                    break;
+                case OP_GT:
+                    for (long i=0; i<n; i++) left[i] = (left[i] > top[i]);
+                    sp--;
+                    break;
+                case OP_GE:
+                    for (long i=0; i<n; i++) left[i] = (left[i] >= top[i]);
+                    sp--;
+                    break;
+                case OP_EQ:
+                    for (long i=0; i<n; i++) left[i] = (left[i] == top[i]);
+                    sp--;
+                    break;
+                case OP_NE:
+                    for (long i=0; i<n; i++) left[i] = (left[i] != top[i]);
+                    sp--;
+                    break;
+                case OP_AND:
+                    for (long i=0; i<n; i++) left[i] = (left[i] != 0 && top[i] != 0);
+                    sp--;
+                    break;
+                case OP_OR:
+                    for (long i=0; i<n; i++) left[i] = (left[i] != 0 || top[i] != 0);
+                    sp--;
+                    break;
+            }
+        }
+
+        memcpy(result, stack, n*sizeof(double));
+    }
+
+    // evaluate the expression for n rows; firstRow is the number of rows in
+    // the file before rows[0]
+    void SageExpression::evaluate(const GalaxyData * rows, long n, long firstRow, const SageExprContext & context, double * result) {
+        vector<double> stack(maxDepth*chunkSize);
+
+        for (long start=0; start<n; start+=chunkSize) {
+            evaluateChunk(rows + start, min(chunkSize, n-start), firstRow + start, context, &stack[0], result + start);
+        }
+    }
+
+    // collect the indices of all rows for which the expression is true
+    long SageExpression::select(const GalaxyData * rows, long n, long firstRow, const SageExprContext & context, vector<long> &selection) {
+        vector<double> stack(maxDepth*chunkSize);
+        double values[chunkSize];
+
+        selection.clear();
+        for (long start=0; start<n; start+=chunkSize) {
+            long nChunk = min(chunkSize, n-start);
+            evaluateChunk(rows + start, nChunk, firstRow + start, context, &stack[0], values);
+            for (long i=0; i<nChunk; i++) {
+                if (values[i] != 0) {
+                    selection.push_back(start + i);
+                }
+            }
+        }
+
+        return selection.size();
+    }
+
+}
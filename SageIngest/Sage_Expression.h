@@ -0,0 +1,134 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include "Sage_Reader.h"
+#include <string>
+#include <vector>
+
+#ifndef Sage_Sage_Expression_h
+#define Sage_Sage_Expression_h
+
+namespace Sage {
+
+    // types of the fields in GalaxyData
+    enum SageFieldType {
+        SFT_INT,
+        SFT_LONG,
+        SFT_FLOAT
+    };
+
+    // description of one field in GalaxyData (arrays like Pos[3] have len > 1)
+    typedef struct {
+        const char * name;
+        size_t offset;
+        SageFieldType type;
+        int len;
+    } SageField;
+
+    // Small arithmetic/logical expression over the fields of GalaxyData,
+    // the derived database columns (e.g. HaloMass, spin, SFR) and the
+    // variables h, fileNum, row (row number in the file, starting at 1) and
+    // globalRow (row number over all files of a manifest, see SageManifest).
+    // The expression is parsed only once into a flat postfix program, which
+    // is then evaluated for a whole block of rows at a time, one operation
+    // after the other over all rows. A compiled expression can be evaluated
+    // by several threads at the same time.
+    // Example: "StellarMass*1e10 > 1e9 && Type == 0"
+    class SageExpression {
+    private:
+        enum OpCode {
+            OP_CONST,
+            OP_FIELD,
+            OP_H,
+            OP_FILENUM,
+            OP_ROW,
+            OP_GLOBALROW,
+            OP_NEG,
+            OP_NOT,
+            OP_ABS,
+            OP_SQRT,
+            OP_LOG10,
+            OP_ADD,
+            OP_SUB,
+            OP_MUL,
+            OP_DIV,
+            OP_LT,
+            OP_LE,
+            OP_GT,
+            OP_GE,
+            OP_EQ,
+            OP_NE,
+            OP_AND,
+            OP_OR
+        };
+
+        typedef struct {
+            OpCode op;
+            double value; // for OP_CONST
+            size_t offset; // for OP_FIELD
+            SageFieldType type; // for OP_FIELD
+        } Instruction;
+
+        string expression;
+        vector<Instruction> program;
+        vector<string> usedFields;
+        int maxDepth;
+
+        // parser state
+        string text;
+        size_t pos;
+
+        void parseOr();
+        void parseAnd();
+        void parseComparison();
+        void parseSum();
+        void parseProduct();
+        void parseUnary();
+        void parsePrimary();
+        void parseIdentifier(string name);
+
+        void skipSpace();
+        bool accept(const char * token);
+        void expect(const char * token);
+        void parseError(string message);
+        void emit(OpCode op);
+
+        void evaluateChunk(const GalaxyData * rows, long n, long firstRow, const SageExprContext & context, double * stack, double * result);
+
+    public:
+        SageExpression();
+        SageExpression(string newExpression);
+        ~SageExpression();
+
+        void compile(string newExpression);
+
+        void evaluate(const GalaxyData * rows, long n, long firstRow, const SageExprContext & context, double * result);
+        long select(const GalaxyData * rows, long n, long firstRow, const SageExprContext & context, vector<long> &selection);
+
+        string getExpression();
+        vector<string> getUsedFields();
+
+        static const SageField * findField(string name);
+        static const char * findDerivedColumn(string name);
+    };
+
+}
+
+#endif
@@ -0,0 +1,320 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <SchemaItem.h>
+#include <DataObjDesc.h>
+#include "sageingest_error.h"
+#include "Sage_Fanout.h"
+
+namespace Sage {
+
+    SageFanoutReader::SageFanoutReader(SageFanout * newFanout, int newTarget, DBDataSchema::Schema * schema) {
+        fanout = newFanout;
+        target = newTarget;
+        batch = NULL;
+        row = 0;
+        itemCursor = 0;
+        rowBytes = fanout->getRowBytes();
+        numColumns = fanout->getNumColumns();
+
+        vector<DBDataSchema::SchemaItem *> schemaItems = schema->getArrSchemaItems();
+        for (size_t j=0; j<schemaItems.size(); j++) {
+            DBDataSchema::DataObjDesc * item = schemaItems[j]->getDataDesc();
+            if (item->getIsConstItem() || item->getIsHeaderItem()) {
+                continue;
+            }
+            int column = fanout->findColumn(item->getDataObjName(), item->getDataObjDType());
+            if (column < 0) {
+                ostringstream message;
+                message << "SageFanout: Column " << item->getDataObjName() << " of a target is not computed by the reader (with this type)." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            items.push_back(item);
+            itemColumns.push_back(column);
+            itemOffsets.push_back(fanout->getColumnOffset(column));
+            itemSizes.push_back(fanout->getColumnSize(column));
+        }
+    }
+
+    SageFanoutReader::~SageFanoutReader() {
+    }
+
+    void SageFanoutReader::openFile(string newFileName) {
+        // nothing to open, rows come from the fan-out
+    }
+
+    void SageFanoutReader::closeFile() {
+    }
+
+    int SageFanoutReader::getNextRow() {
+        row++;
+        while (batch == NULL || row >= batch->numRows) {
+            batch = fanout->nextBatch(target);
+            row = 0;
+            if (batch == NULL) {
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+    // index in items; the items are asked for in the same order for each
+    // row, so usually the next one is the expected one
+    int SageFanoutReader::findItem(DBDataSchema::DataObjDesc * thisItem) {
+        size_t n = items.size();
+
+        for (size_t k=0; k<n; k++) {
+            size_t j = (itemCursor + k) % n;
+            if (items[j] == thisItem) {
+                itemCursor = j + 1;
+                return j;
+            }
+        }
+
+        return -1;
+    }
+
+    bool SageFanoutReader::getItemInRow(DBDataSchema::DataObjDesc * thisItem, bool applyAsserters, bool applyConverters, void* result) {
+        if (thisItem->getIsConstItem()) {
+            getConstItem(thisItem, result);
+            return false;
+        }
+
+        int index = findItem(thisItem);
+        if (index < 0) {
+            printf("Something went wrong in SageFanoutReader::getItemInRow(), field %s not found ...\n", thisItem->getDataObjName().c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        memcpy(result, &batch->values[row*rowBytes + itemOffsets[index]], itemSizes[index]);
+        return batch->nulls[row*numColumns + itemColumns[index]];
+    }
+
+    void SageFanoutReader::getConstItem(DBDataSchema::DataObjDesc * thisItem, void* result) {
+        memcpy(result, thisItem->getConstData(), DBDataSchema::getByteLenOfDType(thisItem->getDataObjDType()));
+    }
+
+
+    // the columns in the batches are the non-constant items of the schema
+    // of the first target, as bound to the source reader
+    SageFanout::SageFanout(SageReader * newSource, DBDataSchema::Schema * schema) {
+        source = newSource;
+        batchRows = 4096;
+        capacity = 8;
+        firstSeq = 0;
+        closed = false;
+        waitMicrosec = 0;
+        rowBytes = 0;
+
+        vector<DBDataSchema::SchemaItem *> schemaItems = schema->getArrSchemaItems();
+        for (size_t j=0; j<schemaItems.size(); j++) {
+            DBDataSchema::DataObjDesc * item = schemaItems[j]->getDataDesc();
+            if (item->getIsConstItem() || item->getIsHeaderItem()) {
+                continue;
+            }
+            items.push_back(item);
+            columnNames.push_back(item->getDataObjName());
+            columnSizes.push_back(DBDataSchema::getByteLenOfDType(item->getDataObjDType()));
+            columnOffsets.push_back(rowBytes);
+            rowBytes += columnSizes.back();
+        }
+    }
+
+    SageFanout::~SageFanout() {
+        for (size_t t=0; t<readers.size(); t++) {
+            delete readers[t];
+        }
+        while (!batches.empty()) {
+            delete batches.front();
+            batches.pop_front();
+        }
+        for (size_t j=0; j<freeBatches.size(); j++) {
+            delete freeBatches[j];
+        }
+    }
+
+    // add a target with its own schema (for its database and table); its
+    // ingestor reads the rows from the returned reader
+    SageFanoutReader * SageFanout::addTarget(DBDataSchema::Schema * schema) {
+        readSeq.push_back(0);
+        reading.push_back(false);
+        readers.push_back(new SageFanoutReader(this, readers.size(), schema));
+        return readers.back();
+    }
+
+    // index of the column with the name and data type, -1 if there is none
+    int SageFanout::findColumn(const string &name, DBDataSchema::DType dtype) {
+        for (size_t j=0; j<items.size(); j++) {
+            if (columnNames[j] == name && items[j]->getDataObjDType() == dtype) {
+                return j;
+            }
+        }
+        return -1;
+    }
+
+    int SageFanout::getColumnSize(int column) {
+        return columnSizes[column];
+    }
+
+    long SageFanout::getColumnOffset(int column) {
+        return columnOffsets[column];
+    }
+
+    long SageFanout::getRowBytes() {
+        return rowBytes;
+    }
+
+    long SageFanout::getNumColumns() {
+        return items.size();
+    }
+
+    // The next batch for the target, after the one it had; NULL once all
+    // rows were handed out. Waits until the source has filled the batch.
+    const SageValueBatch * SageFanout::nextBatch(int target) {
+        boost::mutex::scoped_lock lock(fanoutMutex);
+
+        if (reading[target]) {
+            readSeq[target]++;
+            reading[target] = false;
+            releaseBatches();
+        }
+        while (readSeq[target] >= firstSeq + (long) batches.size() && !closed) {
+            batchAdded.wait(lock);
+        }
+        if (readSeq[target] >= firstSeq + (long) batches.size()) {
+            return NULL;
+        }
+
+        reading[target] = true;
+        return batches[readSeq[target] - firstSeq];
+    }
+
+    // recycle the batches that all targets are done with; the fanout mutex
+    // must be held
+    void SageFanout::releaseBatches() {
+        long minSeq = LONG_MAX;
+        for (size_t t=0; t<readSeq.size(); t++) {
+            minSeq = min(minSeq, readSeq[t]);
+        }
+
+        bool released = false;
+        while (!batches.empty() && firstSeq < minSeq) {
+            freeBatches.push_back(batches.front());
+            batches.pop_front();
+            firstSeq++;
+            released = true;
+        }
+        if (released) {
+            batchReleased.notify_all();
+        }
+    }
+
+    // the writer of the target returned (also if it stopped early, e.g. on
+    // an error), it does not hold back the others any longer
+    void SageFanout::finishTarget(int target) {
+        boost::mutex::scoped_lock lock(fanoutMutex);
+        readSeq[target] = LONG_MAX;
+        reading[target] = false;
+        releaseBatches();
+    }
+
+    void SageFanout::runWriter(int target, SageFanoutWriter writer) {
+        writer();
+        finishTarget(target);
+    }
+
+    // Start the writer of each target (in the order of addTarget) in its
+    // own thread, read all rows of the source into the shared batches and
+    // wait for the writers to finish. Returns the number of rows.
+    long SageFanout::run(const vector<SageFanoutWriter> &writers) {
+        vector<boost::thread *> threads;
+        long numRows = 0;
+        long numBatches = 0;
+
+        if (writers.size() != readers.size()) {
+            SageIngest_error("SageFanout: Need one writer per target.\n");
+        }
+        for (size_t t=0; t<writers.size(); t++) {
+            threads.push_back(new boost::thread(boost::bind(&SageFanout::runWriter, this, (int) t, writers[t])));
+        }
+
+        source->bindColumns(items);
+        while (true) {
+            SageValueBatch * batch;
+            {
+                boost::mutex::scoped_lock lock(fanoutMutex);
+                if (freeBatches.empty()) {
+                    batch = new SageValueBatch;
+                    batch->values.resize(max(batchRows*rowBytes, 1L));
+                    batch->nulls.resize(max(batchRows*(long) items.size(), 1L));
+                } else {
+                    batch = freeBatches.back();
+                    freeBatches.pop_back();
+                }
+            }
+
+            // filled without holding the lock, while the targets write
+            batch->numRows = source->getRows(batchRows, &batch->values[0], &batch->nulls[0], SAGE_ROW_MAJOR);
+
+            boost::mutex::scoped_lock lock(fanoutMutex);
+            if (batch->numRows == 0) {
+                freeBatches.push_back(batch);
+                break;
+            }
+            numRows += batch->numRows;
+            numBatches++;
+
+            if (batches.size() >= capacity) {
+                boost::posix_time::ptime waitStart = boost::posix_time::microsec_clock::universal_time();
+                while (batches.size() >= capacity) {
+                    batchReleased.wait(lock);
+                }
+                waitMicrosec += (boost::posix_time::microsec_clock::universal_time() - waitStart).total_microseconds();
+            }
+            batches.push_back(batch);
+            // right away, if all targets are finished already
+            releaseBatches();
+            batchAdded.notify_all();
+        }
+
+        {
+            boost::mutex::scoped_lock lock(fanoutMutex);
+            closed = true;
+            batchAdded.notify_all();
+        }
+        for (size_t t=0; t<threads.size(); t++) {
+            threads[t]->join();
+            delete threads[t];
+        }
+
+        printf("Fan-out: %ld rows in %ld batches to %ld targets, the reader waited %.1f s for the slowest target\n",
+            numRows, numBatches, (long) readers.size(), waitMicrosec/1e6);
+
+        return numRows;
+    }
+
+}
@@ -0,0 +1,137 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <Reader.h>
+#include <Schema.h>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "Sage_Reader.h"
+
+#ifndef Sage_Sage_Fanout_h
+#define Sage_Sage_Fanout_h
+
+using namespace std;
+
+namespace Sage {
+
+    class SageFanout;
+
+    // rows with the values of all columns (row-major, as from
+    // SageReader::getRows), shared by all targets
+    typedef struct {
+        vector<char> values;
+        vector<char> nulls;
+        long numRows;
+    } SageValueBatch;
+
+    // Reader for one target of the fan-out: hands out the rows of the shared
+    // batches, the values were computed once by the source reader.
+    class SageFanoutReader : public DBReader::Reader {
+    private:
+        SageFanout * fanout;
+        int target;
+        const SageValueBatch * batch;
+        long row; // in the batch
+
+        vector<DBDataSchema::DataObjDesc *> items; // non-constant items of the target's schema
+        vector<int> itemColumns; // column in the batches for each of items
+        vector<long> itemOffsets; // of the value of each of items within a row
+        vector<int> itemSizes;
+        long rowBytes;
+        long numColumns;
+        size_t itemCursor;
+
+        int findItem(DBDataSchema::DataObjDesc * thisItem);
+
+    public:
+        SageFanoutReader(SageFanout * newFanout, int newTarget, DBDataSchema::Schema * schema);
+        ~SageFanoutReader();
+
+        void openFile(string newFileName);
+        void closeFile();
+
+        int getNextRow();
+        bool getItemInRow(DBDataSchema::DataObjDesc * thisItem, bool applyAsserters, bool applyConverters, void* result);
+        void getConstItem(DBDataSchema::DataObjDesc * thisItem, void* result);
+    };
+
+    // writes the rows of one target, e.g. DBIngestor::ingestData bound to
+    // the ingestor of the target
+    typedef boost::function<void ()> SageFanoutWriter;
+
+    // Feeds several database targets from a single pass over a data file:
+    // the source reader fills batches of rows with the values of all columns
+    // once, and each target gets them through its own SageFanoutReader, with
+    // its own ingestor and thread. The batches are kept until all targets
+    // have read them; at most capacity batches are kept, so a slow target
+    // makes the source wait instead of collecting all rows in memory.
+    class SageFanout {
+    private:
+        SageReader * source;
+        vector<DBDataSchema::DataObjDesc *> items; // the columns in the batches
+        vector<string> columnNames;
+        vector<int> columnSizes;
+        vector<long> columnOffsets;
+        long rowBytes;
+        long batchRows;
+        size_t capacity;
+
+        vector<SageFanoutReader *> readers;
+
+        boost::mutex fanoutMutex;
+        boost::condition_variable batchAdded;
+        boost::condition_variable batchReleased;
+        deque<SageValueBatch *> batches;
+        vector<SageValueBatch *> freeBatches;
+        long firstSeq;          // number of the first batch in batches
+        vector<long> readSeq;   // number of the batch each target reads (or reads next)
+        vector<bool> reading;   // the target has a batch in hand
+        bool closed;
+
+        long waitMicrosec;      // the source waited for the slowest target
+
+        void releaseBatches();
+        void finishTarget(int target);
+        void runWriter(int target, SageFanoutWriter writer);
+
+    public:
+        SageFanout(SageReader * newSource, DBDataSchema::Schema * schema);
+        ~SageFanout();
+
+        SageFanoutReader * addTarget(DBDataSchema::Schema * schema);
+        int findColumn(const string &name, DBDataSchema::DType dtype);
+        int getColumnSize(int column);
+        long getColumnOffset(int column);
+        long getRowBytes();
+        long getNumColumns();
+
+        const SageValueBatch * nextBatch(int target);
+
+        long run(const vector<SageFanoutWriter> &writers);
+    };
+
+}
+
+#endif
@@ -0,0 +1,551 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sstream>
+#include <algorithm>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "sageingest_error.h"
+#include "Sage_FileIO.h"
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+using namespace std;
+
+namespace Sage {
+
+    SageFileIO::SageFileIO(string fileName, SageIOMode newMode, long newReadahead, int newQueueDepth) {
+        mode = newMode;
+        readahead = newReadahead;
+        queueDepth = max(1, newQueueDepth);
+        ring = NULL;
+        fixedBuffers = false;
+        headSlot = 0;
+        numInFlight = 0;
+        nextOffset = 0;
+        pos = 0;
+        adviseEnd = 0;
+        dropStart = 0;
+        alignment = 4096;
+        buffer = NULL;
+        bufferSize = 0;
+        bufferStart = 0;
+        bufferEnd = 0;
+        numReads = 0;
+        numBytes = 0;
+        ownsFd = true;
+
+        if (mode == SAGE_IO_PIPE) {
+            openPipe(fileName);
+            return;
+        }
+
+        int flags = O_RDONLY;
+#ifdef O_DIRECT
+        if (mode == SAGE_IO_DIRECT) {
+            flags |= O_DIRECT;
+        }
+#else
+        if (mode == SAGE_IO_DIRECT) {
+            printf("WARNING: O_DIRECT is not available here, reading with fadvise instead.\n");
+            mode = SAGE_IO_FADVISE;
+        }
+#endif
+        fd = open(fileName.c_str(), flags);
+        if (fd < 0 && mode == SAGE_IO_DIRECT && errno == EINVAL) {
+            // e.g. tmpfs does not support O_DIRECT
+            printf("WARNING: %s cannot be opened with O_DIRECT, reading with fadvise instead.\n", fileName.c_str());
+            mode = SAGE_IO_FADVISE;
+            fd = open(fileName.c_str(), O_RDONLY);
+        }
+        if (fd < 0) {
+            ostringstream message;
+            message << "SageFileIO: Cannot open " << fileName << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        struct stat status;
+        fstat(fd, &status);
+        fileSize = status.st_size;
+
+        if (mode == SAGE_IO_DIRECT) {
+            // the block size of the file system, if it is a power of 2
+            if (status.st_blksize >= 512 && (status.st_blksize & (status.st_blksize - 1)) == 0) {
+                alignment = status.st_blksize;
+            }
+            bufferSize = max(alignment, (min(readahead, fileSize) + alignment - 1)/alignment*alignment);
+            void * memory = NULL;
+            if (posix_memalign(&memory, max(alignment, 4096L), bufferSize) != 0) {
+                SageIngest_error("SageFileIO: Cannot allocate the buffer for O_DIRECT.\n");
+            }
+            buffer = (char *) memory;
+        }
+        if (mode == SAGE_IO_URING && !initUring()) {
+            mode = SAGE_IO_FADVISE;
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (mode == SAGE_IO_FADVISE || mode == SAGE_IO_URING) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+#endif
+    }
+
+    // Open the pipe (blocks until there is a writer) or take stdin for "-",
+    // with a pipe buffer of readahead bytes if the system allows it. This
+    // and the block buffers of the reader are all that is buffered.
+    void SageFileIO::openPipe(string fileName) {
+        if (fileName == "-") {
+            fd = 0;
+            ownsFd = false;
+        } else {
+            fd = open(fileName.c_str(), O_RDONLY);
+        }
+        if (fd < 0) {
+            ostringstream message;
+            message << "SageFileIO: Cannot open " << fileName << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+        fileSize = -1;
+#ifdef F_SETPIPE_SZ
+        fcntl(fd, F_SETPIPE_SZ, (int) min(readahead, 1L << 30));
+#endif
+    }
+
+    SageFileIO::~SageFileIO() {
+        exitUring();
+        if (fd >= 0 && ownsFd) {
+            close(fd);
+        }
+        free(buffer);
+    }
+
+    // pread until n bytes or the end of the file, returns the number of bytes
+    long SageFileIO::readAt(char * data, long n, long offset) {
+        long done = 0;
+        while (done < n) {
+            ssize_t got = pread(fd, data + done, n - done, offset + done);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                ostringstream message;
+                message << "SageFileIO: Error reading at offset " << offset + done << " (" << strerror(errno) << ")." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            numReads++;
+            if (got == 0) {
+                break;
+            }
+            done += got;
+            if (mode == SAGE_IO_DIRECT) {
+                // only whole aligned reads may continue, the rest is the end of the file
+                break;
+            }
+        }
+        return done;
+    }
+
+    // Keep readahead bytes ahead of the next n bytes and drop the pages
+    // before the current position, which were copied already.
+    void SageFileIO::advise(long n) {
+#ifdef POSIX_FADV_WILLNEED
+        if (pos + n > adviseEnd - readahead/2) {
+            long start = max(pos, adviseEnd);
+            long length = max(readahead, pos + n - start);
+            posix_fadvise(fd, start, length, POSIX_FADV_WILLNEED);
+            adviseEnd = start + length;
+        }
+        long pageSize = sysconf(_SC_PAGESIZE);
+        long dropEnd = pos/pageSize*pageSize;
+        if (dropEnd > dropStart) {
+            posix_fadvise(fd, dropStart, dropEnd - dropStart, POSIX_FADV_DONTNEED);
+            dropStart = dropEnd;
+        }
+#endif
+    }
+
+    // read until n bytes or the end of the stream, the writer may hand
+    // them over in pieces of any size
+    long SageFileIO::readStream(char * data, long n) {
+        long done = 0;
+        while (done < n) {
+            ssize_t got = ::read(fd, data + done, n - done);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                ostringstream message;
+                message << "SageFileIO: Error reading from pipe (" << strerror(errno) << ")." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            numReads++;
+            if (got == 0) {
+                break;
+            }
+            done += got;
+        }
+        return done;
+    }
+
+    // Read the next n bytes (less at the end of the file), returns their
+    // number.
+    long SageFileIO::read(char * data, long n) {
+        long done = 0;
+
+        // the bytes looked at by peek first
+        long nPeeked = min(n, (long) peeked.size());
+        if (nPeeked > 0) {
+            memcpy(data, &peeked[0], nPeeked);
+            peeked.erase(peeked.begin(), peeked.begin() + nPeeked);
+            pos += nPeeked;
+            numBytes += nPeeked;
+            data += nPeeked;
+            n -= nPeeked;
+            if (n == 0) {
+                return nPeeked;
+            }
+        }
+
+        if (mode == SAGE_IO_PIPE) {
+            done = readStream(data, n);
+            pos += done;
+        } else if (mode == SAGE_IO_URING) {
+            done = readUring(data, n);
+        } else if (mode == SAGE_IO_FADVISE) {
+            advise(n);
+            done = readAt(data, n, pos);
+            pos += done;
+        } else {
+            while (done < n) {
+                if (pos >= bufferStart && pos < bufferEnd) {
+                    long count = min(n - done, bufferEnd - pos);
+                    memcpy(data + done, buffer + (pos - bufferStart), count);
+                    pos += count;
+                    done += count;
+                    continue;
+                }
+                if (pos >= fileSize) {
+                    break;
+                }
+                bufferStart = pos/alignment*alignment;
+                bufferEnd = bufferStart + readAt(buffer, bufferSize, bufferStart);
+                if (bufferEnd <= pos) {
+                    break;
+                }
+            }
+        }
+
+        numBytes += done;
+        if (mode == SAGE_IO_FADVISE) {
+            advise(0);
+        }
+        return nPeeked + done;
+    }
+
+    // Read the next n bytes without consuming them, i.e. the next read
+    // returns them again.
+    long SageFileIO::peek(char * data, long n) {
+        long got = read(data, n);
+        peeked.insert(peeked.begin(), data, data + got);
+        pos -= got;
+        numBytes -= got;
+        return got;
+    }
+
+    void SageFileIO::seek(long offset) {
+        if (mode == SAGE_IO_PIPE && offset != pos) {
+            SageIngest_error("SageFileIO: Cannot seek in a pipe.\n");
+        }
+        if (offset != pos) {
+            peeked.clear();
+        }
+        if (mode == SAGE_IO_URING && offset != pos) {
+            // the reads in flight are for the old position
+            drainUring();
+        }
+        pos = offset;
+        if (mode == SAGE_IO_FADVISE) {
+            // the pages before the new position are not needed any more
+            adviseEnd = pos;
+            advise(0);
+        }
+    }
+
+    long SageFileIO::tell() const {
+        return pos;
+    }
+
+    SageIOMode SageFileIO::getMode() const {
+        return mode;
+    }
+
+    void SageFileIO::report() const {
+        printf("File I/O (%s): %ld MB in %ld reads of up to %ld kB", getModeName(mode),
+            numBytes/(1024*1024), numReads, (mode == SAGE_IO_DIRECT ? bufferSize : readahead)/1024);
+        if (mode == SAGE_IO_URING) {
+            printf(", queue depth %d%s", queueDepth, fixedBuffers ? ", registered buffers" : "");
+        }
+        printf("\n");
+    }
+
+    bool SageFileIO::initUring() {
+#ifdef HAVE_LIBURING
+        ring = new struct io_uring;
+        int result = io_uring_queue_init(queueDepth, ring, 0);
+        if (result < 0) {
+            printf("WARNING: io_uring is not available (%s), reading with fadvise instead.\n", strerror(-result));
+            delete ring;
+            ring = NULL;
+            return false;
+        }
+
+        UringSlot noSlot = {NULL, 0, 0, 0, true};
+        slots.assign(queueDepth, noSlot);
+        vector<struct iovec> buffers(queueDepth);
+        for (int k=0; k<queueDepth; k++) {
+            void * memory = NULL;
+            if (posix_memalign(&memory, 4096, readahead) != 0) {
+                SageIngest_error("SageFileIO: Cannot allocate the buffers for io_uring.\n");
+            }
+            slots[k].data = (char *) memory;
+            buffers[k].iov_base = memory;
+            buffers[k].iov_len = readahead;
+        }
+        // registering may fail e.g. because of the limit of locked memory,
+        // the reads then go to the buffers without registering them
+        fixedBuffers = io_uring_register_buffers(ring, &buffers[0], queueDepth) == 0;
+        return true;
+#else
+        printf("WARNING: built without liburing, reading with fadvise instead of io_uring.\n");
+        return false;
+#endif
+    }
+
+    void SageFileIO::exitUring() {
+#ifdef HAVE_LIBURING
+        if (ring == NULL) {
+            return;
+        }
+        // the kernel may still write to the buffers of unfinished reads
+        drainUring();
+        io_uring_queue_exit(ring);
+        delete ring;
+        ring = NULL;
+        for (size_t k=0; k<slots.size(); k++) {
+            free(slots[k].data);
+        }
+        slots.clear();
+#endif
+    }
+
+    // Copy the next n bytes from the reads in flight, in file order; reads
+    // more as soon as a buffer is consumed.
+    long SageFileIO::readUring(char * data, long n) {
+        long done = 0;
+
+        while (done < n) {
+            if (numInFlight == 0) {
+                if (pos >= fileSize) {
+                    break;
+                }
+                nextOffset = pos;
+                submitUring();
+            }
+
+            UringSlot &slot = slots[headSlot];
+            while (!slot.done) {
+                waitUring();
+            }
+
+            long end = slot.offset + slot.result;
+            if (pos >= slot.offset && pos < end) {
+                long count = min(n - done, end - pos);
+                memcpy(data + done, slot.data + (pos - slot.offset), count);
+                pos += count;
+                done += count;
+            }
+            if (pos < end) {
+                continue;
+            }
+
+            // consumed, the slot takes the next read
+            headSlot = (headSlot + 1) % queueDepth;
+            numInFlight--;
+            if (slot.result < slot.length) {
+                // short read: the following reads do not continue where this
+                // one ended, start again at pos (or stop at the end of the file)
+                drainUring();
+                if (slot.result == 0) {
+                    break;
+                }
+            } else {
+                submitUring();
+            }
+        }
+
+        return done;
+    }
+
+    // fill the free slots with the reads following the last one
+    void SageFileIO::submitUring() {
+#ifdef HAVE_LIBURING
+        int numSubmitted = 0;
+        while (numInFlight < queueDepth && nextOffset < fileSize) {
+            int k = (headSlot + numInFlight) % queueDepth;
+            struct io_uring_sqe * sqe = io_uring_get_sqe(ring);
+            if (sqe == NULL) {
+                break;
+            }
+            UringSlot &slot = slots[k];
+            slot.offset = nextOffset;
+            slot.length = min(readahead, fileSize - nextOffset);
+            slot.result = 0;
+            slot.done = false;
+            if (fixedBuffers) {
+                io_uring_prep_read_fixed(sqe, fd, slot.data, slot.length, slot.offset, k);
+            } else {
+                io_uring_prep_read(sqe, fd, slot.data, slot.length, slot.offset);
+            }
+            io_uring_sqe_set_data(sqe, &slot);
+            nextOffset += slot.length;
+            numInFlight++;
+            numSubmitted++;
+        }
+        if (numSubmitted > 0) {
+            int result = io_uring_submit(ring);
+            if (result < 0) {
+                ostringstream message;
+                message << "SageFileIO: Cannot submit reads to io_uring (" << strerror(-result) << ")." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            numReads += numSubmitted;
+        }
+#endif
+    }
+
+    // wait for one read to complete, in any order
+    void SageFileIO::waitUring() {
+#ifdef HAVE_LIBURING
+        struct io_uring_cqe * cqe;
+        int result;
+        do {
+            result = io_uring_wait_cqe(ring, &cqe);
+        } while (result == -EINTR);
+        if (result < 0) {
+            ostringstream message;
+            message << "SageFileIO: Error waiting for io_uring (" << strerror(-result) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        UringSlot * slot = (UringSlot *) io_uring_cqe_get_data(cqe);
+        slot->result = cqe->res;
+        slot->done = true;
+        io_uring_cqe_seen(ring, cqe);
+        if (slot->result < 0) {
+            ostringstream message;
+            message << "SageFileIO: Error reading at offset " << slot->offset << " (" << strerror(-slot->result) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+#endif
+    }
+
+    // wait for all reads in flight and forget them
+    void SageFileIO::drainUring() {
+        for (int i=0; i<numInFlight; i++) {
+            while (!slots[(headSlot + i) % queueDepth].done) {
+                waitUring();
+            }
+        }
+        numInFlight = 0;
+    }
+
+    // Read the file with io_uring at queue depths 1, 2, 4, ... and with
+    // plain synchronous reads, readSize bytes at a time, and print the MB/s
+    // of each. The file is dropped from the page cache before each pass, as
+    // far as the kernel allows.
+    void SageFileIO::benchmark(string fileName, long readSize, int maxQueueDepth) {
+        vector<char> data(readSize);
+
+        printf("I/O benchmark of %s, reads of %ld kB\n", fileName.c_str(), readSize/1024);
+        for (int depth=0; depth<=maxQueueDepth; depth=max(1, 2*depth)) {
+            SageFileIO io(fileName, depth == 0 ? SAGE_IO_FADVISE : SAGE_IO_URING, readSize, depth);
+            if (depth > 0 && io.getMode() != SAGE_IO_URING) {
+                break;
+            }
+#ifdef POSIX_FADV_DONTNEED
+            posix_fadvise(io.fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+            boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+            long total = 0;
+            long n;
+            while ((n = io.read(&data[0], readSize)) > 0) {
+                total += n;
+            }
+            double seconds = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()/1.e6;
+
+            if (depth == 0) {
+                printf("  synchronous:    ");
+            } else {
+                printf("  queue depth %3d:", depth);
+            }
+            printf(" %ld MB in %.3f s, %.0f MB/s\n", total/(1024*1024), seconds, seconds > 0 ? total/(1024*1024)/seconds : 0.);
+        }
+    }
+
+    SageIOMode SageFileIO::parseMode(string name) {
+        if (name == "stream") {
+            return SAGE_IO_STREAM;
+        } else if (name == "fadvise") {
+            return SAGE_IO_FADVISE;
+        } else if (name == "direct") {
+            return SAGE_IO_DIRECT;
+        } else if (name == "uring") {
+            return SAGE_IO_URING;
+        }
+        ostringstream message;
+        message << "Unknown I/O mode " << name << ", use stream, fadvise, direct or uring." << endl;
+        SageIngest_error(message.str().c_str());
+        return SAGE_IO_STREAM;
+    }
+
+    const char * SageFileIO::getModeName(SageIOMode mode) {
+        switch (mode) {
+            case SAGE_IO_FADVISE:
+                return "fadvise";
+            case SAGE_IO_DIRECT:
+                return "direct";
+            case SAGE_IO_URING:
+                return "uring";
+            case SAGE_IO_PIPE:
+                return "pipe";
+            default:
+                return "stream";
+        }
+    }
+
+}
@@ -0,0 +1,124 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+struct io_uring;
+
+#ifndef Sage_Sage_FileIO_h
+#define Sage_Sage_FileIO_h
+
+namespace Sage {
+
+    // How the rows of a binary file are read (see SageReader::setIOMode):
+    // through the ifstream as always, with posix_fadvise (sequential, an
+    // explicit readahead window and the consumed pages dropped from the page
+    // cache), with O_DIRECT, bypassing the page cache, or with io_uring,
+    // keeping several reads in flight. Pipes and stdin are always read
+    // sequentially with plain reads (SAGE_IO_PIPE, see SageReader::isPipe).
+    enum SageIOMode {
+        SAGE_IO_STREAM,
+        SAGE_IO_FADVISE,
+        SAGE_IO_DIRECT,
+        SAGE_IO_URING,
+        SAGE_IO_PIPE
+    };
+
+    // Reads a file sequentially (with seeks for selected trees) without
+    // filling the page cache, for the fadvise and direct modes. The rows
+    // start right after the header, which is not aligned, so in direct mode
+    // they are read by aligned reads of the readahead size into an aligned
+    // buffer and copied out from there.
+    // With io_uring (only if built with liburing), queueDepth reads of
+    // readSize bytes following the current position are in flight, each into
+    // its own registered buffer; they are consumed in the order of the file,
+    // whatever order they complete in. Without liburing, or if the kernel
+    // does not support it, the file is read with fadvise instead.
+    // A pipe ("-" for stdin) cannot seek; the data arrives in reads of any
+    // size, which are repeated until the requested bytes or the end of the
+    // stream. peek allows to look at the first row without consuming it.
+    class SageFileIO {
+    private:
+        // one read of the io_uring mode
+        typedef struct {
+            char * data;
+            long offset;
+            long length;   // requested
+            long result;   // bytes read, once done
+            bool done;
+        } UringSlot;
+
+        int fd;
+        bool ownsFd;       // not for stdin
+        SageIOMode mode;
+        long pos;          // offset of the next byte to read
+        long fileSize;     // -1 for a pipe
+        long readahead;    // bytes; size of each read for io_uring
+        long adviseEnd;    // end of the range the kernel was asked to read ahead (fadvise)
+        long dropStart;    // start of the consumed pages still in the page cache (fadvise)
+        long alignment;    // of offsets, sizes and addresses for O_DIRECT
+        char * buffer;     // aligned, bufferSize bytes (direct)
+        long bufferSize;
+        long bufferStart;  // file offset of the contents of buffer
+        long bufferEnd;
+        long numReads;
+        long numBytes;
+        std::vector<char> peeked; // returned by the next read, before reading more (pipe)
+
+        struct io_uring * ring;
+        bool fixedBuffers;  // the buffers of the slots are registered with the ring
+        std::vector<UringSlot> slots;
+        int queueDepth;
+        int headSlot;       // slot of the next read in file order
+        int numInFlight;    // submitted reads from headSlot on, done or not
+        long nextOffset;    // of the next read to submit
+
+        long readAt(char * data, long n, long offset);
+        long readStream(char * data, long n);
+        void openPipe(std::string fileName);
+        void advise(long n);
+        bool initUring();
+        void exitUring();
+        long readUring(char * data, long n);
+        void submitUring();
+        void waitUring();
+        void drainUring();
+
+    public:
+        SageFileIO(std::string fileName, SageIOMode newMode, long newReadahead, int newQueueDepth);
+        ~SageFileIO();
+
+        long read(char * data, long n);
+        long peek(char * data, long n);
+        void seek(long offset);
+        long tell() const;
+
+        SageIOMode getMode() const;
+        void report() const;
+
+        static SageIOMode parseMode(std::string name);
+        static const char * getModeName(SageIOMode mode);
+        static void benchmark(std::string fileName, long readSize, int maxQueueDepth);
+    };
+
+}
+
+#endif
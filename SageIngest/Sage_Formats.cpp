@@ -0,0 +1,82 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include "Sage_Formats.h"
+
+using namespace std;
+
+namespace Sage {
+
+#define SAGE_FORMAT(name, description, Layout, native) \
+    { name, description, sizeof(Layout::Record), native, \
+      &decodeBlock<Layout, false>, &decodeBlock<Layout, true>, &Layout::getFields }
+
+    static const SageFormat formats[] = {
+        SAGE_FORMAT("mdpl2", "MDPL2/SMDPL catalogues (8-byte aligned, with Ctrees IDs)", SageLayoutMDPL2, true),
+        SAGE_FORMAT("mdpl2_packed", "as mdpl2, but without padding", SageLayoutMDPL2Packed, false),
+        SAGE_FORMAT("sage2016", "public SAGE release (Croton et al. 2016)", SageLayoutSage2016, false)
+    };
+
+#undef SAGE_FORMAT
+
+    // the native layout is read directly into GalaxyData
+    typedef char assertNativeLayoutSize[sizeof(SageRecordMDPL2) == sizeof(GalaxyData) ? 1 : -1];
+
+    const SageFormat * findFormat(string name) {
+        for (size_t i=0; i<sizeof(formats)/sizeof(formats[0]); i++) {
+            if (name.compare(formats[i].name) == 0) {
+                return &formats[i];
+            }
+        }
+        return NULL;
+    }
+
+    // Find the format(s) whose record size fits the file size, given the
+    // size of the file header and the number of rows from the header.
+    // Returns the first match (or NULL) and the number of matches.
+    const SageFormat * probeFormat(long fileSize, long headerSize, long numRows, int &numMatches) {
+        const SageFormat * match = NULL;
+
+        numMatches = 0;
+        for (size_t i=0; i<sizeof(formats)/sizeof(formats[0]); i++) {
+            if (headerSize + numRows*(long) formats[i].recordSize == fileSize) {
+                if (match == NULL) {
+                    match = &formats[i];
+                }
+                numMatches++;
+            }
+        }
+
+        return match;
+    }
+
+    string getFormatNames() {
+        string names;
+        for (size_t i=0; i<sizeof(formats)/sizeof(formats[0]); i++) {
+            if (i > 0) {
+                names.append(", ");
+            }
+            names.append(formats[i].name);
+        }
+        return names;
+    }
+
+}
@@ -0,0 +1,262 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include "Sage_Reader.h"
+#include <string.h>
+#include <stddef.h>
+#include <string>
+
+#ifndef Sage_Sage_Formats_h
+#define Sage_Sage_Formats_h
+
+namespace Sage {
+
+    // Record layouts of the different SAGE releases.
+    // Each layout is given as a list of its fields in file order:
+    //   F(type, name, target)      field that goes to GalaxyData::target
+    //   N(type, name)              field only present in this layout (ignored)
+    //   A(type, name, len, target) array field that goes to GalaxyData::target
+    // From this list, the record structure, the field descriptors and the
+    // decode function (including byteswapping) are generated at compile time.
+    // Fields of GalaxyData missing in a layout are set to 0.
+    // To support a new release, add its field list, a record type with the
+    // right alignment and an entry in the format table in Sage_Formats.cpp.
+
+    // MDPL2/SMDPL catalogues, written with 8-byte alignment
+    // (4 padding bytes after TreeIndex); same as GalaxyData
+#define SAGE_LAYOUT_MDPL2(F, N, A) \
+    F(int, SnapNum, SnapNum) \
+    F(int, Type, Type) \
+    F(long, GalaxyIndex, GalaxyIndex) \
+    F(long, CentralGalaxyIndex, CentralGalaxyIndex) \
+    F(long, CtreesHaloID, CtreesHaloID) \
+    F(int, TreeIndex, TreeIndex) \
+    F(long, CtreesCentralID, CtreesCentralID) \
+    F(int, mergeType, mergeType) \
+    F(int, mergeIntoID, mergeIntoID) \
+    F(int, mergeIntoSnapNum, mergeIntoSnapNum) \
+    F(float, dT, dT) \
+    A(float, Pos, 3, Pos) \
+    A(float, Vel, 3, Vel) \
+    A(float, Spin, 3, Spin) \
+    F(int, Len, Len) \
+    F(float, Mvir, Mvir) \
+    F(float, CentralMvir, CentralMvir) \
+    F(float, Rvir, Rvir) \
+    F(float, Vvir, Vvir) \
+    F(float, Vmax, Vmax) \
+    F(float, VelDisp, VelDisp) \
+    F(float, ColdGas, ColdGas) \
+    F(float, StellarMass, StellarMass) \
+    F(float, BulgeMass, BulgeMass) \
+    F(float, HotGas, HotGas) \
+    F(float, EjectedMass, EjectedMass) \
+    F(float, BlackHoleMass, BlackHoleMass) \
+    F(float, IntraClusterStars, IntraClusterStars) \
+    F(float, MetalsColdGas, MetalsColdGas) \
+    F(float, MetalsStellarMass, MetalsStellarMass) \
+    F(float, MetalsBulgeMass, MetalsBulgeMass) \
+    F(float, MetalsHotGas, MetalsHotGas) \
+    F(float, MetalsEjectedMass, MetalsEjectedMass) \
+    F(float, MetalsIntraClusterStars, MetalsIntraClusterStars) \
+    F(float, SfrDisk, SfrDisk) \
+    F(float, SfrBulge, SfrBulge) \
+    F(float, SfrDiskZ, SfrDiskZ) \
+    F(float, SfrBulgeZ, SfrBulgeZ) \
+    F(float, DiskRadius, DiskRadius) \
+    F(float, Cooling, Cooling) \
+    F(float, Heating, Heating) \
+    F(float, QuasarModeBHaccretionMass, QuasarModeBHaccretionMass) \
+    F(float, TimeOfLastMajorMerger, TimeOfLastMajorMerger) \
+    F(float, TimeOfLastMinorMerger, TimeOfLastMinorMerger) \
+    F(float, OutflowRate, OutflowRate) \
+    F(float, MeanStarAge, MeanStarAge) \
+    F(float, infallMvir, infallMvir) \
+    F(float, infallVvir, infallVvir) \
+    F(float, infallVmax, infallVmax)
+
+    // public SAGE release (Croton et al. 2016, GALAXY_OUTPUT in core_allvars.h);
+    // no Ctrees IDs and no MeanStarAge, the simulation halo ID is used as
+    // CtreesHaloID
+#define SAGE_LAYOUT_SAGE2016(F, N, A) \
+    F(int, SnapNum, SnapNum) \
+    F(int, Type, Type) \
+    F(long, GalaxyIndex, GalaxyIndex) \
+    F(long, CentralGalaxyIndex, CentralGalaxyIndex) \
+    N(int, SAGEHaloIndex) \
+    F(int, SAGETreeIndex, TreeIndex) \
+    F(long, SimulationHaloIndex, CtreesHaloID) \
+    F(int, mergeType, mergeType) \
+    F(int, mergeIntoID, mergeIntoID) \
+    F(int, mergeIntoSnapNum, mergeIntoSnapNum) \
+    F(float, dT, dT) \
+    A(float, Pos, 3, Pos) \
+    A(float, Vel, 3, Vel) \
+    A(float, Spin, 3, Spin) \
+    F(int, Len, Len) \
+    F(float, Mvir, Mvir) \
+    F(float, CentralMvir, CentralMvir) \
+    F(float, Rvir, Rvir) \
+    F(float, Vvir, Vvir) \
+    F(float, Vmax, Vmax) \
+    F(float, VelDisp, VelDisp) \
+    F(float, ColdGas, ColdGas) \
+    F(float, StellarMass, StellarMass) \
+    F(float, BulgeMass, BulgeMass) \
+    F(float, HotGas, HotGas) \
+    F(float, EjectedMass, EjectedMass) \
+    F(float, BlackHoleMass, BlackHoleMass) \
+    F(float, IntraClusterStars, IntraClusterStars) \
+    F(float, MetalsColdGas, MetalsColdGas) \
+    F(float, MetalsStellarMass, MetalsStellarMass) \
+    F(float, MetalsBulgeMass, MetalsBulgeMass) \
+    F(float, MetalsHotGas, MetalsHotGas) \
+    F(float, MetalsEjectedMass, MetalsEjectedMass) \
+    F(float, MetalsIntraClusterStars, MetalsIntraClusterStars) \
+    F(float, SfrDisk, SfrDisk) \
+    F(float, SfrBulge, SfrBulge) \
+    F(float, SfrDiskZ, SfrDiskZ) \
+    F(float, SfrBulgeZ, SfrBulgeZ) \
+    F(float, DiskRadius, DiskRadius) \
+    F(float, Cooling, Cooling) \
+    F(float, Heating, Heating) \
+    F(float, QuasarModeBHaccretionMass, QuasarModeBHaccretionMass) \
+    F(float, TimeOfLastMajorMerger, TimeOfLastMajorMerger) \
+    F(float, TimeOfLastMinorMerger, TimeOfLastMinorMerger) \
+    F(float, OutflowRate, OutflowRate) \
+    F(float, infallMvir, infallMvir) \
+    F(float, infallVvir, infallVvir) \
+    F(float, infallVmax, infallVmax)
+
+#define SAGE_DECLARE_FIELD(type, name, target) type name;
+#define SAGE_DECLARE_ONLY(type, name) type name;
+#define SAGE_DECLARE_ARRAY(type, name, len, target) type name[len];
+
+#pragma pack(push)
+#pragma pack(8)
+    typedef struct {
+        SAGE_LAYOUT_MDPL2(SAGE_DECLARE_FIELD, SAGE_DECLARE_ONLY, SAGE_DECLARE_ARRAY)
+    } SageRecordMDPL2;
+
+    typedef struct {
+        SAGE_LAYOUT_SAGE2016(SAGE_DECLARE_FIELD, SAGE_DECLARE_ONLY, SAGE_DECLARE_ARRAY)
+    } SageRecordSage2016;
+#pragma pack(1)
+    // same as MDPL2, but written without any padding
+    typedef struct {
+        SAGE_LAYOUT_MDPL2(SAGE_DECLARE_FIELD, SAGE_DECLARE_ONLY, SAGE_DECLARE_ARRAY)
+    } SageRecordMDPL2Packed;
+#pragma pack(pop)
+
+#undef SAGE_DECLARE_FIELD
+#undef SAGE_DECLARE_ONLY
+#undef SAGE_DECLARE_ARRAY
+
+    // byteswap a value of any size; the check of Swap is resolved at compile time
+    template<bool Swap, class T> inline T swapValue(T value) {
+        if (!Swap) {
+            return value;
+        }
+        T swapped;
+        const unsigned char * src = (const unsigned char *) &value;
+        unsigned char * dst = (unsigned char *) &swapped;
+        for (size_t i=0; i<sizeof(T); i++) {
+            dst[i] = src[sizeof(T)-1-i];
+        }
+        return swapped;
+    }
+
+    // description of one field of a record layout
+    typedef struct {
+        const char * name;
+        size_t offset;
+        size_t size;
+        int len;
+    } SageLayoutField;
+
+#define SAGE_DECODE_FIELD(type, name, target) gal.target = swapValue<Swap>(rec.name);
+#define SAGE_DECODE_ONLY(type, name)
+#define SAGE_DECODE_ARRAY(type, name, len, target) for (int k=0; k<len; k++) { gal.target[k] = swapValue<Swap>(rec.name[k]); }
+#define SAGE_DESCRIBE_FIELD(type, name, target) { #name, offsetof(Record, name), sizeof(type), 1 },
+#define SAGE_DESCRIBE_ONLY(type, name) { #name, offsetof(Record, name), sizeof(type), 1 },
+#define SAGE_DESCRIBE_ARRAY(type, name, len, target) { #name, offsetof(Record, name), sizeof(type), len },
+
+#define SAGE_DEFINE_LAYOUT(Layout, RecordType, FIELDS, isComplete) \
+    struct Layout { \
+        typedef RecordType Record; \
+        static const bool complete = isComplete; \
+        template<bool Swap> static inline void decode(const Record & rec, GalaxyData & gal) { \
+            FIELDS(SAGE_DECODE_FIELD, SAGE_DECODE_ONLY, SAGE_DECODE_ARRAY) \
+        } \
+        static const SageLayoutField * getFields(int &numFields) { \
+            static const SageLayoutField fields[] = { \
+                FIELDS(SAGE_DESCRIBE_FIELD, SAGE_DESCRIBE_ONLY, SAGE_DESCRIBE_ARRAY) \
+            }; \
+            numFields = sizeof(fields)/sizeof(fields[0]); \
+            return fields; \
+        } \
+    };
+
+    SAGE_DEFINE_LAYOUT(SageLayoutMDPL2, SageRecordMDPL2, SAGE_LAYOUT_MDPL2, true)
+    SAGE_DEFINE_LAYOUT(SageLayoutMDPL2Packed, SageRecordMDPL2Packed, SAGE_LAYOUT_MDPL2, true)
+    SAGE_DEFINE_LAYOUT(SageLayoutSage2016, SageRecordSage2016, SAGE_LAYOUT_SAGE2016, false)
+
+#undef SAGE_DEFINE_LAYOUT
+#undef SAGE_DECODE_FIELD
+#undef SAGE_DECODE_ONLY
+#undef SAGE_DECODE_ARRAY
+#undef SAGE_DESCRIBE_FIELD
+#undef SAGE_DESCRIBE_ONLY
+#undef SAGE_DESCRIBE_ARRAY
+
+    // Decode n records of the given layout into GalaxyData rows
+    // (raw and out must be different buffers).
+    template<class Layout, bool Swap> void decodeBlock(const char * raw, long n, GalaxyData * out) {
+        const typename Layout::Record * records = (const typename Layout::Record *) raw;
+
+        if (!Layout::complete) {
+            memset(out, 0, n*sizeof(GalaxyData));
+        }
+        for (long i=0; i<n; i++) {
+            Layout::template decode<Swap>(records[i], out[i]);
+        }
+    }
+
+    typedef void (*SageDecodeFunc)(const char * raw, long n, GalaxyData * out);
+    typedef const SageLayoutField * (*SageFieldsFunc)(int &numFields);
+
+    // one supported file format, with its decoders instantiated for the layout
+    typedef struct SageFormat {
+        const char * name;
+        const char * description;
+        size_t recordSize;
+        bool native; // record is identical to GalaxyData, can be used as it is if not byteswapped
+        SageDecodeFunc decode;
+        SageDecodeFunc decodeSwap;
+        SageFieldsFunc getFields;
+    } SageFormat;
+
+    const SageFormat * findFormat(std::string name);
+    const SageFormat * probeFormat(long fileSize, long headerSize, long numRows, int &numMatches);
+    std::string getFormatNames();
+
+}
+
+#endif
@@ -0,0 +1,351 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "sageingest_error.h"
+#include "Sage_HDF5Reader.h"
+#include "Sage_HaloAggregator.h"
+#include "Sage_Mapping.h"
+
+using namespace H5;
+
+namespace Sage {
+
+    SageHDF5Reader::SageHDF5Reader(string newFileName, string newGroupName, float newH, int newFileNum, int newBlocksize, long newMaxRows, vector<string> newColumnNames) : SageReader() {
+        h5file = NULL;
+        groupName = newGroupName;
+        columnNames = newColumnNames;
+        columnsReady = false;
+        numSampleColumns = 0;
+
+        // no byteswapping needed, HDF5 converts to native types itself
+        init(newFileName, 0, newH, newFileNum, newBlocksize, newMaxRows);
+    }
+
+    SageHDF5Reader::~SageHDF5Reader() {
+        // the pipeline may still be reading from the file
+        stopPipeline();
+        closeFile();
+    }
+
+    bool SageHDF5Reader::isHDF5File(string fileName) {
+        try {
+            return H5File::isHdf5(fileName.c_str());
+        } catch (Exception &e) {
+            return false;
+        }
+    }
+
+    void SageHDF5Reader::openFile(string newFileName) {
+        closeFile();
+
+        try {
+            h5file = new H5File(newFileName.c_str(), H5F_ACC_RDONLY);
+        } catch (Exception &e) {
+            SageIngest_error("SageHDF5Reader: Error in opening file.\n");
+        }
+
+        fileName = newFileName;
+    }
+
+    void SageHDF5Reader::closeFile() {
+        columns.clear();
+        columnsReady = false;
+        if (h5file) {
+            h5file->close();
+            delete h5file;
+            h5file = NULL;
+        }
+    }
+
+    long SageHDF5Reader::getMeta() {
+        DataSet dataSet;
+        hsize_t dims[1];
+
+        // the number of rows is taken from the SnapNum dataset, which is
+        // always needed anyway
+        try {
+            dataSet = h5file->openDataSet(groupName + "/SnapNum");
+            DataSpace dataSpace = dataSet.getSpace();
+            if (dataSpace.getSimpleExtentNdims() != 1) {
+                SageIngest_error("SageHDF5Reader: Dataset SnapNum is not one-dimensional.\n");
+            }
+            dataSpace.getSimpleExtentDims(dims);
+        } catch (Exception &e) {
+            ostringstream message;
+            message << "SageHDF5Reader: Cannot read dataset " << groupName << "/SnapNum: " << e.getDetailMsg() << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        header.Ntrees = 0;
+        header.NtotGals = (int) dims[0];
+        headerSize = 0;
+        fileSize = 0;
+
+        printf("Group, NtotGals: %s %ld\n", groupName.c_str(), (long) dims[0]);
+
+        return (long) dims[0];
+    }
+
+    // dataset names used by the different SAGE versions for a field
+    bool SageHDF5Reader::findDataSet(string fieldName, int index, string &dataSetName) {
+        vector<string> candidates;
+        const char * components[] = {"x", "y", "z"};
+
+        if (index >= 0) {
+            candidates.push_back(fieldName + components[index]);
+            candidates.push_back(fieldName + "_" + components[index]);
+        } else {
+            candidates.push_back(fieldName);
+            if (fieldName == "TreeIndex") {
+                candidates.push_back("SAGETreeIndex");
+            } else if (fieldName == "CtreesHaloID") {
+                candidates.push_back("SimulationHaloIndex");
+            }
+        }
+
+        for (size_t i=0; i<candidates.size(); i++) {
+            if (H5Lexists(h5file->getId(), (groupName + "/" + candidates[i]).c_str(), H5P_DEFAULT) > 0) {
+                dataSetName = groupName + "/" + candidates[i];
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void SageHDF5Reader::addColumn(string fieldName, const SageField * field, int index) {
+        SageHDF5Column column;
+        string dataSetName;
+
+        if (!findDataSet(fieldName, index, dataSetName)) {
+            ostringstream message;
+            message << "SageHDF5Reader: No dataset found in group '" << groupName << "' for field " << fieldName;
+            if (index >= 0) {
+                message << "[" << index << "]";
+            }
+            message << ", which is needed for the database columns." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        column.fieldName = fieldName;
+        column.dataSetName = dataSetName;
+        column.dataSet = h5file->openDataSet(dataSetName);
+        column.type = field->type;
+        column.offset = field->offset + max(index, 0)*(field->type == SFT_LONG ? sizeof(long) : sizeof(int));
+        columns.push_back(column);
+    }
+
+    // Find out which fields are needed for the database columns and the
+    // filter, open their datasets and align the block size to the chunks.
+    void SageHDF5Reader::setupColumns() {
+        vector<string> fieldNames;
+        vector<string> usedFields;
+        const char * derived;
+        hsize_t chunkRows = 1;
+
+        // SnapNum is always needed (dbId, snapnum check); with a sample, it
+        // and GalaxyIndex are read for all rows
+        fieldNames.push_back("SnapNum");
+        if (sampler) {
+            fieldNames.push_back("GalaxyIndex");
+        }
+        numSampleColumns = fieldNames.size();
+        for (size_t i=0; i<columnNames.size(); i++) {
+            if (columnExprs[i] >= 0) {
+                usedFields = mapping->getUsedFields(columnExprs[i]);
+            } else if (SageExpression::findField(columnNames[i])) {
+                usedFields.assign(1, columnNames[i]);
+            } else if ((derived = SageExpression::findDerivedColumn(columnNames[i])) != NULL) {
+                usedFields = SageExpression(derived).getUsedFields();
+            } else {
+                continue;
+            }
+            for (size_t j=0; j<usedFields.size(); j++) {
+                if (find(fieldNames.begin(), fieldNames.end(), usedFields[j]) == fieldNames.end()) {
+                    fieldNames.push_back(usedFields[j]);
+                }
+            }
+        }
+        if (aggregator) {
+            usedFields = SageHaloAggregator::getUsedFields();
+            for (size_t j=0; j<usedFields.size(); j++) {
+                if (find(fieldNames.begin(), fieldNames.end(), usedFields[j]) == fieldNames.end()) {
+                    fieldNames.push_back(usedFields[j]);
+                }
+            }
+        }
+        if (filter) {
+            usedFields = filter->getUsedFields();
+            for (size_t j=0; j<usedFields.size(); j++) {
+                if (find(fieldNames.begin(), fieldNames.end(), usedFields[j]) == fieldNames.end()) {
+                    fieldNames.push_back(usedFields[j]);
+                }
+            }
+        }
+
+        for (size_t i=0; i<fieldNames.size(); i++) {
+            const SageField * field = SageExpression::findField(fieldNames[i]);
+            if (field->len == 1) {
+                addColumn(fieldNames[i], field, -1);
+            } else {
+                for (int k=0; k<field->len; k++) {
+                    addColumn(fieldNames[i], field, k);
+                }
+            }
+        }
+
+        // read whole chunks only, so that no chunk needs to be read (and
+        // decompressed) twice
+        for (size_t i=0; i<columns.size(); i++) {
+            DSetCreatPropList plist = columns[i].dataSet.getCreatePlist();
+            if (plist.getLayout() == H5D_CHUNKED) {
+                hsize_t chunkDims[1];
+                plist.getChunk(1, chunkDims);
+                chunkRows = max(chunkRows, chunkDims[0]);
+            }
+        }
+        if ((long) chunkRows <= maxBlocksize) {
+            blocksize = max(1L, blocksize/(long) chunkRows)*chunkRows;
+        } else {
+            printf("WARNING: chunks (%ld rows) are larger than the block size, reading partial chunks.\n", (long) chunkRows);
+        }
+
+        cout << "Reading " << columns.size() << " datasets, block size " << blocksize << " rows" << endl;
+        for (size_t i=0; i<columns.size(); i++) {
+            columns[i].column.resize(maxBlocksize*(columns[i].type == SFT_LONG ? sizeof(long) : sizeof(int)));
+        }
+
+        // fields that are not read stay 0
+        memset(datarows, 0, maxBlocksize*sizeof(GalaxyData));
+
+        columnsReady = true;
+    }
+
+    // read the next n rows directly into rows, no decoding needed
+    long SageHDF5Reader::readRows(long n, GalaxyData * rows, char * raw) {
+        assert(h5file != NULL);
+
+        if (!columnsReady) {
+            // may align the block size to the chunks
+            setupColumns();
+            n = min(n, blocksize);
+        }
+
+        n = max(0L, min(n, maxRows-rowsRead));
+        if (n == 0) {
+            return 0;
+        }
+
+        hsize_t offset[1] = {(hsize_t) rowsRead};
+        hsize_t count[1] = {(hsize_t) n};
+        DataSpace memSpace(1, count);
+        const hsize_t * points = NULL;
+
+        // read one block of each dataset and copy it into its field
+        for (size_t i=0; i<columns.size(); i++) {
+            SageHDF5Column & column = columns[i];
+
+            if (i == numSampleColumns && sampler) {
+                // the rest only for the sampled rows (as points), if that
+                // is clearly less than the whole block
+                sampledRows.clear();
+                for (long j=0; j<n; j++) {
+                    if (sampler->isSelected(rows[j].GalaxyIndex)) {
+                        sampledRows.push_back(rowsRead + j);
+                    }
+                }
+                if (sampledRows.empty()) {
+                    break;
+                }
+                if ((long) sampledRows.size() < n/2) {
+                    points = &sampledRows[0];
+                    hsize_t numPoints[1] = {sampledRows.size()};
+                    memSpace = DataSpace(1, numPoints);
+                }
+            }
+
+            DataSpace fileSpace = column.dataSet.getSpace();
+            if (points) {
+                fileSpace.selectElements(H5S_SELECT_SET, sampledRows.size(), points);
+                readColumn(column, fileSpace, memSpace, sampledRows.size(), rows, points);
+            } else {
+                fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+                readColumn(column, fileSpace, memSpace, n, rows, NULL);
+            }
+        }
+        rowsRead += n;
+
+        return n;
+    }
+
+    // copy n values of a column into its field, either of the first n rows
+    // or of the given points (rows in the file) of the current block
+    void SageHDF5Reader::readColumn(SageHDF5Column &column, DataSpace &fileSpace, DataSpace &memSpace, long n, GalaxyData * rows, const hsize_t * points) {
+        char * dest = (char *) rows + column.offset;
+
+        if (column.type == SFT_INT) {
+            const int * values = (const int *) &column.column[0];
+            column.dataSet.read(&column.column[0], PredType::NATIVE_INT, memSpace, fileSpace);
+            for (long j=0; j<n; j++) {
+                long row = points ? (long) points[j] - rowsRead : j;
+                *(int *) (dest + row*sizeof(GalaxyData)) = values[j];
+            }
+        } else if (column.type == SFT_LONG) {
+            const long * values = (const long *) &column.column[0];
+            column.dataSet.read(&column.column[0], PredType::NATIVE_LONG, memSpace, fileSpace);
+            for (long j=0; j<n; j++) {
+                long row = points ? (long) points[j] - rowsRead : j;
+                *(long *) (dest + row*sizeof(GalaxyData)) = values[j];
+            }
+        } else {
+            const float * values = (const float *) &column.column[0];
+            column.dataSet.read(&column.column[0], PredType::NATIVE_FLOAT, memSpace, fileSpace);
+            for (long j=0; j<n; j++) {
+                long row = points ? (long) points[j] - rowsRead : j;
+                *(float *) (dest + row*sizeof(GalaxyData)) = values[j];
+            }
+        }
+    }
+
+    bool SageHDF5Reader::needsRawBuffer() const {
+        return false;
+    }
+
+    void SageHDF5Reader::rewindRows() {
+        rowsRead = 0;
+    }
+
+    // must be set before the first block is read, the datasets needed for
+    // the sample are chosen then
+    void SageHDF5Reader::setSampler(const SageSampler * newSampler) {
+        assert(!columnsReady);
+        SageReader::setSampler(newSampler);
+    }
+
+    // the datasets are not read in the order of the file, so there is no
+    // checksum of HDF5 files
+    void SageHDF5Reader::enableHash() {
+    }
+
+}
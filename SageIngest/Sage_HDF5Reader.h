@@ -0,0 +1,86 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include "Sage_Reader.h"
+#include "Sage_Expression.h"
+#include "Sage_Sampler.h"
+#include <string>
+#include <vector>
+#include "H5Cpp.h"
+
+#ifndef Sage_Sage_HDF5Reader_h
+#define Sage_Sage_HDF5Reader_h
+
+namespace Sage {
+
+    // one dataset of the HDF5 file that is read into a GalaxyData field
+    typedef struct {
+        string fieldName; // name of the GalaxyData field (with [i] for array components)
+        string dataSetName;
+        H5::DataSet dataSet;
+        size_t offset; // offset of the field in GalaxyData
+        SageFieldType type;
+        vector<char> column; // buffer for one block of this dataset
+    } SageHDF5Column;
+
+    // Reader for SAGE catalogues in HDF5 format, with one dataset per field
+    // (arrays like Pos as Posx, Posy, Posz) in one group per snapshot.
+    // Only the datasets needed for the database columns (and the filter) are
+    // read, each in hyperslabs of one block that are aligned to the dataset
+    // chunks, and then copied into the usual GalaxyData block, so that all
+    // the rest works the same as for binary files. With a sample, only
+    // GalaxyIndex is read for all rows, the other datasets only for the
+    // sampled rows.
+    class SageHDF5Reader : public SageReader {
+    private:
+        H5::H5File * h5file;
+        string groupName;
+
+        vector<SageHDF5Column> columns;
+        bool columnsReady;
+        size_t numSampleColumns;     // columns read for all rows, the others only for sampled rows
+        vector<hsize_t> sampledRows; // in the file, for the current block
+
+        void setupColumns();
+        void readColumn(SageHDF5Column &column, H5::DataSpace &fileSpace, H5::DataSpace &memSpace, long n, GalaxyData * rows, const hsize_t * points);
+        void addColumn(string fieldName, const SageField * field, int index);
+        bool findDataSet(string fieldName, int index, string &dataSetName);
+
+    public:
+        SageHDF5Reader(string newFileName, string newGroupName, float newH, int newFileNum, int newBlocksize, long newMaxRows, vector<string> newColumnNames);
+        ~SageHDF5Reader();
+
+        static bool isHDF5File(string fileName);
+
+        void openFile(string newFileName);
+        void closeFile();
+
+        long getMeta();
+
+        long readRows(long n, GalaxyData * rows, char * raw);
+        bool needsRawBuffer() const;
+        void enableHash();
+        void rewindRows();
+        void setSampler(const SageSampler * newSampler);
+    };
+
+}
+
+#endif
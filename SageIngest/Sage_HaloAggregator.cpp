@@ -0,0 +1,350 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+#include "sageingest_error.h"
+#include "Sage_HaloAggregator.h"
+#include "Sage_ColumnWriters.h"
+
+namespace Sage {
+
+    static inline size_t hashHalo(long hostHaloId, int snapnum) {
+        uint64_t x = (uint64_t) hostHaloId ^ ((uint64_t) snapnum << 56);
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    static inline bool haloLess(const SageHaloAggregate &a, const SageHaloAggregate &b) {
+        return a.snapnum < b.snapnum || (a.snapnum == b.snapnum && a.hostHaloId < b.hostHaloId);
+    }
+
+    static inline bool sameHalo(const SageHaloAggregate &a, const SageHaloAggregate &b) {
+        return a.snapnum == b.snapnum && a.hostHaloId == b.hostHaloId;
+    }
+
+    static inline void combine(SageHaloAggregate &a, const SageHaloAggregate &b) {
+        a.numGalaxies += b.numGalaxies;
+        a.numSatellites += b.numSatellites;
+        a.stellarMass += b.stellarMass;
+        a.coldGas += b.coldGas;
+        a.blackHoleMass += b.blackHoleMass;
+    }
+
+    SageHaloAggregator::SageHaloAggregator(long memoryBytes, string newSpillDir) {
+        spillDir = newSpillDir;
+        numSpilled = 0;
+
+        // largest power of two of slots fitting into the memory, the map
+        // starts small and grows up to this
+        maxCapacity = 1024;
+        while (maxCapacity*2*sizeof(SageHaloAggregate) <= (size_t) memoryBytes) {
+            maxCapacity *= 2;
+        }
+
+        slots.resize(min(maxCapacity, (size_t) 65536));
+        memset(&slots[0], 0, slots.size()*sizeof(SageHaloAggregate));
+        mask = slots.size() - 1;
+        numEntries = 0;
+        memoryPos = 0;
+    }
+
+    SageHaloAggregator::~SageHaloAggregator() {
+        clear();
+    }
+
+    // fields of GalaxyData needed for the aggregates (for readers that only
+    // read some of them)
+    vector<string> SageHaloAggregator::getUsedFields() {
+        const char * fields[] = {"SnapNum", "Type", "CtreesHaloID", "StellarMass", "ColdGas", "BlackHoleMass"};
+        return vector<string>(fields, fields + sizeof(fields)/sizeof(fields[0]));
+    }
+
+    // add the rows of a block, only the selected ones if a selection is given
+    void SageHaloAggregator::add(const GalaxyData * rows, const vector<long> * selection, long n) {
+        if (selection) {
+            for (long k=0; k<n; k++) {
+                addRow(rows[(*selection)[k]]);
+            }
+        } else {
+            for (long k=0; k<n; k++) {
+                addRow(rows[k]);
+            }
+        }
+    }
+
+    void SageHaloAggregator::addRow(const GalaxyData &row) {
+        size_t i = hashHalo(row.CtreesHaloID, row.SnapNum) & mask;
+
+        while (slots[i].numGalaxies != 0 && (slots[i].hostHaloId != row.CtreesHaloID || slots[i].snapnum != row.SnapNum)) {
+            i = (i + 1) & mask;
+        }
+
+        if (slots[i].numGalaxies == 0) {
+            // new halo; keep the load below 3/4 for short probes
+            if ((numEntries + 1)*4 > slots.size()*3) {
+                if (slots.size() < maxCapacity) {
+                    grow();
+                } else {
+                    spill();
+                }
+                i = hashHalo(row.CtreesHaloID, row.SnapNum) & mask;
+                while (slots[i].numGalaxies != 0) {
+                    i = (i + 1) & mask;
+                }
+            }
+            slots[i].hostHaloId = row.CtreesHaloID;
+            slots[i].snapnum = row.SnapNum;
+            numEntries++;
+        }
+
+        SageHaloAggregate &halo = slots[i];
+        halo.numGalaxies++;
+        halo.numSatellites += (row.Type != 0);
+        halo.stellarMass += row.StellarMass*1.e10;
+        halo.coldGas += row.ColdGas*1.e10;
+        halo.blackHoleMass += row.BlackHoleMass*1.e10;
+    }
+
+    void SageHaloAggregator::grow() {
+        vector<SageHaloAggregate> oldSlots(slots.size()*2);
+        oldSlots.swap(slots);
+        memset(&slots[0], 0, slots.size()*sizeof(SageHaloAggregate));
+        mask = slots.size() - 1;
+
+        for (size_t j=0; j<oldSlots.size(); j++) {
+            if (oldSlots[j].numGalaxies != 0) {
+                size_t i = hashHalo(oldSlots[j].hostHaloId, oldSlots[j].snapnum) & mask;
+                while (slots[i].numGalaxies != 0) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = oldSlots[j];
+            }
+        }
+    }
+
+    // move the aggregates to the front of the slots, in the order of next()
+    void SageHaloAggregator::sortEntries() {
+        size_t n = 0;
+        for (size_t j=0; j<slots.size(); j++) {
+            if (slots[j].numGalaxies != 0) {
+                slots[n++] = slots[j];
+            }
+        }
+        sort(slots.begin(), slots.begin() + n, haloLess);
+    }
+
+    // write the (sorted) aggregates of the map to a new run file and empty
+    // the map
+    void SageHaloAggregator::spill() {
+        ostringstream fileName;
+        fileName << spillDir << "/sage_halos_" << getpid() << "_" << spillFiles.size() << ".tmp";
+
+        sortEntries();
+
+        ofstream out(fileName.str().c_str(), ios::binary | ios::trunc);
+        out.write((const char *) &slots[0], numEntries*sizeof(SageHaloAggregate));
+        out.close();
+        if (!out) {
+            ostringstream message;
+            message << "SageHaloAggregator: Cannot write spill file " << fileName.str() << "." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        printf("Halo aggregates: map full, spilled %ld halos to %s\n", (long) numEntries, fileName.str().c_str());
+        spillFiles.push_back(fileName.str());
+        numSpilled += numEntries;
+
+        memset(&slots[0], 0, slots.size()*sizeof(SageHaloAggregate));
+        numEntries = 0;
+    }
+
+    // Prepare for handing out the aggregates with next(); no more rows can
+    // be added until clear() is called.
+    void SageHaloAggregator::finish() {
+        sortEntries();
+        memoryPos = 0;
+
+        for (size_t i=0; i<spillFiles.size(); i++) {
+            ifstream * run = new ifstream(spillFiles[i].c_str(), ios::binary);
+            if (!run->is_open()) {
+                ostringstream message;
+                message << "SageHaloAggregator: Cannot read spill file " << spillFiles[i] << "." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            runs.push_back(run);
+        }
+
+        heads.resize(runs.size() + 1);
+        hasHead.resize(runs.size() + 1);
+        for (size_t source=0; source<heads.size(); source++) {
+            advance(source);
+        }
+    }
+
+    void SageHaloAggregator::advance(size_t source) {
+        if (source < runs.size()) {
+            hasHead[source] = (bool) runs[source]->read((char *) &heads[source], sizeof(SageHaloAggregate));
+        } else {
+            hasHead[source] = memoryPos < numEntries;
+            if (hasHead[source]) {
+                heads[source] = slots[memoryPos++];
+            }
+        }
+    }
+
+    // next halo (after finish), combined from all runs; false at the end
+    bool SageHaloAggregator::next(SageHaloAggregate &aggregate) {
+        size_t best = heads.size();
+
+        for (size_t source=0; source<heads.size(); source++) {
+            if (hasHead[source] && (best == heads.size() || haloLess(heads[source], heads[best]))) {
+                best = source;
+            }
+        }
+        if (best == heads.size()) {
+            return false;
+        }
+
+        aggregate = heads[best];
+        advance(best);
+
+        // each run has a halo at most once
+        for (size_t source=0; source<heads.size(); source++) {
+            if (hasHead[source] && sameHalo(heads[source], aggregate)) {
+                combine(aggregate, heads[source]);
+                advance(source);
+            }
+        }
+
+        return true;
+    }
+
+    // forget all aggregates, e.g. after they were written for one file
+    void SageHaloAggregator::clear() {
+        for (size_t i=0; i<runs.size(); i++) {
+            delete runs[i];
+        }
+        runs.clear();
+        for (size_t i=0; i<spillFiles.size(); i++) {
+            remove(spillFiles[i].c_str());
+        }
+        spillFiles.clear();
+        heads.clear();
+        hasHead.clear();
+
+        memset(&slots[0], 0, slots.size()*sizeof(SageHaloAggregate));
+        numEntries = 0;
+        memoryPos = 0;
+    }
+
+    long SageHaloAggregator::getNumSpilled() {
+        return numSpilled;
+    }
+
+
+    SageHaloReader::SageHaloReader(SageHaloAggregator * newAggregator) {
+        aggregator = newAggregator;
+        memset(&current, 0, sizeof(current));
+    }
+
+    SageHaloReader::~SageHaloReader() {
+    }
+
+    void SageHaloReader::openFile(string newFileName) {
+    }
+
+    void SageHaloReader::closeFile() {
+    }
+
+    int SageHaloReader::getNextRow() {
+        return aggregator->next(current) ? 1 : 0;
+    }
+
+    template<class T>
+    static void writeValue(DBDataSchema::DType dtype, T value, void * result) {
+        switch (dtype) {
+            case DBDataSchema::DT_INT1:  *(SageDTypeOf<DBDataSchema::DT_INT1>::type *) result = value; break;
+            case DBDataSchema::DT_INT2:  *(SageDTypeOf<DBDataSchema::DT_INT2>::type *) result = value; break;
+            case DBDataSchema::DT_INT4:  *(SageDTypeOf<DBDataSchema::DT_INT4>::type *) result = value; break;
+            case DBDataSchema::DT_INT8:  *(SageDTypeOf<DBDataSchema::DT_INT8>::type *) result = value; break;
+            case DBDataSchema::DT_UINT1: *(SageDTypeOf<DBDataSchema::DT_UINT1>::type *) result = value; break;
+            case DBDataSchema::DT_UINT2: *(SageDTypeOf<DBDataSchema::DT_UINT2>::type *) result = value; break;
+            case DBDataSchema::DT_UINT4: *(SageDTypeOf<DBDataSchema::DT_UINT4>::type *) result = value; break;
+            case DBDataSchema::DT_UINT8: *(SageDTypeOf<DBDataSchema::DT_UINT8>::type *) result = value; break;
+            case DBDataSchema::DT_REAL4: *(SageDTypeOf<DBDataSchema::DT_REAL4>::type *) result = value; break;
+            case DBDataSchema::DT_REAL8: *(SageDTypeOf<DBDataSchema::DT_REAL8>::type *) result = value; break;
+            default:
+                SageIngest_error("SageHaloReader: Unsupported data type.\n");
+        }
+    }
+
+    bool SageHaloReader::getItemInRow(DBDataSchema::DataObjDesc * thisItem, bool applyAsserters, bool applyConverters, void* result) {
+        string name = thisItem->getDataObjName();
+        DBDataSchema::DType dtype = thisItem->getDataObjDType();
+
+        if (thisItem->getIsConstItem()) {
+            getConstItem(thisItem, result);
+        } else if (name == "snapnum") {
+            writeValue(dtype, current.snapnum, result);
+        } else if (name == "HostHaloID") {
+            writeValue(dtype, current.hostHaloId, result);
+        } else if (name == "numGalaxies") {
+            writeValue(dtype, current.numGalaxies, result);
+        } else if (name == "numSatellites") {
+            writeValue(dtype, current.numSatellites, result);
+        } else if (name == "MstarSum") {
+            writeValue(dtype, current.stellarMass, result);
+        } else if (name == "McoldSum") {
+            writeValue(dtype, current.coldGas, result);
+        } else if (name == "MbhSum") {
+            writeValue(dtype, current.blackHoleMass, result);
+        } else {
+            printf("Something went wrong in SageHaloReader::getItemInRow(), field %s not found ...\n", name.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        return false;
+    }
+
+    void SageHaloReader::getConstItem(DBDataSchema::DataObjDesc * thisItem, void* result) {
+        memcpy(result, thisItem->getConstData(), DBDataSchema::getByteLenOfDType(thisItem->getDataObjDType()));
+    }
+
+    // write all remaining aggregates as text lines, returns their number
+    long SageHaloReader::writeText(ostream &out) {
+        long n = 0;
+
+        out.precision(9);
+        while (getNextRow()) {
+            out << current.snapnum << " " << current.hostHaloId << " " << current.numGalaxies << " "
+                << current.numSatellites << " " << current.stellarMass << " " << current.coldGas << " "
+                << current.blackHoleMass << "\n";
+            n++;
+        }
+
+        return n;
+    }
+
+}
@@ -0,0 +1,113 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <Reader.h>
+#include "Sage_Reader.h"
+
+#ifndef Sage_Sage_HaloAggregator_h
+#define Sage_Sage_HaloAggregator_h
+
+namespace Sage {
+
+    // sums over the galaxies of one host halo in one snapshot
+    typedef struct {
+        long hostHaloId;    // CtreesHaloID of the galaxies
+        int snapnum;
+        int numGalaxies;    // 0 for empty slots of the hash map
+        int numSatellites;  // galaxies with Type != 0
+        double stellarMass; // as MstarSpheroid + MstarDisk
+        double coldGas;     // as McoldDisk
+        double blackHoleMass; // as Mbh
+    } SageHaloAggregate;
+
+    // Aggregates the galaxies per host halo while the blocks stream by (see
+    // SageReader::setAggregator), in a hash map with open addressing and
+    // linear probing. The map grows up to the given memory size; when it is
+    // full, its aggregates are sorted and spilled to a file, and the map
+    // starts empty again. finish() then merges the spilled runs with the
+    // map, so that next() returns each halo once, ordered by snapnum and
+    // host halo id.
+    class SageHaloAggregator {
+    private:
+        vector<SageHaloAggregate> slots;
+        size_t mask;
+        size_t numEntries;
+        size_t maxCapacity;
+        string spillDir;
+        long numSpilled;
+
+        // merge of the spilled runs (sources 0..n-1) and the sorted map
+        // (source n), see finish and next
+        vector<string> spillFiles;
+        vector<ifstream *> runs;
+        vector<SageHaloAggregate> heads;
+        vector<bool> hasHead;
+        size_t memoryPos;
+
+        void addRow(const GalaxyData &row);
+        void grow();
+        void sortEntries();
+        void spill();
+        void advance(size_t source);
+
+    public:
+        SageHaloAggregator(long memoryBytes, string newSpillDir);
+        ~SageHaloAggregator();
+
+        void add(const GalaxyData * rows, const vector<long> * selection, long n);
+
+        void finish();
+        bool next(SageHaloAggregate &aggregate);
+        void clear();
+
+        long getNumSpilled();
+
+        static vector<string> getUsedFields();
+    };
+
+    // Hands out the aggregates of a SageHaloAggregator (after finish) as
+    // rows for an ingestor, with the columns of
+    // SageSchemaMapper::generateHaloSchema.
+    class SageHaloReader : public DBReader::Reader {
+    private:
+        SageHaloAggregator * aggregator;
+        SageHaloAggregate current;
+
+    public:
+        SageHaloReader(SageHaloAggregator * newAggregator);
+        ~SageHaloReader();
+
+        void openFile(string newFileName);
+        void closeFile();
+
+        int getNextRow();
+        bool getItemInRow(DBDataSchema::DataObjDesc * thisItem, bool applyAsserters, bool applyConverters, void* result);
+        void getConstItem(DBDataSchema::DataObjDesc * thisItem, void* result);
+
+        long writeText(ostream &out);
+    };
+
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <boost/crc.hpp>
+#include "Sage_Hash.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define SAGE_HAVE_SSE42_CRC
+#endif
+
+namespace Sage {
+
+    typedef boost::crc_optimal<32, 0x1EDC6F41, 0, 0, true, true> SageCrc32cSoftware;
+
+    // boost::crc keeps the remainder unreflected, crc is the reflected one
+    static uint32_t reflect(uint32_t value) {
+        uint32_t reflected = 0;
+        for (int i=0; i<32; i++) {
+            reflected = (reflected << 1) | ((value >> i) & 1);
+        }
+        return reflected;
+    }
+
+    static uint32_t updateSoftware(uint32_t crc, const unsigned char * data, size_t n) {
+        SageCrc32cSoftware software(reflect(crc));
+        software.process_bytes(data, n);
+        return software.checksum();
+    }
+
+#ifdef SAGE_HAVE_SSE42_CRC
+    __attribute__((target("sse4.2")))
+    static uint32_t updateHardware(uint32_t crc, const unsigned char * data, size_t n) {
+#ifdef __x86_64__
+        uint64_t crc64 = crc;
+        uint64_t word;
+        while (n >= 8) {
+            memcpy(&word, data, 8);
+            crc64 = _mm_crc32_u64(crc64, word);
+            data += 8;
+            n -= 8;
+        }
+        crc = (uint32_t) crc64;
+#endif
+        while (n > 0) {
+            crc = _mm_crc32_u8(crc, *data);
+            data++;
+            n--;
+        }
+        return crc;
+    }
+#endif
+
+    typedef uint32_t (*SageCrcUpdate)(uint32_t crc, const unsigned char * data, size_t n);
+
+    static SageCrcUpdate chooseUpdate() {
+#ifdef SAGE_HAVE_SSE42_CRC
+        if (__builtin_cpu_supports("sse4.2")) {
+            return &updateHardware;
+        }
+#endif
+        return &updateSoftware;
+    }
+
+    static const SageCrcUpdate crcUpdate = chooseUpdate();
+
+    SageCrc32c::SageCrc32c() {
+        reset();
+    }
+
+    void SageCrc32c::reset() {
+        crc = 0xFFFFFFFF;
+        numBytes = 0;
+    }
+
+    void SageCrc32c::update(const void * data, size_t n) {
+        crc = crcUpdate(crc, (const unsigned char *) data, n);
+        numBytes += n;
+    }
+
+    uint32_t SageCrc32c::value() const {
+        return ~crc;
+    }
+
+    // number of bytes that went into the checksum so far
+    long SageCrc32c::getNumBytes() const {
+        return numBytes;
+    }
+
+}
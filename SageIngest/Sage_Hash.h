@@ -0,0 +1,48 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef Sage_Sage_Hash_h
+#define Sage_Sage_Hash_h
+
+namespace Sage {
+
+    // Streaming CRC32C (Castagnoli) checksum of the bytes of a file, updated
+    // block by block while the file is read. Uses the crc32 instruction of
+    // SSE 4.2 if the CPU has it, otherwise boost::crc.
+    class SageCrc32c {
+    private:
+        uint32_t crc; // running remainder, not yet inverted
+        long numBytes;
+
+    public:
+        SageCrc32c();
+
+        void reset();
+        void update(const void * data, size_t n);
+
+        uint32_t value() const;
+        long getNumBytes() const;
+    };
+
+}
+
+#endif
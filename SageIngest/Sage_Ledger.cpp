@@ -0,0 +1,130 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "sageingest_error.h"
+#include "Sage_Ledger.h"
+
+namespace Sage {
+
+    SageLedger::SageLedger(string newLedgerFile) {
+        ledgerFile = newLedgerFile;
+
+        read();
+
+        ledgerStream.open(ledgerFile.c_str(), ios::out | ios::app);
+        if (!(ledgerStream.is_open())) {
+            SageIngest_error("SageLedger: Error in opening ledger file for writing.\n");
+        }
+
+        printf("Ledger %s: %ld files ingested before\n", ledgerFile.c_str(), (long) entries.size());
+    }
+
+    SageLedger::~SageLedger() {
+        ledgerStream.close();
+    }
+
+    // Lines are "fileSize mtime crc numRows path", with crc as hex number or
+    // "-"; for files listed more than once, the last line counts. A missing
+    // ledger file is just empty.
+    void SageLedger::read() {
+        ifstream readStream;
+        string line;
+
+        readStream.open(ledgerFile.c_str(), ios::in);
+        if (!(readStream.is_open())) {
+            return;
+        }
+
+        while (getline(readStream, line)) {
+            if (line.length() == 0 || line[0] == '#') {
+                continue;
+            }
+            SageLedgerEntry entry;
+            string crcStr;
+            istringstream lineStream(line);
+            if (!(lineStream >> entry.fileSize >> entry.mtime >> crcStr >> entry.numRows >> ws)
+                || !getline(lineStream, entry.path)) {
+                // e.g. the last line, if writing it was interrupted
+                printf("WARNING: ignoring line '%s' in ledger %s\n", line.c_str(), ledgerFile.c_str());
+                continue;
+            }
+            entry.hasCrc = (crcStr != "-");
+            entry.crc = entry.hasCrc ? (uint32_t) strtoul(crcStr.c_str(), NULL, 16) : 0;
+            entries[entry.path] = entry;
+        }
+
+        readStream.close();
+    }
+
+    // fill in absolute path, size and modification time of the file
+    bool SageLedger::statFile(string path, SageLedgerEntry &entry) {
+        struct stat fileStat;
+        char absPath[PATH_MAX];
+
+        if (stat(path.c_str(), &fileStat) != 0) {
+            return false;
+        }
+
+        entry.path = realpath(path.c_str(), absPath) ? string(absPath) : path;
+        entry.fileSize = fileStat.st_size;
+        entry.mtime = fileStat.st_mtime;
+        entry.hasCrc = false;
+        entry.crc = 0;
+        entry.numRows = 0;
+
+        return true;
+    }
+
+    bool SageLedger::isDone(const SageLedgerEntry &entry) {
+        boost::unordered_map<string, SageLedgerEntry>::const_iterator it = entries.find(entry.path);
+
+        if (it == entries.end()) {
+            return false;
+        }
+
+        return it->second.fileSize == entry.fileSize && it->second.mtime == entry.mtime;
+    }
+
+    // write the line immediately, the ingest may fail at the next file
+    void SageLedger::record(const SageLedgerEntry &entry) {
+        char crcStr[16];
+
+        if (entry.hasCrc) {
+            snprintf(crcStr, sizeof(crcStr), "%08x", entry.crc);
+        } else {
+            snprintf(crcStr, sizeof(crcStr), "-");
+        }
+
+        ledgerStream << entry.fileSize << " " << entry.mtime << " " << crcStr << " "
+            << entry.numRows << " " << entry.path << endl;
+        if (!ledgerStream) {
+            SageIngest_error("SageLedger: Error in writing ledger file.\n");
+        }
+
+        entries[entry.path] = entry;
+    }
+
+}
@@ -0,0 +1,68 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include <boost/unordered_map.hpp>
+
+#ifndef Sage_Sage_Ledger_h
+#define Sage_Sage_Ledger_h
+
+using namespace std;
+
+namespace Sage {
+
+    // one data file that was ingested completely
+    typedef struct {
+        string path;     // absolute path
+        long fileSize;
+        long mtime;      // modification time (seconds since 1970)
+        bool hasCrc;     // false if no checksum could be computed (e.g. HDF5)
+        uint32_t crc;    // CRC32C of the whole file
+        long numRows;
+    } SageLedgerEntry;
+
+    // Local record of the files that were ingested completely, so that a
+    // rerun of a partly failed multi-file ingest only ingests the files that
+    // changed or were not finished. The ledger is a text file with one line
+    // per file, appended right after each file is done; a file counts as done
+    // if path, size and modification time are the same as recorded.
+    class SageLedger {
+    private:
+        string ledgerFile;
+        boost::unordered_map<string, SageLedgerEntry> entries;
+        ofstream ledgerStream;
+
+        void read();
+
+    public:
+        SageLedger(string newLedgerFile);
+        ~SageLedger();
+
+        static bool statFile(string path, SageLedgerEntry &entry);
+
+        bool isDone(const SageLedgerEntry &entry);
+        void record(const SageLedgerEntry &entry);
+    };
+
+}
+
+#endif
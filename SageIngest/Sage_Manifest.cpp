@@ -0,0 +1,298 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "sageingest_error.h"
+#include "Sage_Manifest.h"
+#include "Sage_Formats.h"
+
+namespace Sage {
+
+    // Read only the header of a binary SAGE file (Ntrees, NtotGals,
+    // GalsPerTree) and the snapnum of its first row. Errors are only reported
+    // here (numRows = -1), so that one bad file does not stop the others.
+    static SageManifestEntry scanFile(string path, int bswap) {
+        SageManifestEntry entry;
+        ifstream fileStream;
+        int Ntrees;
+        int NtotGals;
+        int snapnum;
+        long headerSize;
+        long sumGals;
+
+        entry.path = path;
+        entry.fileSize = 0;
+        entry.numRows = -1;
+        entry.numTrees = 0;
+        entry.snapnum = -1;
+        entry.rowOffset = 0;
+        entry.recordSize = 0;
+        entry.index = 0;
+
+        fileStream.open(path.c_str(), ios::in | ios::binary);
+        if (!(fileStream.is_open())) {
+            printf("WARNING: cannot open %s\n", path.c_str());
+            return entry;
+        }
+
+        fileStream.seekg(0, ios::end);
+        entry.fileSize = fileStream.tellg();
+        fileStream.seekg(0, ios::beg);
+
+        fileStream.read((char *) &Ntrees, sizeof(Ntrees));
+        fileStream.read((char *) &NtotGals, sizeof(NtotGals));
+        if (!fileStream) {
+            printf("WARNING: cannot read the header of %s\n", path.c_str());
+            return entry;
+        }
+        if (bswap) {
+            Ntrees = swapValue<true>(Ntrees);
+            NtotGals = swapValue<true>(NtotGals);
+        }
+        headerSize = 2*sizeof(int) + (long) Ntrees*sizeof(int);
+        if (Ntrees < 0 || NtotGals < 0 || headerSize > entry.fileSize) {
+            printf("WARNING: header of %s is invalid (Ntrees %d, NtotGals %d), wrong byte swap?\n", path.c_str(), Ntrees, NtotGals);
+            return entry;
+        }
+
+        // check the number of galaxies per tree against the total
+        vector<int> GalsPerTree(Ntrees);
+        if (Ntrees > 0) {
+            fileStream.read((char *) &GalsPerTree[0], Ntrees*sizeof(int));
+        }
+        sumGals = 0;
+        for (int i=0; i<Ntrees; i++) {
+            sumGals += bswap ? swapValue<true>(GalsPerTree[i]) : GalsPerTree[i];
+        }
+        if (sumGals != NtotGals) {
+            printf("WARNING: %s: sum of GalsPerTree (%ld) differs from NtotGals (%d)\n", path.c_str(), sumGals, NtotGals);
+        }
+
+        // SnapNum is the first field in all formats
+        snapnum = -1;
+        if (NtotGals > 0 && fileStream.read((char *) &snapnum, sizeof(snapnum))) {
+            snapnum = bswap ? swapValue<true>(snapnum) : snapnum;
+        }
+
+        entry.numRows = NtotGals;
+        entry.numTrees = Ntrees;
+        entry.snapnum = snapnum;
+        if (NtotGals == 0) {
+            // no rows, nothing to check (the record size stays unknown)
+            if (entry.fileSize != headerSize) {
+                printf("WARNING: %s has no rows, but %ld bytes after the header\n", path.c_str(), entry.fileSize - headerSize);
+            }
+        } else if ((entry.fileSize - headerSize) % NtotGals == 0) {
+            entry.recordSize = (entry.fileSize - headerSize)/NtotGals;
+        } else {
+            printf("WARNING: size of %s does not fit %d rows of equal size\n", path.c_str(), NtotGals);
+        }
+
+        return entry;
+    }
+
+    // one scan thread: takes the next file until all are done
+    static void scanFiles(const vector<string> * files, vector<SageManifestEntry> * entries, boost::atomic<size_t> * nextFile, int bswap) {
+        size_t i;
+        while ((i = (*nextFile)++) < files->size()) {
+            (*entries)[i] = scanFile((*files)[i], bswap);
+        }
+    }
+
+    // orders entry indices by decreasing number of rows
+    struct SageEntriesByRows {
+        const vector<SageManifestEntry> * entries;
+        bool operator()(size_t a, size_t b) const {
+            return (*entries)[a].numRows > (*entries)[b].numRows;
+        }
+    };
+
+    SageManifest::SageManifest() {
+    }
+
+    // Scan the headers of all files with numThreads threads; the files are
+    // handed out one by one, so that a few slow files do not hold up the rest.
+    SageManifest SageManifest::scan(const vector<string> &files, int bswap, int numThreads) {
+        SageManifest manifest;
+        boost::atomic<size_t> nextFile(0);
+        boost::thread_group threads;
+        boost::posix_time::ptime startTime;
+        boost::posix_time::ptime endTime;
+        long numFailed;
+
+        startTime = boost::posix_time::microsec_clock::universal_time();
+
+        manifest.entries.resize(files.size());
+        for (int t=0; t<max(1, numThreads); t++) {
+            threads.create_thread(boost::bind(&scanFiles, &files, &manifest.entries, &nextFile, bswap));
+        }
+        threads.join_all();
+
+        numFailed = 0;
+        for (size_t i=0; i<manifest.entries.size(); i++) {
+            SageManifestEntry & entry = manifest.entries[i];
+            entry.index = i;
+            if (entry.numRows < 0) {
+                numFailed++;
+                continue;
+            }
+            int numMatches;
+            probeFormat(entry.fileSize, entry.fileSize - entry.recordSize*entry.numRows, entry.numRows, numMatches);
+            if (entry.recordSize > 0 && numMatches == 0) {
+                printf("WARNING: record size %ld of %s does not fit any known format (%s)\n",
+                    entry.recordSize, entry.path.c_str(), getFormatNames().c_str());
+            }
+        }
+        if (numFailed > 0) {
+            ostringstream message;
+            message << "SageManifest: " << numFailed << " of " << files.size() << " files could not be scanned, see the warnings above." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        manifest.computeOffsets();
+
+        endTime = boost::posix_time::microsec_clock::universal_time();
+        printf("Scanned %ld files with %ld rows in total in %lld ms\n",
+            (long) files.size(), manifest.getTotalRows(), (long long int) (endTime-startTime).total_milliseconds());
+
+        return manifest;
+    }
+
+    // the rows are numbered over all files in the order of the manifest
+    void SageManifest::computeOffsets() {
+        long offset = 0;
+        for (size_t i=0; i<entries.size(); i++) {
+            entries[i].rowOffset = offset;
+            offset += entries[i].numRows;
+        }
+    }
+
+    // One line per file; the path comes last, so that it may contain spaces.
+    void SageManifest::write(string manifestFile) {
+        ofstream manifestStream;
+
+        manifestStream.open(manifestFile.c_str(), ios::out);
+        if (!(manifestStream.is_open())) {
+            SageIngest_error("SageManifest: Error in opening manifest file for writing.\n");
+        }
+
+        manifestStream << "# fileSize numRows numTrees snapnum rowOffset recordSize path" << endl;
+        for (size_t i=0; i<entries.size(); i++) {
+            const SageManifestEntry & entry = entries[i];
+            manifestStream << entry.fileSize << " " << entry.numRows << " " << entry.numTrees << " "
+                << entry.snapnum << " " << entry.rowOffset << " " << entry.recordSize << " " << entry.path << endl;
+        }
+
+        manifestStream.close();
+        if (!manifestStream) {
+            SageIngest_error("SageManifest: Error in writing manifest file.\n");
+        }
+    }
+
+    void SageManifest::read(string manifestFile) {
+        ifstream manifestStream;
+        string line;
+
+        manifestStream.open(manifestFile.c_str(), ios::in);
+        if (!(manifestStream.is_open())) {
+            SageIngest_error("SageManifest: Error in opening manifest file.\n");
+        }
+
+        entries.clear();
+        while (getline(manifestStream, line)) {
+            if (line.length() == 0 || line[0] == '#') {
+                continue;
+            }
+            SageManifestEntry entry;
+            istringstream lineStream(line);
+            if (!(lineStream >> entry.fileSize >> entry.numRows >> entry.numTrees >> entry.snapnum
+                  >> entry.rowOffset >> entry.recordSize >> ws) || !getline(lineStream, entry.path)) {
+                ostringstream message;
+                message << "SageManifest: Cannot read line '" << line << "' in manifest " << manifestFile << "." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            entry.index = entries.size();
+            entries.push_back(entry);
+        }
+
+        manifestStream.close();
+    }
+
+    // Split the files into numParts parts with about the same number of rows
+    // (largest file first to the part with the fewest rows so far) and return
+    // part number part (0, ..., numParts-1), with the files in manifest order.
+    SageManifest SageManifest::getPart(int part, int numParts) {
+        SageManifest partManifest;
+        vector<size_t> order(entries.size());
+        vector<long> partRows(numParts, 0);
+
+        if (part < 0 || part >= numParts) {
+            SageIngest_error("SageManifest: Part number must be between 0 and number of parts - 1.\n");
+        }
+
+        for (size_t i=0; i<order.size(); i++) {
+            order[i] = i;
+        }
+        SageEntriesByRows byRows;
+        byRows.entries = &entries;
+        stable_sort(order.begin(), order.end(), byRows);
+
+        vector<size_t> selected;
+        for (size_t i=0; i<order.size(); i++) {
+            int smallest = min_element(partRows.begin(), partRows.end()) - partRows.begin();
+            partRows[smallest] += entries[order[i]].numRows;
+            if (smallest == part) {
+                selected.push_back(order[i]);
+            }
+        }
+        sort(selected.begin(), selected.end());
+
+        for (size_t i=0; i<selected.size(); i++) {
+            partManifest.entries.push_back(entries[selected[i]]);
+        }
+
+        return partManifest;
+    }
+
+    size_t SageManifest::size() {
+        return entries.size();
+    }
+
+    const SageManifestEntry & SageManifest::getEntry(size_t i) {
+        return entries[i];
+    }
+
+    long SageManifest::getTotalRows() {
+        long totalRows = 0;
+        for (size_t i=0; i<entries.size(); i++) {
+            totalRows += entries[i].numRows;
+        }
+        return totalRows;
+    }
+
+}
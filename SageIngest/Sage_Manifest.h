@@ -0,0 +1,71 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#ifndef Sage_Sage_Manifest_h
+#define Sage_Sage_Manifest_h
+
+using namespace std;
+
+namespace Sage {
+
+    // what is known about one data file from its header
+    typedef struct {
+        string path;
+        long fileSize;
+        long numRows;    // NtotGals
+        int numTrees;    // Ntrees
+        int snapnum;     // snapnum of the first row
+        long rowOffset;  // number of rows in all files before this one
+        long recordSize; // bytes per row, from file size, header size and number of rows
+        long index;      // position in the whole manifest (line number), not written
+    } SageManifestEntry;
+
+    // List of data files with their number of rows etc., written by a scan
+    // of the file headers (--scan), so that later ingest runs know the whole
+    // set of files beforehand: for numbering the rows over all files, for
+    // splitting the files evenly into parts for parallel runs, and for
+    // reporting the progress.
+    class SageManifest {
+    private:
+        vector<SageManifestEntry> entries;
+
+        void computeOffsets();
+
+    public:
+        SageManifest();
+
+        static SageManifest scan(const vector<string> &files, int bswap, int numThreads);
+
+        void write(string manifestFile);
+        void read(string manifestFile);
+
+        SageManifest getPart(int part, int numParts);
+
+        size_t size();
+        const SageManifestEntry & getEntry(size_t i);
+        long getTotalRows();
+    };
+
+}
+
+#endif
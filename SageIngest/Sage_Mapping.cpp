@@ -0,0 +1,160 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "sageingest_error.h"
+#include "Sage_Mapping.h"
+#include "Sage_Expression.h"
+
+namespace Sage {
+
+    SageMapping::SageMapping(string newMapFile) {
+        mapFile = newMapFile;
+
+        ifstream in(mapFile.c_str());
+        if (!in.is_open()) {
+            ostringstream message;
+            message << "SageMapping: Cannot open mapping file " << mapFile << "." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        string line;
+        int lineNum = 0;
+        while (getline(in, line)) {
+            lineNum++;
+            size_t comment = line.find('#');
+            if (comment != string::npos) {
+                line.erase(comment);
+            }
+
+            SageMappedColumn column;
+            istringstream fields(line);
+            if (!(fields >> column.name)) {
+                continue; // empty line
+            }
+
+            ostringstream message;
+            message << "SageMapping: Error in line " << lineNum << " of mapping file " << mapFile << ": ";
+            if (!(fields >> column.type)) {
+                message << "no type given for column " << column.name << "." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            for (size_t i=0; i<columns.size(); i++) {
+                if (columns[i].name == column.name) {
+                    message << "column " << column.name << " is given twice." << endl;
+                    SageIngest_error(message.str().c_str());
+                }
+            }
+
+            string expression;
+            getline(fields, expression);
+            expression.erase(0, expression.find_first_not_of(" \t"));
+            expression.erase(expression.find_last_not_of(" \t\r") + 1);
+
+            column.expression = NULL;
+            if (expression != "") {
+                column.expression = new SageExpression(expression);
+                expressions.push_back(column.expression);
+            } else if (SageReader::getColumnId(column.name) < 0) {
+                message << "column " << column.name << " is not a built-in column, please give an expression." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+
+            columns.push_back(column);
+        }
+
+        if (columns.empty()) {
+            ostringstream message;
+            message << "SageMapping: No columns in mapping file " << mapFile << "." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        printf("Mapping file %s: %ld columns, %ld of them computed by expressions\n",
+            mapFile.c_str(), (long) columns.size(), (long) expressions.size());
+    }
+
+    SageMapping::~SageMapping() {
+        for (size_t i=0; i<expressions.size(); i++) {
+            delete expressions[i];
+        }
+    }
+
+    // names and database types of the columns, for SageSchemaMapper::setFields
+    vector<DataField> SageMapping::getFields() const {
+        vector<DataField> fields;
+
+        for (size_t i=0; i<columns.size(); i++) {
+            fields.push_back(DataField(columns[i].name, columns[i].type));
+        }
+
+        return fields;
+    }
+
+    // index of the expression computing the column, -1 for built-in columns
+    // and columns that are not in the mapping
+    int SageMapping::findExpression(string columnName) const {
+        for (size_t i=0; i<columns.size(); i++) {
+            if (columns[i].name == columnName && columns[i].expression) {
+                return find(expressions.begin(), expressions.end(), columns[i].expression) - expressions.begin();
+            }
+        }
+        return -1;
+    }
+
+    long SageMapping::getNumExpressions() const {
+        return expressions.size();
+    }
+
+    // names of the GalaxyData fields an expression needs
+    vector<string> SageMapping::getUsedFields(int expression) const {
+        return expressions[expression]->getUsedFields();
+    }
+
+    // Evaluate all expressions for a block of n rows (firstRow rows in the
+    // file before it), but keep only the values of the nSelected rows of the
+    // selection (all rows if selection is NULL). The values of expression e
+    // are written to values + e*stride.
+    void SageMapping::evaluate(const GalaxyData * rows, long n, long firstRow, const SageExprContext & context,
+                               const vector<long> * selection, long nSelected, double * values, long stride) const {
+        vector<double> blockValues;
+
+        if (selection) {
+            blockValues.resize(n);
+        }
+
+        for (size_t e=0; e<expressions.size(); e++) {
+            double * result = values + e*stride;
+            if (!selection) {
+                expressions[e]->evaluate(rows, n, firstRow, context, result);
+                continue;
+            }
+
+            // rows are numbered in the file, so the whole block is evaluated
+            expressions[e]->evaluate(rows, n, firstRow, context, &blockValues[0]);
+            for (long k=0; k<nSelected; k++) {
+                result[k] = blockValues[(*selection)[k]];
+            }
+        }
+    }
+
+}
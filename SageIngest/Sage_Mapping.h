@@ -0,0 +1,75 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "Sage_Reader.h"
+#include "Sage_SchemaMapper.h"
+
+#ifndef Sage_Sage_Mapping_h
+#define Sage_Sage_Mapping_h
+
+namespace Sage {
+
+    class SageExpression;
+
+    // one database column of a mapping file
+    typedef struct {
+        string name;
+        string type;                // database type, e.g. BIGINT or FLOAT
+        SageExpression * expression; // NULL for the built-in columns
+    } SageMappedColumn;
+
+    // Database columns read from a mapping file (--mapFile), one column per
+    // line: name, database type and optionally an expression (see
+    // SageExpression) computing the column, e.g.
+    //
+    //     # name     type     expression
+    //     dbId       BIGINT
+    //     HaloMass   FLOAT    Mvir*1e10/h
+    //     logMstar   FLOAT    log10(StellarMass*1e10/h)
+    //
+    // Columns without an expression are the built-in columns of the reader
+    // (see Sage_ColumnWriters.cpp). The expressions are compiled once and
+    // evaluated for a whole block of rows at a time, in double precision;
+    // 64 bit ids should therefore be taken from the built-in columns.
+    class SageMapping {
+    private:
+        string mapFile;
+        vector<SageMappedColumn> columns;
+        vector<SageExpression *> expressions; // of the columns that have one, in their order
+
+    public:
+        SageMapping(string newMapFile);
+        ~SageMapping();
+
+        vector<DataField> getFields() const;
+        int findExpression(string columnName) const;
+        long getNumExpressions() const;
+        vector<string> getUsedFields(int expression) const;
+
+        void evaluate(const GalaxyData * rows, long n, long firstRow, const SageExprContext & context,
+                      const vector<long> * selection, long nSelected, double * values, long stride) const;
+    };
+
+}
+
+#endif
@@ -0,0 +1,256 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <SchemaItem.h>
+#include <DataObjDesc.h>
+#include "sageingest_error.h"
+#include "Sage_MemoryIngest.h"
+
+namespace Sage {
+
+    SageMemoryTarget::SageMemoryTarget(const vector<int> &newColumnSizes, bool newStoreRows, long newLatencyMicrosec) {
+        columnSizes = newColumnSizes;
+        storeRows = newStoreRows;
+        latencyMicrosec = newLatencyMicrosec;
+
+        numRows = 0;
+        numBatches = 0;
+        if (storeRows) {
+            columns.resize(columnSizes.size());
+        }
+    }
+
+    // values contains numBatchRows rows with the values of all columns one
+    // after the other, nulls one flag per value
+    void SageMemoryTarget::insertBatch(const char * values, const char * nulls, long numBatchRows) {
+        long rowBytes = 0;
+        for (size_t j=0; j<columnSizes.size(); j++) {
+            rowBytes += columnSizes[j];
+        }
+
+        // separately, so that the checksums do not depend on the batch size
+        valueChecksum.update(values, numBatchRows*rowBytes);
+        nullChecksum.update(nulls, numBatchRows*columnSizes.size());
+
+        if (storeRows) {
+            for (long i=0; i<numBatchRows; i++) {
+                const char * value = values + i*rowBytes;
+                for (size_t j=0; j<columnSizes.size(); j++) {
+                    columns[j].insert(columns[j].end(), value, value + columnSizes[j]);
+                    value += columnSizes[j];
+                }
+            }
+        }
+
+        if (latencyMicrosec > 0) {
+            boost::this_thread::sleep(boost::posix_time::microseconds(latencyMicrosec));
+        }
+
+        numRows += numBatchRows;
+        numBatches++;
+    }
+
+    long SageMemoryTarget::getNumRows() {
+        return numRows;
+    }
+
+    long SageMemoryTarget::getNumBatches() {
+        return numBatches;
+    }
+
+    uint32_t SageMemoryTarget::getValueChecksum() {
+        return valueChecksum.value();
+    }
+
+    uint32_t SageMemoryTarget::getNullChecksum() {
+        return nullChecksum.value();
+    }
+
+    // values of one column, if the rows are stored
+    const vector<char> & SageMemoryTarget::getColumn(int column) {
+        return columns[column];
+    }
+
+
+    SageMemoryAdaptor::SageMemoryAdaptor(bool newStoreRows, long newLatencyMicrosec) {
+        storeRows = newStoreRows;
+        latencyMicrosec = newLatencyMicrosec;
+        target = NULL;
+        rowBytes = 0;
+        started = false;
+    }
+
+    SageMemoryAdaptor::~SageMemoryAdaptor() {
+        if (target) {
+            delete target;
+        }
+    }
+
+    // nothing to connect to; the time of the report starts with the first
+    // connection after the last report
+    int SageMemoryAdaptor::connect(string usr, string pwd, string host, string port, string socket) {
+        if (!started) {
+            startTime = boost::posix_time::microsec_clock::universal_time();
+            endTime = startTime;
+            started = true;
+        }
+        return 1;
+    }
+
+    int SageMemoryAdaptor::disconnect() {
+        endTime = boost::posix_time::microsec_clock::universal_time();
+        return 1;
+    }
+
+    // the batches are inserted one after the other, nothing to roll back
+    int SageMemoryAdaptor::setSavepoint() {
+        return 1;
+    }
+
+    int SageMemoryAdaptor::rollbackToSavepoint() {
+        return 1;
+    }
+
+    int SageMemoryAdaptor::releaseSavepoint() {
+        return 1;
+    }
+
+    int SageMemoryAdaptor::disableKeys(DBDataSchema::Schema * thisSchema) {
+        return 1;
+    }
+
+    int SageMemoryAdaptor::enableKeys(DBDataSchema::Schema * thisSchema) {
+        return 1;
+    }
+
+    // the value sizes of the columns, from the data types of the schema;
+    // all statements of the adaptor must be for the same columns
+    void SageMemoryAdaptor::setColumns(DBDataSchema::Schema * thisSchema) {
+        vector<DBDataSchema::SchemaItem *> schemaItems = thisSchema->getArrSchemaItems();
+        vector<int> sizes;
+        long bytes = 0;
+
+        for (size_t j=0; j<schemaItems.size(); j++) {
+            sizes.push_back(DBDataSchema::getByteLenOfDType(schemaItems[j]->getDataDesc()->getDataObjDType()));
+            bytes += sizes.back();
+        }
+
+        if (target == NULL) {
+            columnSizes = sizes;
+            rowBytes = bytes;
+            target = new SageMemoryTarget(columnSizes, storeRows, latencyMicrosec);
+        } else if (sizes != columnSizes) {
+            SageIngest_error("SageMemoryAdaptor: All statements of a memory target must have the same columns.\n");
+        }
+    }
+
+    void * SageMemoryAdaptor::prepareMultiRowStmt(DBDataSchema::Schema * thisSchema, int numRows) {
+        setColumns(thisSchema);
+
+        SageMemoryStatement * statement = new SageMemoryStatement;
+        statement->maxRows = max(numRows, 1);
+        statement->numRows = 0;
+        statement->values.assign(statement->maxRows*rowBytes, 0);
+        statement->nulls.assign(statement->maxRows*columnSizes.size(), 0);
+
+        return statement;
+    }
+
+    // thisData is the row as buffered by DBIngestor: one pointer per column
+    // to its value, NULL for a NULL value (stored as zeros)
+    void SageMemoryAdaptor::bindRow(SageMemoryStatement * statement, void * thisData, long numRow) {
+        void ** rowData = (void **) thisData;
+        char * value = &statement->values[numRow*rowBytes];
+        char * nulls = &statement->nulls[numRow*columnSizes.size()];
+
+        if (numRow < 0 || numRow >= statement->maxRows) {
+            SageIngest_error("SageMemoryAdaptor: Row bound outside of the prepared statement.\n");
+        }
+
+        for (size_t j=0; j<columnSizes.size(); j++) {
+            nulls[j] = rowData[j] == NULL;
+            if (rowData[j] == NULL) {
+                memset(value, 0, columnSizes[j]);
+            } else {
+                memcpy(value, rowData[j], columnSizes[j]);
+            }
+            value += columnSizes[j];
+        }
+        statement->numRows = max(statement->numRows, numRow + 1L);
+    }
+
+    int SageMemoryAdaptor::bindOneRowToStmt(DBDataSchema::Schema * thisSchema, void * thisData, void * preparedStatement, int numRow) {
+        bindRow((SageMemoryStatement *) preparedStatement, thisData, numRow);
+        return 1;
+    }
+
+    // one insert batch of the rows bound so far
+    int SageMemoryAdaptor::executeStmt(void * preparedStatement) {
+        SageMemoryStatement * statement = (SageMemoryStatement *) preparedStatement;
+
+        if (statement->numRows > 0) {
+            target->insertBatch(&statement->values[0], &statement->nulls[0], statement->numRows);
+        }
+        statement->numRows = 0;
+
+        return 1;
+    }
+
+    int SageMemoryAdaptor::finalizeStmt(void * preparedStatement) {
+        delete (SageMemoryStatement *) preparedStatement;
+        return 1;
+    }
+
+    int SageMemoryAdaptor::insertOneRow(DBDataSchema::Schema * thisSchema, void * thisData) {
+        SageMemoryStatement * statement = (SageMemoryStatement *) prepareMultiRowStmt(thisSchema, 1);
+        bindRow(statement, thisData, 0);
+        executeStmt(statement);
+        finalizeStmt(statement);
+        return 1;
+    }
+
+    // the summary since the last report; the checksums start again
+    void SageMemoryAdaptor::report() {
+        long totalMillisec = (endTime-startTime).total_milliseconds();
+        long numRows = target ? target->getNumRows() : 0;
+
+        printf("Memory ingest: %ld rows in %ld batches, %ld ms (%.0f rows/s), checksum values %08x, nulls %08x\n",
+            numRows, target ? target->getNumBatches() : 0, totalMillisec,
+            totalMillisec > 0 ? 1000.*numRows/totalMillisec : 0.,
+            target ? target->getValueChecksum() : 0, target ? target->getNullChecksum() : 0);
+
+        if (target) {
+            delete target;
+            target = NULL;
+        }
+        started = false;
+    }
+
+    // of the rows since the last report, NULL if there were none
+    SageMemoryTarget * SageMemoryAdaptor::getTarget() {
+        return target;
+    }
+
+}
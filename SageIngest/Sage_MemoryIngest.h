@@ -0,0 +1,117 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <Schema.h>
+#include <DBAbstractor.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "Sage_Hash.h"
+
+#ifndef Sage_Sage_MemoryIngest_h
+#define Sage_Sage_MemoryIngest_h
+
+using namespace std;
+
+namespace Sage {
+
+    // Stand-in for a database server (-s memory): receives the rows in
+    // batches like a database receives the inserts, checksums them and
+    // optionally keeps them in memory, one column after the other. A latency
+    // per batch can be given to simulate the round trip to a server.
+    class SageMemoryTarget {
+    private:
+        vector<int> columnSizes; // bytes per value of each column
+        bool storeRows;
+        long latencyMicrosec;
+
+        vector< vector<char> > columns; // if storeRows
+        SageCrc32c valueChecksum;
+        SageCrc32c nullChecksum;
+        long numRows;
+        long numBatches;
+
+    public:
+        SageMemoryTarget(const vector<int> &newColumnSizes, bool newStoreRows, long newLatencyMicrosec);
+
+        void insertBatch(const char * values, const char * nulls, long numBatchRows);
+
+        long getNumRows();
+        long getNumBatches();
+        uint32_t getValueChecksum();
+        uint32_t getNullChecksum();
+        const vector<char> & getColumn(int column);
+    };
+
+    // a prepared multi-row insert of SageMemoryAdaptor: the bound rows,
+    // with the values of all columns one after the other
+    typedef struct {
+        long maxRows;
+        long numRows;   // rows bound so far
+        vector<char> values;
+        vector<char> nulls;
+    } SageMemoryStatement;
+
+    // Database adaptor for -s memory, used by DBIngestor like the adaptors
+    // of the DBIngestor library (see newDBAdaptor in main.cpp), so that the
+    // whole ingest path including the buffering of bufferSize rows is
+    // benchmarked without a server. The rows bound to a prepared multi-row
+    // statement go to a SageMemoryTarget when the statement is executed;
+    // the target is created at the first statement, from the schema.
+    // report prints the rows, batches and checksums since the last report.
+    class SageMemoryAdaptor : public DBServer::DBAbstractor {
+    private:
+        bool storeRows;
+        long latencyMicrosec;
+        SageMemoryTarget * target;
+        vector<int> columnSizes;
+        long rowBytes;
+        bool started;
+        boost::posix_time::ptime startTime;
+        boost::posix_time::ptime endTime;
+
+        void setColumns(DBDataSchema::Schema * thisSchema);
+        void bindRow(SageMemoryStatement * statement, void * thisData, long numRow);
+
+    public:
+        SageMemoryAdaptor(bool newStoreRows, long newLatencyMicrosec);
+        ~SageMemoryAdaptor();
+
+        int connect(string usr, string pwd, string host, string port, string socket);
+        int disconnect();
+        int setSavepoint();
+        int rollbackToSavepoint();
+        int releaseSavepoint();
+        int disableKeys(DBDataSchema::Schema * thisSchema);
+        int enableKeys(DBDataSchema::Schema * thisSchema);
+        void * prepareMultiRowStmt(DBDataSchema::Schema * thisSchema, int numRows);
+        int bindOneRowToStmt(DBDataSchema::Schema * thisSchema, void * thisData, void * preparedStatement, int numRow);
+        int executeStmt(void * preparedStatement);
+        int finalizeStmt(void * preparedStatement);
+        int insertOneRow(DBDataSchema::Schema * thisSchema, void * thisData);
+
+        void report();
+        SageMemoryTarget * getTarget();
+    };
+
+}
+
+#endif
@@ -0,0 +1,378 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "sageingest_error.h"
+#include "Sage_Pipeline.h"
+#include "Sage_BlockPool.h"
+#include "Sage_Expression.h"
+#include "Sage_Mapping.h"
+#include "Sage_Formats.h"
+#include "Sage_Affinity.h"
+
+namespace Sage {
+
+    // wait a little for another stage: spin first, then yield, then sleep
+    static void backoff(int &spins) {
+        spins++;
+        if (spins < 64) {
+            return;
+        } else if (spins < 256) {
+            boost::this_thread::yield();
+        } else {
+            boost::this_thread::sleep(boost::posix_time::microseconds(50));
+        }
+    }
+
+    SagePipeline::SagePipeline(SageReader * newReader, int newNumWorkers, int newNumBlocks, bool newComputeColumns) :
+        freeBlocks(newNumBlocks) {
+
+        reader = newReader;
+        numWorkers = max(1, newNumWorkers);
+        numBlocks = max(2, newNumBlocks);
+        computeColumns = newComputeColumns;
+
+        numBlocksRead = 0;
+        readDone = false;
+        stopping = false;
+        nextSeq = 0;
+        readWaitMicrosec = 0;
+        ingestWaitMicrosec = 0;
+
+        numExpressions = reader->mapping ? reader->mapping->getNumExpressions() : 0;
+        if (numExpressions > 0 && !computeColumns) {
+            SageIngest_error("SagePipeline: Columns computed by expressions need the columns to be computed in the pipeline.\n");
+        }
+
+        if (computeColumns) {
+            // the cells are written with the types of the schema items
+            for (size_t j=0; j<reader->columnNames.size(); j++) {
+                if (reader->columnWriters[j] == NULL && reader->valueWriters[j] == NULL) {
+                    ostringstream message;
+                    message << "SagePipeline: Field " << reader->columnNames[j] << " is not bound, call bindSchema before starting the pipeline." << endl;
+                    SageIngest_error(message.str().c_str());
+                }
+            }
+            columnWriters = reader->columnWriters;
+            valueWriters = reader->valueWriters;
+        }
+
+        // one queue per NUMA node of the transform threads
+        affinity = reader->affinity;
+        for (int k=0; k<numWorkers; k++) {
+            int node = (affinity && affinity->hasTransformCpus()) ? affinity->getTransformNode(k) : -1;
+            size_t queue = find(nodes.begin(), nodes.end(), node) - nodes.begin();
+            if (queue == nodes.size()) {
+                nodes.push_back(node);
+                filledBlocks.push_back(new boost::lockfree::queue<SageBlock *>(numBlocks));
+            }
+            workerQueues.push_back(queue);
+        }
+        WorkerStats noStats = {0, 0, 0, 0};
+        workerStats.assign(numWorkers, noStats);
+
+        // the buffers are touched first while this thread runs on the node
+        // of the block, so that their pages are placed there
+        vector<int> ownCpus = SageAffinity::getThreadCpus();
+        bool pinned = false; // to the node of an earlier block
+
+        readyBlocks = new boost::atomic<SageBlock *>[numBlocks];
+        for (int i=0; i<numBlocks; i++) {
+            SageBlock * block = new SageBlock;
+            block->seq = -1;
+            block->firstRow = 0;
+            block->n = 0;
+            block->maxRows = reader->maxBlocksize;
+            block->nSelected = 0;
+            block->hasColumns = computeColumns;
+            block->queue = workerQueues[i % numWorkers];
+
+            int node = nodes[block->queue];
+            if (node >= 0 && SageAffinity::pinThreadToNode(node)) {
+                pinned = true;
+            } else if (node >= 0) {
+                // not on the node of an earlier block either
+                if (pinned) {
+                    SageAffinity::pinThread(ownCpus);
+                    pinned = false;
+                }
+                node = -1;
+            }
+
+            // fields that are not read (HDF5) stay 0
+            block->rows = (GalaxyData *) SageBlockPool::instance().borrow(block->maxRows*sizeof(GalaxyData), node);
+            memset(block->rows, 0, block->maxRows*sizeof(GalaxyData));
+            block->raw = NULL;
+            if (reader->needsRawBuffer()) {
+                block->raw = (char *) SageBlockPool::instance().borrow(block->maxRows*reader->format->recordSize, node);
+            }
+            if (computeColumns) {
+                block->values.resize(columnWriters.size()*block->maxRows);
+                block->nulls.resize(columnWriters.size()*block->maxRows);
+                block->exprValues.resize(numExpressions*block->maxRows);
+            }
+
+            blocks.push_back(block);
+            readyBlocks[i] = NULL;
+        }
+        if (pinned) {
+            SageAffinity::pinThread(ownCpus);
+        }
+
+        printf("Pipeline: 1 read thread, %d transform threads, %d blocks of %ld rows\n", numWorkers, numBlocks, reader->maxBlocksize);
+        if (nodes[0] >= 0) {
+            printf("Pipeline: block buffers placed on %ld NUMA nodes\n", (long) nodes.size());
+        }
+    }
+
+    SagePipeline::~SagePipeline() {
+        stopping = true;
+        readThread.join();
+        transformThreads.join_all();
+
+        printf("Pipeline: %ld blocks, ingest waited %ld ms for blocks, reading waited %ld ms for free buffers\n",
+            (long) numBlocksRead, ingestWaitMicrosec/1000, readWaitMicrosec/1000);
+        if (affinity) {
+            reportNodes();
+        }
+
+        for (size_t i=0; i<blocks.size(); i++) {
+            SageBlockPool::instance().giveBack(blocks[i]->rows);
+            if (blocks[i]->raw) {
+                SageBlockPool::instance().giveBack(blocks[i]->raw);
+            }
+            delete blocks[i];
+        }
+        for (size_t q=0; q<filledBlocks.size(); q++) {
+            delete filledBlocks[q];
+        }
+        delete [] readyBlocks;
+    }
+
+    // rows transformed on each NUMA node; rows/s are over the time since
+    // the start, and per thread over the time it was busy
+    void SagePipeline::reportNodes() {
+        double seconds = (boost::posix_time::microsec_clock::universal_time() - startTime).total_microseconds()/1.e6;
+
+        for (size_t q=0; q<nodes.size(); q++) {
+            int numThreads = 0;
+            long numNodeBlocks = 0;
+            long numStolen = 0;
+            long numRows = 0;
+            long busyMicrosec = 0;
+            for (int k=0; k<numWorkers; k++) {
+                if (workerQueues[k] == (int) q) {
+                    numThreads++;
+                    numNodeBlocks += workerStats[k].numBlocks;
+                    numStolen += workerStats[k].numStolen;
+                    numRows += workerStats[k].numRows;
+                    busyMicrosec += workerStats[k].busyMicrosec;
+                }
+            }
+            printf("Pipeline node %d: %d transform threads, %ld blocks (%ld of other nodes), %ld rows, %.0f rows/s, %.0f rows/s per busy thread\n",
+                max(nodes[q], 0), numThreads, numNodeBlocks, numStolen, numRows,
+                seconds > 0 ? numRows/seconds : 0., busyMicrosec > 0 ? 1.e6*numRows/busyMicrosec : 0.);
+        }
+    }
+
+    void SagePipeline::start() {
+        for (size_t i=0; i<blocks.size(); i++) {
+            freeBlocks.push(blocks[i]);
+        }
+
+        startTime = boost::posix_time::microsec_clock::universal_time();
+        readThread = boost::thread(boost::bind(&SagePipeline::readLoop, this));
+        for (int i=0; i<numWorkers; i++) {
+            transformThreads.create_thread(boost::bind(&SagePipeline::transformLoop, this, i));
+        }
+    }
+
+    // only this thread reads from the file
+    void SagePipeline::readLoop() {
+        SageBlock * block;
+        long seq = 0;
+        int spins = 0;
+        boost::posix_time::ptime waitStart;
+
+        if (affinity) {
+            affinity->pinIO();
+        }
+
+        while (!stopping) {
+            if (!freeBlocks.pop(block)) {
+                if (spins == 0) {
+                    waitStart = boost::posix_time::microsec_clock::universal_time();
+                }
+                backoff(spins);
+                continue;
+            }
+            if (spins > 0) {
+                readWaitMicrosec += (boost::posix_time::microsec_clock::universal_time() - waitStart).total_microseconds();
+                spins = 0;
+            }
+
+            block->firstRow = reader->rowsRead;
+            block->n = reader->readRows(reader->blocksize, block->rows, block->raw);
+            if (block->n <= 0) {
+                break;
+            }
+
+            block->seq = seq++;
+            // cannot fail, there are never more blocks than numBlocks;
+            // the block goes to the queue of the node of its buffers
+            filledBlocks[block->queue]->bounded_push(block);
+        }
+
+        numBlocksRead = seq;
+        readDone = true;
+    }
+
+    void SagePipeline::transformLoop(int worker) {
+        SageBlock * block;
+        int spins = 0;
+        WorkerStats & stats = workerStats[worker];
+
+        if (affinity) {
+            affinity->pinTransform(worker);
+        }
+
+        while (!stopping) {
+            if (popFilledBlock(worker, block)) {
+                boost::posix_time::ptime transformStart = boost::posix_time::microsec_clock::universal_time();
+                transform(block);
+                stats.busyMicrosec += (boost::posix_time::microsec_clock::universal_time() - transformStart).total_microseconds();
+                stats.numBlocks++;
+                stats.numRows += block->nSelected;
+                readyBlocks[block->seq % numBlocks].store(block, boost::memory_order_release);
+                spins = 0;
+            } else if (readDone && allQueuesEmpty()) {
+                break;
+            } else {
+                backoff(spins);
+            }
+        }
+    }
+
+    // A block of the node of this worker if there is one, otherwise one of
+    // another node, so that no thread idles while blocks are waiting.
+    bool SagePipeline::popFilledBlock(int worker, SageBlock * &block) {
+        int own = workerQueues[worker];
+        if (filledBlocks[own]->pop(block)) {
+            return true;
+        }
+        for (size_t q=0; q<filledBlocks.size(); q++) {
+            if ((int) q != own && filledBlocks[q]->pop(block)) {
+                workerStats[worker].numStolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool SagePipeline::allQueuesEmpty() {
+        for (size_t q=0; q<filledBlocks.size(); q++) {
+            if (!filledBlocks[q]->empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // decode, select and compute the columns of one block, as it is done in
+    // getNextRow and getDataItem without the pipeline
+    void SagePipeline::transform(SageBlock * block) {
+        reader->decodeRows(block->n, block->raw, block->rows);
+
+        block->nSelected = reader->selectRows(block->rows, block->n, block->firstRow, block->selection);
+
+        if (!computeColumns) {
+            return;
+        }
+
+        if (numExpressions > 0) {
+            reader->mapping->evaluate(block->rows, block->n, block->firstRow, reader->filterContext,
+                reader->selecting ? &block->selection : NULL, block->nSelected, &block->exprValues[0], block->maxRows);
+        }
+
+        for (size_t j=0; j<columnWriters.size(); j++) {
+            SageColumnWriter writer = columnWriters[j];
+            long * values = &block->values[j*block->maxRows];
+            char * nulls = &block->nulls[j*block->maxRows];
+            if (valueWriters[j] != NULL) {
+                SageValueWriter valueWriter = valueWriters[j];
+                const double * exprColumn = &block->exprValues[reader->columnExprs[j]*block->maxRows];
+                for (long k=0; k<block->nSelected; k++) {
+                    valueWriter(exprColumn[k], &values[k]);
+                    nulls[k] = 0;
+                }
+                continue;
+            }
+            for (long k=0; k<block->nSelected; k++) {
+                long index = reader->selecting ? block->selection[k] : k;
+                nulls[k] = writer(*reader, block->rows[index], block->firstRow + index + 1, &values[k]);
+            }
+        }
+    }
+
+    // Next block in the order of the file, NULL at the end. The block must
+    // be given back with releaseBlock before asking for the next one.
+    SageBlock * SagePipeline::nextBlock() {
+        boost::atomic<SageBlock *> & slot = readyBlocks[nextSeq % numBlocks];
+        SageBlock * block;
+        int spins = 0;
+        boost::posix_time::ptime waitStart;
+
+        while (true) {
+            block = slot.load(boost::memory_order_acquire);
+            if (block != NULL) {
+                break;
+            }
+            if (readDone && nextSeq >= numBlocksRead) {
+                break;
+            }
+            if (spins == 0) {
+                waitStart = boost::posix_time::microsec_clock::universal_time();
+            }
+            backoff(spins);
+        }
+        if (spins > 0) {
+            ingestWaitMicrosec += (boost::posix_time::microsec_clock::universal_time() - waitStart).total_microseconds();
+        }
+
+        if (block != NULL) {
+            assert(block->seq == nextSeq);
+            slot.store(NULL, boost::memory_order_relaxed);
+            nextSeq++;
+        }
+
+        return block;
+    }
+
+    void SagePipeline::releaseBlock(SageBlock * block) {
+        freeBlocks.push(block);
+    }
+
+}
@@ -0,0 +1,133 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include "Sage_Reader.h"
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#ifndef Sage_Sage_Pipeline_h
+#define Sage_Sage_Pipeline_h
+
+namespace Sage {
+
+    class SageAffinity;
+
+    // one block of rows on its way through the pipeline
+    struct SageBlock {
+        long seq;       // number of the block in the file (0, 1, 2, ...)
+        long firstRow;  // number of rows in the file before this block
+        long n;         // number of rows in this block
+        long maxRows;   // number of rows the buffers were allocated for
+        int queue;      // index of the NUMA node the buffers are placed on, see SagePipeline::nodes
+
+        GalaxyData * rows; // decoded rows
+        char * raw;        // rows as read from the file, if they need decoding
+
+        vector<long> selection; // rows matching the filter
+        long nSelected;
+
+        // values of the database columns for the selected rows, one column
+        // (of maxRows cells with 8 bytes each) after the other
+        bool hasColumns;
+        vector<long> values;
+        vector<char> nulls;
+        vector<double> exprValues; // of the expressions of the mapping, see SageMapping::evaluate
+    };
+
+    // Reads, transforms and hands out the blocks of a SageReader in three
+    // stages: one thread reads the blocks from the file, a pool of transform
+    // threads decodes (byteswaps) them, applies the filter and computes the
+    // database columns, and the ingest thread gets the blocks in the order of
+    // the file with nextBlock. The blocks are passed between the stages with
+    // lock-free queues; the transformed blocks are put into a ring of slots
+    // (one per block buffer), so that they can be handed out in order
+    // even if they were transformed out of order. Block buffers are reused
+    // as soon as they are given back with releaseBlock.
+    // With an affinity (see SageReader::setAffinity), the threads are pinned
+    // to their CPUs, and each block is placed on the NUMA node of one of the
+    // transform threads (round robin); there is one queue of read blocks per
+    // node, and the transform threads take the blocks of their own node
+    // first, those of other nodes only if there are none.
+    class SagePipeline {
+    private:
+        SageReader * reader;
+        int numWorkers;
+        int numBlocks;
+        bool computeColumns;
+        vector<SageColumnWriter> columnWriters; // for each of the reader's columns
+        vector<SageValueWriter> valueWriters;   // instead, for the columns computed by an expression
+        long numExpressions;
+
+        vector<SageBlock *> blocks;
+        boost::lockfree::spsc_queue<SageBlock *> freeBlocks;  // ingest thread -> read thread
+        vector<boost::lockfree::queue<SageBlock *> *> filledBlocks; // read thread -> transform threads, one per node
+
+        // NUMA placement
+        const SageAffinity * affinity;
+        vector<int> nodes;        // NUMA node of each queue (-1 without affinity)
+        vector<int> workerQueues; // queue of each transform thread
+
+        // per transform thread, only written by that thread
+        typedef struct {
+            long numBlocks;
+            long numStolen; // blocks of other nodes
+            long numRows;
+            long busyMicrosec;
+        } WorkerStats;
+        vector<WorkerStats> workerStats;
+        boost::posix_time::ptime startTime;
+        boost::atomic<SageBlock *> * readyBlocks;             // transform threads -> ingest thread, at seq % numBlocks
+
+        boost::atomic<long> numBlocksRead; // total number of blocks, once readDone is set
+        boost::atomic<bool> readDone;
+        boost::atomic<bool> stopping;
+        long nextSeq; // next block to hand out
+
+        // waiting times, for finding the slowest stage
+        long readWaitMicrosec;
+        long ingestWaitMicrosec;
+
+        boost::thread readThread;
+        boost::thread_group transformThreads;
+
+        void readLoop();
+        void transformLoop(int worker);
+        bool popFilledBlock(int worker, SageBlock * &block);
+        bool allQueuesEmpty();
+        void reportNodes();
+        void transform(SageBlock * block);
+
+    public:
+        SagePipeline(SageReader * newReader, int newNumWorkers, int newNumBlocks, bool newComputeColumns);
+        ~SagePipeline();
+
+        void start();
+
+        SageBlock * nextBlock();
+        void releaseBlock(SageBlock * block);
+    };
+
+}
+
+#endif
@@ -23,11 +23,23 @@
 #include <math.h>   // sqrt, pow
 #include "sageingest_error.h"
 #include <list>
+#include <algorithm>
+#include <climits>
+#include <sys/stat.h>
 //#include <boost/filesystem.hpp>
 //#include <boost/serialization/string.hpp> // needed on erebos for conversion from boost-path to string()
 #include <boost/regex.hpp> // for string regex match/replace to remove redshift from dataSetNames
 
 #include "Sage_Reader.h"
+#include "Sage_BlockPool.h"
+#include "Sage_Expression.h"
+#include "Sage_Mapping.h"
+#include "Sage_Formats.h"
+#include "Sage_Pipeline.h"
+#include "Sage_Sampler.h"
+#include "Sage_HaloAggregator.h"
+#include "Sage_ColumnCache.h"
+#include "Sage_Duplicates.h"
 
 //using namespace boost::filesystem;
 
@@ -40,9 +52,37 @@ namespace Sage {
     SageReader::SageReader() {
 
         currRow = 0;
+        rowsReturned = 0;
+        datarows = NULL;
+        rawrows = NULL;
+        filter = NULL;
+        sampler = NULL;
+        selecting = false;
+        aggregator = NULL;
+        duplicates = NULL;
+        mapping = NULL;
+        affinity = NULL;
+        cache = NULL;
+        streaming = false;
+        fileIO = NULL;
+        treesSelected = false;
+        currRange = 0;
+        pipeline = NULL;
+        currBlock = NULL;
+        itemCursor = 0;
+        hashEnabled = false;
+        format = findFormat("mdpl2");
     }
 
     SageReader::SageReader(string newFileName, int newBswap, float newH, int newFileNum, int newBlocksize, long newMaxRows, vector<string>datafileFieldNames) {
+        columnNames = datafileFieldNames;
+        init(newFileName, newBswap, newH, newFileNum, newBlocksize, newMaxRows);
+    }
+
+    // common setup for all readers of files; calls the (virtual) openFile
+    // and getMeta, so readers for other file types call it from their own
+    // constructor
+    void SageReader::init(string newFileName, int newBswap, float newH, int newFileNum, int newBlocksize, long newMaxRows) {
 
         fileName = newFileName;
         
@@ -51,11 +91,45 @@ namespace Sage {
         bswap = newBswap;
 
         maxRows = newMaxRows;
+        rowOffset = 0;
 
         currRow = 0;
-        countInBlock = 0;   // counts rows in each block
+        countInBlock = 0;   // counts (selected) rows in each block
+        rowsRead = 0;
+        rowsReturned = 0;
+        blockStartRow = 0;
+        nSelected = 0;
+        filter = NULL;
+        sampler = NULL;
+        selecting = false;
+        aggregator = NULL;
+        duplicates = NULL;
+        mapping = NULL;
+        affinity = NULL;
+        cache = NULL;
+        streaming = false;
+        fileIO = NULL;
+        treesSelected = false;
+        currRange = 0;
+        rawrows = NULL;
+        pipeline = NULL;
+        currBlock = NULL;
+        itemCursor = 0;
+        columnItems.assign(columnNames.size(), NULL);
+        columnWriters.assign(columnNames.size(), NULL);
+        valueWriters.assign(columnNames.size(), NULL);
+        columnExprs.assign(columnNames.size(), -1);
+        hashEnabled = false;
+        format = findFormat("mdpl2"); // may be changed with setFormat
 
         blocksize = newBlocksize; // size of block in rows, i.e. row number in each block
+        maxBlocksize = blocksize;
+        minBlocksize = blocksize;
+        nInBlock = 0;
+
+        autoBlocksize = false;
+        tuneSettled = false;
+        tuneDirection = 0;
 
         // factors for constructing dbId, could/should be read from user input, actually
         snapnumfactor = 1000; // must be less than max(fileNum from user)! -> 1000 is exactly the number.
@@ -66,6 +140,10 @@ namespace Sage {
 
         h = newH; //for MDPL2, Planck cosm.: 0.6777
 
+        filterContext.h = h;
+        filterContext.fileNum = fileNum;
+        filterContext.rowOffset = rowOffset;
+
         rockstarId = 0;
         depthFirstId = 0;
         forestId = 0;
@@ -77,22 +155,30 @@ namespace Sage {
 
         totalRows = getMeta();
 
-        if (maxRows == -1) {
+        if (streaming) {
+            // the header may be written before the model knows the number of
+            // galaxies, read to the end of the stream
+            if (maxRows == -1) {
+                maxRows = LONG_MAX;
+            }
+        } else if (maxRows == -1) {
             maxRows = totalRows;
         }
 
-        if (maxRows > totalRows) {
+        if (maxRows > totalRows && !streaming) {
             printf("WARNING: total number of rows is %ld, but %ld rows were requested. Setting maxRows to %ld.\n",
                 totalRows, maxRows, totalRows);
             maxRows = totalRows;
         }
 
-        // allocate memory for datablock
+        // get memory for datablock from the block pool
         // (only needed once; mem. size won't change after this point, only at
-        // the end there may be less data to be read, which is no problem)
-        if (!(datarows = (GalaxyData *) malloc(blocksize*sizeof(GalaxyData))) ) {
-            SageIngest_error("SageReader: Error in allocating memory.\n");
-            exit(0);
+        // the end there may be less data to be read, which is no problem;
+        // the buffer is given back to the pool for the next file)
+        datarows = (GalaxyData *) SageBlockPool::instance().borrow(maxBlocksize*sizeof(GalaxyData));
+        if (bswap) {
+            // swapped data is decoded from a separate buffer (see setFormat)
+            rawrows = (char *) SageBlockPool::instance().borrow(maxBlocksize*format->recordSize);
         }
 
         //cout << "size of dataSetMap: " << dataSetMap.size() << endl;
@@ -100,11 +186,15 @@ namespace Sage {
 
 
     SageReader::~SageReader() {
+        stopPipeline();
         closeFile();
         // delete datablock
 
         if (datarows) {
-            free(datarows);
+            SageBlockPool::instance().giveBack(datarows);
+        }
+        if (rawrows) {
+            SageBlockPool::instance().giveBack(rawrows);
         }
 
     }
@@ -115,6 +205,14 @@ namespace Sage {
         if (fileStream.is_open())
             fileStream.close();
 
+        // a pipe is read sequentially through SageFileIO, as it comes
+        if (isPipe(newFileName)) {
+            streaming = true;
+            fileIO = new SageFileIO(newFileName, SAGE_IO_PIPE, 1L << 20, 0);
+            fileName = newFileName;
+            return;
+        }
+
         // open binary file
         fileStream.open(newFileName.c_str(), ios::in | ios::binary);
         
@@ -128,25 +226,78 @@ namespace Sage {
     void SageReader::closeFile() {
         if (fileStream.is_open())
             fileStream.close();
+        if (fileIO) {
+            fileIO->report();
+            delete fileIO;
+            fileIO = NULL;
+        }
+    }
+
+    // "-" (stdin) or a named pipe, e.g. written by a running SAGE model
+    bool SageReader::isPipe(string fileName) {
+        struct stat fileStat;
+        return fileName == "-" || (stat(fileName.c_str(), &fileStat) == 0 && S_ISFIFO(fileStat.st_mode));
+    }
+
+    // Read the rows with posix_fadvise or O_DIRECT instead of the ifstream
+    // (see SageFileIO), so that a large file does not push everything else
+    // out of the page cache, or with io_uring, with queueDepth reads of one
+    // block in flight. The header is still read by getMeta. Must be set
+    // before the first row is read.
+    void SageReader::setIOMode(SageIOMode mode, long readahead, int queueDepth) {
+        if (streaming) {
+            if (mode != SAGE_IO_STREAM) {
+                printf("WARNING: the I/O mode is not used for pipes.\n");
+            }
+            return;
+        }
+        if (fileIO) {
+            delete fileIO;
+            fileIO = NULL;
+        }
+        if (mode == SAGE_IO_STREAM) {
+            return;
+        }
+        long readSize = mode == SAGE_IO_URING ? maxBlocksize*format->recordSize : readahead;
+        fileIO = new SageFileIO(fileName, mode, readSize, queueDepth);
+        fileIO->seek(headerSize + rowsRead*format->recordSize);
+    }
+
+    // n bytes from the current position, returns the number of bytes read
+    long SageReader::readBytes(char * data, long n) {
+        if (fileIO) {
+            return fileIO->read(data, n);
+        }
+        fileStream.read(data, n);
+        return fileStream.gcount();
+    }
+
+    void SageReader::seekBytes(long offset) {
+        if (fileIO) {
+            fileIO->seek(offset);
+            return;
+        }
+        fileStream.clear();
+        fileStream.seekg(offset, ios::beg);
     }
 
     long SageReader::getMeta() {
 
-        assert(fileStream.is_open());
+        assert(fileStream.is_open() || streaming);
 
         char memchunk[4];
         int *GalsPerTree;
         long mRows;
 
-        fileStream.read((char *) &header.Ntrees, sizeof(header.Ntrees));
+        readBytes((char *) &header.Ntrees, sizeof(header.Ntrees));
         header.Ntrees = swapInt(header.Ntrees, bswap);
 
-        fileStream.read((char *) &header.NtotGals, sizeof(header.NtotGals));
+        readBytes((char *) &header.NtotGals, sizeof(header.NtotGals));
         header.NtotGals = swapInt(header.NtotGals, bswap);
         
         // also read num gal. per tree:
         GalsPerTree = (int *) malloc(header.Ntrees*sizeof(int));
-        fileStream.read((char *) GalsPerTree, header.Ntrees*sizeof(int));
+        readBytes((char *) GalsPerTree, header.Ntrees*sizeof(int));
 
         if (bswap) {
             for (int i=0; i<header.Ntrees; i++) {
@@ -156,8 +307,34 @@ namespace Sage {
 
         mRows = header.NtotGals;
 
+        // index of the trees, the galaxies of each tree follow each other
+        treeFirstRows.resize(header.Ntrees + 1);
+        treeFirstRows[0] = 0;
+        for (int i=0; i<header.Ntrees; i++) {
+            treeFirstRows[i+1] = treeFirstRows[i] + GalsPerTree[i];
+        }
+        free(GalsPerTree);
+        if (treeFirstRows[header.Ntrees] != mRows) {
+            printf("WARNING: GalsPerTree adds up to %ld galaxies instead of %ld, trees cannot be selected.\n", treeFirstRows[header.Ntrees], mRows);
+            treeFirstRows.clear();
+        }
+
+        // needed for probing the record size
+        if (streaming) {
+            headerSize = fileIO->tell();
+            fileSize = -1;
+        } else {
+            headerSize = fileStream.tellg();
+            fileStream.seekg(0, ios::end);
+            fileSize = fileStream.tellg();
+            fileStream.seekg(headerSize, ios::beg);
+        }
+
         // check:
         printf("Ntrees, NtotGals: %d %d\n", header.Ntrees, header.NtotGals);
+        if (streaming) {
+            printf("Reading from a pipe, up to the end of the stream.\n");
+        }
         //printf("Galaxies in this tree: 0: %d, 1: %d, 2: %d, 3: %d\n"; // 500: %d, 1000: %d\n", 
         //    GalsPerTree[0], GalsPerTree[1], GalsPerTree[2],GalsPerTree[3], GalsPerTree[500], GalsPerTree[1000]);
 
@@ -165,17 +342,11 @@ namespace Sage {
     }
 
     int SageReader::readNextBlock(long blocksize) {
-        assert(fileStream.is_open());
- 
         //performance output stuff
         boost::posix_time::ptime startTime;
         boost::posix_time::ptime endTime;
 
-        // make sure that we won't exceed the max. number
-        // of rows/total rows in this file:
-        // TODO!
-        blocksize = min(blocksize, maxRows-currRow);
-        if (currRow >= maxRows) {
+        if (rowsRead >= maxRows) {
             // already reached end of file, no more data available
             cout << "End of dataset reached. Nothing more to read. Done" << endl;
             return 0;
@@ -185,54 +356,969 @@ namespace Sage {
         // more efficient than just reading line by line
         startTime = boost::posix_time::microsec_clock::universal_time();
 
-        if (!fileStream.read((char *) datarows, blocksize*sizeof(GalaxyData)));
+        // decode (and swap) the whole block at once, so that filters and
+        // the snapnum check work on the correct values
+        blocksize = readRows(blocksize, datarows, rawrows);
+        decodeRows(blocksize, rawrows, datarows);
 
         endTime = boost::posix_time::microsec_clock::universal_time();
         printf("Time for reading (%ld rows): %lld ms\n", blocksize, (long long int) (endTime-startTime).total_milliseconds());
 
+        // the time since the end of the previous read is what the consumer
+        // needed to drain the previous block
+        if (autoBlocksize && !lastReadEnd.is_not_a_date_time()) {
+            tuneBlocksize(blocksize, (endTime-startTime).total_microseconds(),
+                nInBlock, (startTime-lastReadEnd).total_microseconds());
+        }
+        lastReadEnd = endTime;
+
         return blocksize;
     }
 
+    // Read the next n rows from the file, into raw if they need to be
+    // decoded (see needsRawBuffer), otherwise directly into rows; returns the
+    // number of rows read.
+    long SageReader::readRows(long n, GalaxyData * rows, char * raw) {
+        assert(fileStream.is_open() || streaming);
 
-    int SageReader::getNextRow() {
-        assert(fileStream.is_open());
+        // make sure that we won't exceed the max. number
+        // of rows/total rows in this file (or the selected trees)
+        if (treesSelected) {
+            if (currRange >= selectedRows.size()) {
+                return 0;
+            }
+            n = min(n, selectedRows[currRange].second - rowsRead);
+        }
+        n = max(0L, min(n, maxRows-rowsRead));
 
-        // read one line from already read datablock (see readNextBlock)
-        // readNextBlock returns number of read values
-        if (currRow == 0) {
-            blocksize = readNextBlock(blocksize);
-            countInBlock = 0;
+        long nBytes;
+        if (needsRawBuffer()) {
+            nBytes = readBytes(raw, n*format->recordSize);
+        } else {
+            nBytes = readBytes((char *) rows, n*sizeof(GalaxyData));
+        }
+        if (streaming) {
+            // the stream may end anywhere
+            n = nBytes/format->recordSize;
+            if (nBytes % format->recordSize != 0) {
+                printf("WARNING: the stream ended within a row, %ld bytes of it are ignored.\n", nBytes % format->recordSize);
+            }
+        }
+        rowsRead += n;
 
-            // store the snapnum in global variable for checking reading
-            snapnum = datarows[countInBlock].SnapNum;
-        } else if (countInBlock == blocksize-1) {
-            // end of block reached, read the next block
-            blocksize = readNextBlock(blocksize);
-            //cout << "nvalues in getNextRow: " << nvalues << endl;
-            countInBlock = 0;
+        // the bytes as in the file, i.e. before decoding
+        if (hashEnabled) {
+            hash.update(needsRawBuffer() ? raw : (char *) rows, nBytes);
+        }
+
+        // continue with the next selected trees; rowsRead always is the
+        // number of the next row to be read
+        if (treesSelected && rowsRead >= selectedRows[currRange].second) {
+            currRange++;
+            if (currRange < selectedRows.size()) {
+                seekRow(selectedRows[currRange].first);
+            }
+        }
+
+        return n;
+    }
+
+    void SageReader::seekFirstTree() {
+        currRange = 0;
+        if (!selectedRows.empty()) {
+            seekRow(selectedRows[0].first);
+        }
+    }
+
+    void SageReader::seekRow(long row) {
+        seekBytes(headerSize + row*format->recordSize);
+        rowsRead = row;
+    }
+
+    // Decode n rows read by readRows into rows. Does not change the reader,
+    // so it may be called from several threads for different blocks.
+    void SageReader::decodeRows(long n, const char * raw, GalaxyData * rows) const {
+        if (!needsRawBuffer()) {
+            return;
+        }
+        if (bswap) {
+            format->decodeSwap(raw, n, rows);
         } else {
-            //cout << "blocksize: " << blocksize << endl;
-            countInBlock++;
+            format->decode(raw, n, rows);
         }
+    }
 
-        if (blocksize <= 0) {
-            // might happen if end of file reached in readNextBlock (if currRow >= maxRows in min() statement)
-            return 0;
+    bool SageReader::needsRawBuffer() const {
+        return !format->native || bswap;
+    }
+
+    // go back to the first row of the file
+    void SageReader::rewindRows() {
+        seekBytes(headerSize);
+        rowsRead = 0;
+
+        if (hashEnabled) {
+            hashHeader();
+        }
+        if (treesSelected) {
+            seekFirstTree();
+        }
+    }
+
+    // Compute a CRC32C checksum of the whole file while reading it (see
+    // getHash); must be called before the first row is read. With the
+    // pipeline, this happens in the reading thread, i.e. while the previous
+    // blocks are transformed and ingested.
+    void SageReader::enableHash() {
+        if (streaming) {
+            printf("WARNING: no checksum for pipes.\n");
+            return;
+        }
+        hashEnabled = true;
+        hashHeader();
+    }
+
+    // start the checksum again with the header, which was read by getMeta
+    void SageReader::hashHeader() {
+        vector<char> headerBytes(headerSize);
+        streampos pos = fileStream.tellg();
+
+        hash.reset();
+        fileStream.seekg(0, ios::beg);
+        if (headerSize > 0 && fileStream.read(&headerBytes[0], headerSize)) {
+            hash.update(&headerBytes[0], headerSize);
+        }
+        fileStream.clear();
+        fileStream.seekg(pos, ios::beg);
+    }
+
+    // the checksum, if the whole file was read
+    bool SageReader::getHash(uint32_t &crc) {
+        if (cache) {
+            return cache->getHash(crc);
+        }
+        if (!hashEnabled || hash.getNumBytes() != fileSize) {
+            return false;
+        }
+        crc = hash.value();
+        return true;
+    }
+
+    // true if all rows of the file were read (i.e. not limited by maxRows
+    // or selected trees)
+    bool SageReader::isComplete() {
+        if (cache) {
+            return cache->isComplete();
+        }
+        return rowsRead >= totalRows && !treesSelected;
+    }
+
+    long SageReader::getTotalRows() {
+        return totalRows;
+    }
+
+    // Read and transform the blocks in other threads from now on (see
+    // SagePipeline), using numBlocks block buffers. With computeColumns, the
+    // values of the database columns are computed in the transform threads
+    // as well, otherwise only the rows are handed out (e.g. for routing).
+    void SageReader::startPipeline(int numWorkers, int numBlocks, bool computeColumns) {
+        // the snapnum check needs the snapnum of the first row, before any
+        // block is transformed; a pipe cannot be rewound, the row is only
+        // looked at there
+        if (streaming) {
+            char * firstRow = needsRawBuffer() ? rawrows : (char *) datarows;
+            long peeked = fileIO->peek(firstRow, format->recordSize);
+            if (peeked >= 0 && (size_t) peeked == format->recordSize) {
+                decodeRows(1, rawrows, datarows);
+                snapnum = datarows[0].SnapNum;
+            }
+        } else {
+            if (readRows(1, datarows, rawrows) == 1) {
+                decodeRows(1, rawrows, datarows);
+                snapnum = datarows[0].SnapNum;
+            }
+            rewindRows();
+        }
+
+        if (autoBlocksize) {
+            printf("WARNING: block size is not tuned when using the pipeline, using %ld rows.\n", blocksize);
+        }
+
+        pipeline = new SagePipeline(this, numWorkers, numBlocks, computeColumns);
+        pipeline->start();
+    }
+
+    void SageReader::stopPipeline() {
+        if (pipeline) {
+            if (currBlock) {
+                pipeline->releaseBlock(currBlock);
+                currBlock = NULL;
+            }
+            delete pipeline;
+            pipeline = NULL;
+        }
+    }
+
+    // Derive the block size (in rows) and the number of pipeline blocks
+    // from a memory budget (in bytes), and reallocate the block buffers of
+    // the reader for it; returns the number of pipeline blocks (0 without
+    // pipeline). Each block costs per row the decoded row, the raw row if it
+    // is decoded, the expression values and, in the pipeline, one value
+    // (8 bytes) and one null flag per column. The reader's own block counts
+    // as well, so the budget must hold 1 + 3 blocks with the pipeline.
+    // Blocks larger than about 32 MB hardly lower the cost per row any
+    // further, so the remaining budget rather goes into more pipeline blocks
+    // (up to 16). Must be called after setFormat and before the first row is
+    // read.
+    int SageReader::setMemBudget(long memBudget, long numExpressions, bool pipelined) {
+        const long maxBlockBytes = 32L*1024*1024;
+        const long maxNumBlocks = 16;
+        const long minNumBlocks = pipelined ? 3 : 0;
+        long rowBytes;
+        long rows;
+        int numBlocks;
+
+        rowBytes = sizeof(GalaxyData) + numExpressions*sizeof(double);
+        if (needsRawBuffer()) {
+            rowBytes += format->recordSize;
+        }
+        if (pipelined) {
+            rowBytes += columnNames.size()*(sizeof(long) + 1);
+        }
+
+        rows = min(maxBlockBytes, memBudget/(minNumBlocks + 1))/rowBytes;
+        if (rows < 1) {
+            ostringstream message;
+            message << "SageReader: Memory budget of " << memBudget << " bytes is too small, need at least "
+                << (minNumBlocks + 1)*rowBytes << " bytes for " << minNumBlocks + 1 << " blocks of one row ("
+                << rowBytes << " bytes per row)." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+        // no larger blocks than the file has rows
+        rows = min(rows, max(1L, maxRows));
+
+        numBlocks = 0;
+        if (pipelined) {
+            numBlocks = (int) min(maxNumBlocks, memBudget/(rows*rowBytes) - 1);
+            numBlocks = (int) min((long) numBlocks, max(minNumBlocks, (maxRows - 1)/rows + 1));
+        }
+
+        printf("Memory budget: %ld blocks of %ld rows, %ld bytes per row, %ld MB in total\n",
+            (long) numBlocks + 1, rows, rowBytes, (numBlocks + 1)*rows*rowBytes >> 20);
+
+        // the buffers of the reader for the new block size
+        maxBlocksize = rows;
+        minBlocksize = min(minBlocksize, maxBlocksize);
+        blocksize = autoBlocksize ? minBlocksize : maxBlocksize;
+        SageBlockPool::instance().giveBack(datarows);
+        datarows = (GalaxyData *) SageBlockPool::instance().borrow(maxBlocksize*sizeof(GalaxyData));
+        if (rawrows) {
+            SageBlockPool::instance().giveBack(rawrows);
+            rawrows = (char *) SageBlockPool::instance().borrow(maxBlocksize*format->recordSize);
+        }
+        if (mapping) {
+            exprValues.assign(mapping->getNumExpressions()*maxBlocksize, 0);
+        }
+
+        return numBlocks;
+    }
+
+    void SageReader::setAutoBlocksize(bool newAutoBlocksize, long newMinBlocksize) {
+        autoBlocksize = newAutoBlocksize;
+        minBlocksize = max(1L, min(newMinBlocksize, maxBlocksize));
+        tuneSettled = false;
+        tuneDirection = 0;
+
+        // start with the smallest block and let tuneBlocksize grow it
+        if (autoBlocksize) {
+            blocksize = minBlocksize;
+        }
+    }
+
+    // Adapt the block size after each read: if reading a block takes longer
+    // than the consumer needs to drain one, the pipeline stalls and the
+    // (fixed) cost per read is not amortized yet, so the block is doubled.
+    // If reading is more than twice as fast as draining, the block is halved
+    // to save memory. As soon as the direction flips, the smallest block
+    // size that did not stall is kept.
+    void SageReader::tuneBlocksize(long nRead, long readMicrosec, long nDrained, long drainMicrosec) {
+        double readPerRow;
+        double drainPerRow;
+        long newBlocksize;
+        int direction;
+
+        if (tuneSettled || nRead <= 0 || nDrained <= 0) {
+            return;
+        }
+
+        // compare per row, the drained block may have had a different size
+        readPerRow = (double) readMicrosec/nRead;
+        drainPerRow = (double) drainMicrosec/nDrained;
+
+        if (readPerRow > drainPerRow) {
+            direction = 1;
+        } else if (2*readPerRow < drainPerRow) {
+            direction = -1;
+        } else {
+            direction = 0;
+        }
+
+        if (direction == 0) {
+            return;
+        }
+
+        if (direction == -1 && tuneDirection == 1) {
+            // was grown because the smaller block stalled -> keep this one
+            tuneSettled = true;
+            newBlocksize = blocksize;
+        } else if (direction == 1 && tuneDirection == -1) {
+            // shrinking made it stall -> go back to the larger block
+            tuneSettled = true;
+            newBlocksize = min(2*blocksize, maxBlocksize);
+        } else if (direction == 1) {
+            newBlocksize = min(2*blocksize, maxBlocksize);
+        } else {
+            newBlocksize = max(blocksize/2, minBlocksize);
+        }
+
+        if (newBlocksize != blocksize || tuneSettled) {
+            printf("Block size tuning: read %.3f us/row, drain %.3f us/row, block size %ld -> %ld rows%s\n",
+                readPerRow, drainPerRow, blocksize, newBlocksize, tuneSettled ? " (settled)" : "");
+        }
+
+        tuneDirection = direction;
+        blocksize = newBlocksize;
+    }
+
+    long SageReader::getBlocksize() {
+        return blocksize;
+    }
+
+    // Read a snapshot list as used by SAGE, i.e. one scale factor per line,
+    // and convert it to redshifts. Empty lines and lines starting with #
+    // are skipped, so the n-th scale factor (counting from 0) is snapnum n,
+    // not the one in line n.
+    vector<float> SageReader::readSnapList(string snapListFile) {
+        vector<float> redshifts;
+        ifstream snapStream;
+        string line;
+        double a;
+
+        snapStream.open(snapListFile.c_str(), ios::in);
+        if (!(snapStream.is_open())) {
+            SageIngest_error("SageReader: Error in opening snapshot list file.\n");
+        }
+
+        while (getline(snapStream, line)) {
+            if (line.length() == 0 || line[0] == '#') {
+                continue;
+            }
+            istringstream lineStream(line);
+            if (!(lineStream >> a) || a <= 0) {
+                ostringstream message;
+                message << "SageReader: Cannot read scale factor from line '" << line
+                    << "' in snapshot list " << snapListFile << "." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            redshifts.push_back(1./a - 1.);
+        }
+
+        snapStream.close();
+
+        return redshifts;
+    }
+
+    void SageReader::setSnapRedshifts(vector<float> newSnapRedshifts) {
+        snapRedshifts = newSnapRedshifts;
+    }
+
+    const GalaxyData & SageReader::getDatarow() {
+        return datarow;
+    }
+
+    long SageReader::getCurrRow() {
+        return currRow;
+    }
+
+    // rows handed out by getNextRow and getRows so far (the selected ones)
+    long SageReader::getNumRowsReturned() {
+        return rowsReturned;
+    }
+
+    // take over everything needed for computing the values of a row from
+    // another reader (used by readers that get their rows from elsewhere)
+    void SageReader::copyRowSettings(const SageReader &source) {
+        fileName = source.fileName;
+        fileNum = source.fileNum;
+        rowOffset = source.rowOffset;
+        h = source.h;
+        bswap = source.bswap;
+        maxRows = source.maxRows;
+        totalRows = source.totalRows;
+        snapnumfactor = source.snapnumfactor;
+        rowfactor = source.rowfactor;
+        redshift = source.redshift;
+        snapRedshifts = source.snapRedshifts;
+        rockstarId = source.rockstarId;
+        depthFirstId = source.depthFirstId;
+        forestId = source.forestId;
+        snapnum = source.snapnum;
+
+        // the items are bound again on first use
+        columnNames = source.columnNames;
+        columnItems.assign(columnNames.size(), NULL);
+        columnWriters.assign(columnNames.size(), NULL);
+        valueWriters.assign(columnNames.size(), NULL);
+        columnExprs.assign(columnNames.size(), -1);
+        itemCursor = 0;
+    }
+
+    // Bind the items of the schema to the columns of the reader, choosing
+    // the column writer for the DType of each item (see
+    // Sage_ColumnWriters.h). Must be called before a pipeline computing the
+    // columns is started; otherwise the items are bound on first use.
+    void SageReader::bindSchema(DBDataSchema::Schema * schema) {
+        vector<DBDataSchema::SchemaItem *> schemaItems = schema->getArrSchemaItems();
+
+        for (size_t i=0; i<schemaItems.size(); i++) {
+            DBDataSchema::DataObjDesc * thisItem = schemaItems[i]->getDataDesc();
+            if (thisItem->getIsConstItem() || thisItem->getIsHeaderItem()) {
+                continue;
+            }
+
+            int index = -1;
+            for (size_t j=0; j<columnNames.size(); j++) {
+                if (columnNames[j] == thisItem->getDataObjName()) {
+                    index = j;
+                    break;
+                }
+            }
+            if (index < 0) {
+                printf("Something went wrong in bindSchema(), field %s not found ...\n", thisItem->getDataObjName().c_str());
+                exit(EXIT_FAILURE);
+            }
+
+            bindColumnItem(index, thisItem);
+        }
+    }
+
+    void SageReader::bindColumnItem(int index, DBDataSchema::DataObjDesc * thisItem) {
+        if (columnExprs[index] >= 0) {
+            SageValueWriter valueWriter = findValueWriter(thisItem->getDataObjDType());
+            if (valueWriter == NULL) {
+                ostringstream message;
+                message << "SageReader: Field " << columnNames[index] << " has an unsupported data type." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            columnItems[index] = thisItem;
+            valueWriters[index] = valueWriter;
+            return;
+        }
+
+        SageColumnWriter writer = findColumnWriter(getColumnId(columnNames[index]), thisItem->getDataObjDType(), columnNames[index]);
+
+        if (writer == NULL) {
+            ostringstream message;
+            message << "SageReader: Field " << columnNames[index] << " is unknown or has an unsupported data type." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        columnItems[index] = thisItem;
+        columnWriters[index] = writer;
+    }
+
+
+    int SageReader::getNextRow() {
+
+        if (pipeline) {
+            return getNextPipelineRow();
+        }
+        if (cache) {
+            return getNextCacheRow();
+        }
+
+        // read one line from already read datablock (see readNextBlock);
+        // when all (selected) rows of the block are done, read the next one
+        countInBlock++;
+        while (countInBlock >= nSelected) {
+            blockStartRow = rowsRead;
+            nInBlock = readNextBlock(blocksize);
+            countInBlock = 0;
+
+            if (nInBlock <= 0) {
+                // might happen if end of file reached in readNextBlock (if rowsRead >= maxRows in min() statement)
+                nSelected = 0;
+                return 0;
+            }
+
+            if (blockStartRow == (treesSelected ? selectedRows[0].first : 0)) {
+                // store the snapnum in global variable for checking reading;
+                // with a tree selection the first block starts at the first tree
+                snapnum = datarows[0].SnapNum;
+            }
+
+            // apply the filter and sample to the whole block at once, only
+            // the selected rows are handed out below
+            nSelected = selectRows(datarows, nInBlock, blockStartRow, selection);
+            if (aggregator) {
+                aggregator->add(datarows, selecting ? &selection : NULL, nSelected);
+            }
+            if (duplicates) {
+                duplicates->add(datarows, selecting ? &selection : NULL, nSelected);
+            }
+            if (!exprValues.empty()) {
+                // the columns of the mapping computed by expressions
+                mapping->evaluate(datarows, nInBlock, blockStartRow, filterContext, selecting ? &selection : NULL, nSelected, &exprValues[0], maxBlocksize);
+            }
         }
 
         // if not using readNextBlock:
         // fileStream.read((char *) &datarow, sizeof(GalaxyData));
 
-        datarow = datarows[countInBlock];
-        if (bswap) {
-            datarow = byteswap_GalaxyData(&datarow, bswap);
+        long index = selecting ? selection[countInBlock] : countInBlock;
+        datarow = datarows[index];
+
+        // row number in the file (starting at 1), also for filtered rows
+        currRow = blockStartRow + index + 1;
+        rowsReturned++;
+
+        return 1;
+    }
+
+    // same as getNextRow, but with the blocks coming from the pipeline, in
+    // the order of the file
+    int SageReader::getNextPipelineRow() {
+        countInBlock++;
+        while (currBlock == NULL || countInBlock >= currBlock->nSelected) {
+            if (currBlock) {
+                pipeline->releaseBlock(currBlock);
+            }
+            currBlock = pipeline->nextBlock();
+            countInBlock = 0;
+
+            if (currBlock == NULL) {
+                cout << "End of dataset reached. Nothing more to read. Done" << endl;
+                return 0;
+            }
+            if (aggregator) {
+                aggregator->add(currBlock->rows, selecting ? &currBlock->selection : NULL, currBlock->nSelected);
+            }
+            if (duplicates) {
+                duplicates->add(currBlock->rows, selecting ? &currBlock->selection : NULL, currBlock->nSelected);
+            }
         }
 
-        currRow++; // global counter for all rows
+        long index = selecting ? currBlock->selection[countInBlock] : countInBlock;
+        datarow = currBlock->rows[index];
+        currRow = currBlock->firstRow + index + 1;
+        rowsReturned++;
+
+        return 1;
+    }
+
+    // same as getNextRow, but with the rows coming from the column cache;
+    // countInBlock is the row in the cache (the cache is one big block)
+    int SageReader::getNextCacheRow() {
+        countInBlock++;
+        if (countInBlock >= cache->getNumRows()) {
+            countInBlock = cache->getNumRows();
+            return 0;
+        }
+        currRow = countInBlock + 1;
+        rowsReturned++;
 
         return 1;
     }
 
+    // Bind the columns for getRows, in the order in which their values are
+    // written into the buffers (usually the order of the schema items).
+    void SageReader::bindColumns(const vector<DBDataSchema::DataObjDesc *> &items) {
+        batchItems = items;
+        batchWriters.clear();
+        batchValueWriters.clear();
+        batchCells.clear();
+        batchCacheColumns.clear();
+        batchSizes.clear();
+        batchOffsets.clear();
+        batchRowBytes = 0;
+
+        for (size_t j=0; j<items.size(); j++) {
+            SageColumnWriter writer = NULL;
+            SageValueWriter valueWriter = NULL;
+            int cell = -1;
+
+            if (items[j]->getIsHeaderItem()) {
+                SageIngest_error("SageReader: Header items are not supported.\n");
+            }
+            if (!items[j]->getIsConstItem()) {
+                string name = items[j]->getDataObjName();
+                for (size_t k=0; k<columnNames.size(); k++) {
+                    if (columnNames[k] == name) {
+                        cell = k;
+                        break;
+                    }
+                }
+                if (cell >= 0 && columnExprs[cell] >= 0) {
+                    valueWriter = findValueWriter(items[j]->getDataObjDType());
+                } else {
+                    writer = findColumnWriter(getColumnId(name), items[j]->getDataObjDType(), name);
+                }
+                if (writer == NULL && valueWriter == NULL) {
+                    printf("Something went wrong in bindColumns(), field %s not found ...\n", name.c_str());
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            batchWriters.push_back(writer);
+            batchValueWriters.push_back(valueWriter);
+            batchCells.push_back(cell);
+            batchCacheColumns.push_back(cache && (writer || valueWriter) ? cache->findColumn(items[j]->getDataObjName()) : -1);
+            batchSizes.push_back(DBDataSchema::getByteLenOfDType(items[j]->getDataObjDType()));
+            batchOffsets.push_back(batchRowBytes);
+            batchRowBytes += batchSizes.back();
+        }
+    }
+
+    // bytes of one row in the buffers of getRows
+    long SageReader::getRowBytes() {
+        return batchRowBytes;
+    }
+
+    // Fill values (and one null flag per value into nulls) for up to numRows
+    // rows with the columns given to bindColumns, each value with the size
+    // of its data type. In row-major layout each row takes getRowBytes()
+    // bytes (and one null flag per column), in column-major layout each
+    // column takes numRows values, also if less rows are returned. Returns
+    // the number of rows, 0 at the end of the file.
+    // Instead of one (virtual) getItemInRow call per value, each column is
+    // filled for all rows of a block at once.
+    long SageReader::getRows(long numRows, char * values, char * nulls, SageBatchLayout layout) {
+        long n = 0;
+
+        while (n < numRows) {
+            // makes sure that there is a block with at least one row left
+            if (!getNextRow()) {
+                break;
+            }
+
+            long available = (cache ? cache->getNumRows() : pipeline ? currBlock->nSelected : nSelected) - countInBlock;
+            long count = min(numRows - n, available);
+            fillRows(countInBlock, count, values, nulls, n, numRows, layout);
+            n += count;
+            rowsReturned += count - 1; // the first one was counted by getNextRow
+
+            // the last of these rows is the current row now
+            countInBlock += count - 1;
+            if (cache) {
+                currRow = countInBlock + 1;
+                continue;
+            }
+            const GalaxyData * rows = pipeline ? currBlock->rows : datarows;
+            long index = selecting ? (pipeline ? currBlock->selection : selection)[countInBlock] : countInBlock;
+            datarow = rows[index];
+            currRow = (pipeline ? currBlock->firstRow : blockStartRow) + index + 1;
+        }
+
+        return n;
+    }
+
+    // write count rows of the current block, starting at the (selected) row
+    // first, into the buffers at row
+    void SageReader::fillRows(long first, long count, char * values, char * nulls, long row, long capacity, SageBatchLayout layout) {
+        const GalaxyData * rows = pipeline ? currBlock->rows : datarows;
+        const vector<long> & rowSelection = pipeline ? currBlock->selection : selection;
+        long firstRow = pipeline ? currBlock->firstRow : blockStartRow;
+        long numItems = batchItems.size();
+
+        for (long j=0; j<numItems; j++) {
+            int size = batchSizes[j];
+            char * dest;
+            char * destNulls;
+            long stride;
+            long nullStride;
+
+            if (layout == SAGE_ROW_MAJOR) {
+                dest = values + row*batchRowBytes + batchOffsets[j];
+                stride = batchRowBytes;
+                destNulls = nulls + row*numItems + j;
+                nullStride = numItems;
+            } else {
+                dest = values + capacity*batchOffsets[j] + row*size;
+                stride = size;
+                destNulls = nulls + j*capacity + row;
+                nullStride = 1;
+            }
+
+            if (cache && batchCacheColumns[j] >= 0) {
+                // as written by the reader before, with the size of the type
+                const char * cells = cache->getValues(batchCacheColumns[j]) + first*size;
+                const char * cellNulls = cache->getNulls(batchCacheColumns[j]) + first;
+                if (stride == size) {
+                    memcpy(dest, cells, count*size);
+                } else {
+                    for (long k=0; k<count; k++) {
+                        memcpy(dest + k*stride, cells + k*size, size);
+                    }
+                }
+                for (long k=0; k<count; k++) {
+                    destNulls[k*nullStride] = cellNulls[k];
+                }
+            } else if (batchValueWriters[j] != NULL && !(pipeline && currBlock->hasColumns)) {
+                SageValueWriter valueWriter = batchValueWriters[j];
+                const double * exprColumn = &exprValues[columnExprs[batchCells[j]]*maxBlocksize + first];
+                for (long k=0; k<count; k++) {
+                    valueWriter(exprColumn[k], dest + k*stride);
+                    destNulls[k*nullStride] = 0;
+                }
+            } else if (batchWriters[j] == NULL && batchValueWriters[j] == NULL) {
+                const void * constData = batchItems[j]->getConstData();
+                for (long k=0; k<count; k++) {
+                    memcpy(dest + k*stride, constData, size);
+                    destNulls[k*nullStride] = 0;
+                }
+            } else if (pipeline && currBlock->hasColumns && batchCells[j] >= 0) {
+                // already computed by the pipeline
+                const long * cells = &currBlock->values[batchCells[j]*currBlock->maxRows + first];
+                const char * cellNulls = &currBlock->nulls[batchCells[j]*currBlock->maxRows + first];
+                for (long k=0; k<count; k++) {
+                    memcpy(dest + k*stride, &cells[k], size);
+                    destNulls[k*nullStride] = cellNulls[k];
+                }
+            } else {
+                SageColumnWriter writer = batchWriters[j];
+                for (long k=0; k<count; k++) {
+                    long index = selecting ? rowSelection[first + k] : first + k;
+                    destNulls[k*nullStride] = writer(*this, rows[index], firstRow + index + 1, dest + k*stride);
+                }
+            }
+        }
+    }
+
+    // Set the record layout of the data file by name (see Sage_Formats.h),
+    // or determine it from the file size with "auto".
+    void SageReader::setFormat(string formatName) {
+        const SageFormat * newFormat;
+        int numMatches;
+
+        if (formatName == "auto" && streaming) {
+            printf("The size of a pipe is not known, using format mdpl2 (see --format).\n");
+            newFormat = findFormat("mdpl2");
+        } else if (formatName == "auto") {
+            newFormat = probeFormat(fileSize, headerSize, totalRows, numMatches);
+            if (numMatches == 0) {
+                printf("WARNING: file size %ld does not fit any known format for %ld rows, using mdpl2.\n", fileSize, totalRows);
+                newFormat = findFormat("mdpl2");
+            } else if (numMatches > 1) {
+                ostringstream message;
+                message << "SageReader: File size fits " << numMatches << " formats, please choose one with --format ("
+                    << getFormatNames() << ")." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+        } else {
+            newFormat = findFormat(formatName);
+            if (newFormat == NULL) {
+                ostringstream message;
+                message << "SageReader: Unknown format " << formatName << ", supported formats are: "
+                    << getFormatNames() << "." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+        }
+
+        format = newFormat;
+        printf("Data format: %s (%s), record size %ld bytes\n", format->name, format->description, (long) format->recordSize);
+
+        // all formats but the native one (or a swapped one) are read into a
+        // separate buffer and then decoded into datarows
+        if (rawrows) {
+            SageBlockPool::instance().giveBack(rawrows);
+            rawrows = NULL;
+        }
+        if (!format->native || bswap) {
+            rawrows = (char *) SageBlockPool::instance().borrow(maxBlocksize*format->recordSize);
+        }
+    }
+
+    // Only rows for which the filter expression is true are returned by
+    // getNextRow. currRow (thus dbId and NInFile) still counts all rows.
+    void SageReader::setFilter(SageExpression * newFilter) {
+        filter = newFilter;
+        selecting = filter || sampler;
+    }
+
+    // Only read the given trees, as ranges [first, last) of tree indices in
+    // the file. The reader seeks to the records of each tree, the other
+    // records are not read at all. Must be called before reading.
+    void SageReader::setTrees(const vector<pair<long,long> > &treeRanges) {
+        long numTrees = (long) treeFirstRows.size() - 1;
+
+        if (streaming) {
+            SageIngest_error("SageReader: Trees cannot be selected when reading from a pipe.\n");
+        }
+
+        if (numTrees < 0) {
+            SageIngest_error("SageReader: There is no tree information for this file, cannot select trees.\n");
+        }
+
+        selectedRows.clear();
+        for (size_t i=0; i<treeRanges.size(); i++) {
+            if (treeRanges[i].first < 0 || treeRanges[i].second > numTrees) {
+                ostringstream message;
+                message << "SageReader: Tree " << treeRanges[i].second-1 << " was selected, but the file has only "
+                    << numTrees << " trees." << endl;
+                SageIngest_error(message.str().c_str());
+            }
+            long first = treeFirstRows[treeRanges[i].first];
+            long last = treeFirstRows[treeRanges[i].second];
+            if (first == last) {
+                continue;
+            }
+            // neighbouring trees are read in one go
+            if (!selectedRows.empty() && selectedRows.back().second == first) {
+                selectedRows.back().second = last;
+            } else {
+                selectedRows.push_back(make_pair(first, last));
+            }
+        }
+
+        treesSelected = true;
+        seekFirstTree();
+    }
+
+    // Parse a list of tree indices and ranges like "3,17,100-120" into
+    // ranges [first, last), sorted and without overlaps.
+    vector<pair<long,long> > SageReader::parseTreeList(string treeList) {
+        vector<pair<long,long> > ranges;
+        vector<pair<long,long> > merged;
+        istringstream list(treeList);
+        string item;
+
+        while (getline(list, item, ',')) {
+            long first, last;
+            char dash;
+            istringstream range(item);
+
+            if (!(range >> first)) {
+                SageIngest_error("SageReader: Cannot parse the list of trees, expected e.g. 3,17,100-120.\n");
+            }
+            last = first;
+            if (range >> dash) {
+                if (dash != '-' || !(range >> last) || last < first) {
+                    SageIngest_error("SageReader: Cannot parse the list of trees, expected e.g. 3,17,100-120.\n");
+                }
+            }
+            ranges.push_back(make_pair(first, last + 1));
+        }
+
+        sort(ranges.begin(), ranges.end());
+        for (size_t i=0; i<ranges.size(); i++) {
+            if (!merged.empty() && ranges[i].first <= merged.back().second) {
+                merged.back().second = max(merged.back().second, ranges[i].second);
+            } else {
+                merged.push_back(ranges[i]);
+            }
+        }
+
+        return merged;
+    }
+
+    // Write the side-car index of the trees: one line per tree with its
+    // index, number of galaxies and the byte offset of its first record.
+    void SageReader::writeTreeIndex(string indexFile) {
+        ofstream out(indexFile.c_str(), ios::trunc);
+
+        if (!out.is_open()) {
+            ostringstream message;
+            message << "SageReader: Cannot write tree index " << indexFile << "." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        out << "# tree numGalaxies byteOffset, for " << fileName << " (record size " << format->recordSize << " bytes)" << endl;
+        for (size_t i=0; i+1<treeFirstRows.size(); i++) {
+            out << i << " " << treeFirstRows[i+1] - treeFirstRows[i] << " " << headerSize + treeFirstRows[i]*format->recordSize << "\n";
+        }
+        out.close();
+        if (!out) {
+            ostringstream message;
+            message << "SageReader: Cannot write tree index " << indexFile << "." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+    }
+
+    // Only rows of the galaxies in the sample are returned by getNextRow
+    // (together with the filter, if given); as for the filter, currRow still
+    // counts all rows. Readers that can skip the data of rows outside the
+    // sample override this.
+    void SageReader::setSampler(const SageSampler * newSampler) {
+        sampler = newSampler;
+        selecting = filter || sampler;
+    }
+
+    // All rows handed out by getNextRow (or getRows) are also added to the
+    // aggregator, a whole block at a time. Must be set before reading.
+    void SageReader::setAggregator(SageHaloAggregator * newAggregator) {
+        aggregator = newAggregator;
+    }
+
+    // the same for the duplicate detector (see SageDuplicateDetector)
+    void SageReader::setDuplicateDetector(SageDuplicateDetector * newDuplicates) {
+        duplicates = newDuplicates;
+    }
+
+    // Columns of the mapping that have an expression are computed by it,
+    // for a whole block at a time, instead of by their built-in writer
+    // (see SageMapping). Must be set before the schema is bound.
+    void SageReader::setMapping(const SageMapping * newMapping) {
+        mapping = newMapping;
+        for (size_t j=0; j<columnNames.size(); j++) {
+            columnExprs[j] = mapping->findExpression(columnNames[j]);
+        }
+        exprValues.assign(mapping->getNumExpressions()*maxBlocksize, 0);
+    }
+
+    // The threads of the pipeline are pinned to the CPUs of the affinity
+    // and the block buffers placed on their NUMA nodes. Must be set before
+    // the pipeline is started.
+    void SageReader::setAffinity(const SageAffinity * newAffinity) {
+        affinity = newAffinity;
+    }
+
+    // Take the rows from the column cache, which was written by a reader of
+    // the same file with the same settings (see SageColumnCache), instead of
+    // reading the file. Must be called before the first row is handed out.
+    void SageReader::setCache(const SageColumnCache * newCache) {
+        stopPipeline();
+        cache = newCache;
+        countInBlock = -1;
+        rowsReturned = 0;
+
+        cacheColumns.clear();
+        for (size_t j=0; j<columnNames.size(); j++) {
+            cacheColumns.push_back(cache->findColumn(columnNames[j]));
+        }
+        for (size_t j=0; j<batchItems.size(); j++) {
+            batchCacheColumns[j] = batchWriters[j] || batchValueWriters[j] ? cache->findColumn(batchItems[j]->getDataObjName()) : -1;
+        }
+    }
+
+    // indices of the rows of a block that match the filter and the sample,
+    // returns their number (n if there is neither)
+    long SageReader::selectRows(const GalaxyData * rows, long n, long firstRow, vector<long> &rowSelection) const {
+        if (filter) {
+            long nSelected = filter->select(rows, n, firstRow, filterContext, rowSelection);
+            return sampler ? sampler->reduce(rows, nSelected, rowSelection) : nSelected;
+        } else if (sampler) {
+            return sampler->select(rows, n, rowSelection);
+        }
+        return n;
+    }
+
+    // Number of rows in all files before this one, for the globalRow column
+    // and variable in expressions; rows are then numbered uniquely over all files.
+    void SageReader::setRowOffset(long newRowOffset) {
+        rowOffset = newRowOffset;
+        filterContext.rowOffset = rowOffset;
+    }
+
     bool SageReader::getItemInRow(DBDataSchema::DataObjDesc * thisItem, bool applyAsserters, bool applyConverters, void* result) {
         
         bool isNull;
@@ -247,7 +1333,28 @@ namespace Sage {
             printf("We never told you to read headers...\n");
             exit(EXIT_FAILURE);
         } else {
-            isNull = getDataItem(thisItem, result);
+            int index = findColumnItem(thisItem);
+            if (cache) {
+                int column = index >= 0 ? cacheColumns[index] : cache->findColumn(thisItem->getDataObjName());
+                if (column < 0) {
+                    printf("Something went wrong in getItemInRow(), field %s not in the column cache ...\n", thisItem->getDataObjName().c_str());
+                    exit(EXIT_FAILURE);
+                }
+                int size = cache->getValueSize(column);
+                isNull = cache->getNulls(column)[countInBlock];
+                memcpy(result, cache->getValues(column) + countInBlock*size, size);
+            } else if (index < 0) {
+                isNull = getDataItem(thisItem, result);
+            } else if (currBlock && currBlock->hasColumns) {
+                // already computed by the pipeline, with the type of the item
+                long cell = index*currBlock->maxRows + countInBlock;
+                isNull = currBlock->nulls[cell];
+                memcpy(result, &currBlock->values[cell], DBDataSchema::getByteLenOfDType(thisItem->getDataObjDType()));
+            } else if (columnExprs[index] >= 0) {
+                valueWriters[index](exprValues[columnExprs[index]*maxBlocksize + countInBlock], result);
+            } else {
+                isNull = columnWriters[index](*this, datarow, currRow, result);
+            }
         }
         
         // assertions and conversions could be applied here
@@ -258,111 +1365,63 @@ namespace Sage {
         return isNull;
     }
     
-    bool SageReader::getDataItem(DBDataSchema::DataObjDesc * thisItem, void* result) {
+    // index of the item in columnNames; the items are asked for in the same
+    // order for each row, so usually the next one is the expected one
+    int SageReader::findColumnItem(DBDataSchema::DataObjDesc * thisItem) {
+        size_t n = columnItems.size();
+
+        for (size_t k=0; k<n; k++) {
+            size_t j = (itemCursor + k) % n;
+            if (columnItems[j] == thisItem) {
+                itemCursor = j + 1;
+                return j;
+            }
+        }
 
-        //check if this is "Col1" etc. and if yes, assign corresponding value
-        //the variables are declared already in Pmss_Reader.h 
-        //and the values were read in getNextRow()
-        bool isNull;
+        // first time for this item
+        for (size_t j=0; j<n; j++) {
+            if (columnItems[j] == NULL && columnNames[j] == thisItem->getDataObjName()) {
+                bindColumnItem(j, thisItem);
+                itemCursor = j + 1;
+                return j;
+            }
+        }
 
-        isNull = false;
+        return -1;
+    }
 
-        if(thisItem->getDataObjName().compare("dbId") == 0) {
-            *(long*)(result) = (datarow.SnapNum * snapnumfactor + fileNum) * rowfactor + currRow;
-        } else if(thisItem->getDataObjName().compare("snapnum") == 0) {
-            if (datarow.SnapNum != snapnum) {
-                ostringstream message;
-                message << "SageReader: Value for snapnum in this row ("
-                    << datarow.SnapNum << ") is not the same as in first row ("
-                    << snapnum << ")." << endl
-                    << "Please check the data reader! (Possible issues with little/big endian (byteswap) or 32/64-bit architecture or byte-alignment?)"
-                    << endl;
-                SageIngest_error(message.str().c_str());
-                exit(EXIT_FAILURE);
-            }
-            *(short*)(result) = datarow.SnapNum;
-        } else if(thisItem->getDataObjName().compare("redshift") == 0) {
-            *(float*)(result) = redshift;
-        } else if(thisItem->getDataObjName().compare("rockstarId") == 0) {
-            *(long*)(result) = abs(datarow.CtreesHaloID); // should be the same as HostHaloId, except or the sign
-        } else if(thisItem->getDataObjName().compare("depthFirstId") == 0) {
-            *(long*)(result) = depthFirstId;
-        } else if(thisItem->getDataObjName().compare("forestId") == 0) {
-            *(long*)(result) = forestId;
-        } else if(thisItem->getDataObjName().compare("GalaxyID") == 0) {
-            *(long*)(result) = datarow.GalaxyIndex;
-        } else if(thisItem->getDataObjName().compare("HostHaloID") == 0) {
-            *(long*)(result) = datarow.CtreesHaloID;
-        } else if (thisItem->getDataObjName().compare("MainHaloID") == 0) {
-            *(long*)(result) = datarow.CtreesCentralID;
-        } else if (thisItem->getDataObjName().compare("GalaxyType") == 0) {
-            *(short*)(result) = datarow.Type;
-        } else if (thisItem->getDataObjName().compare("HaloMass") == 0) {
-            *(float*)(result) = datarow.Mvir*1.e10;
-        } else if (thisItem->getDataObjName().compare("Vmax") == 0) {
-            *(float*)(result) = datarow.Vmax;
-        } else if (thisItem->getDataObjName().compare("spin") == 0) {
-            *(float*)(result) = sqrt( datarow.Spin[0]*datarow.Spin[0] + datarow.Spin[1]*datarow.Spin[1] + datarow.Spin[2]*datarow.Spin[2] ) / (sqrt(2)*datarow.Rvir*datarow.Vvir);
-        } else if (thisItem->getDataObjName().compare("x") == 0) {
-            *(float*)(result) = datarow.Pos[0];
-        } else if (thisItem->getDataObjName().compare("y") == 0) {
-            *(float*)(result) = datarow.Pos[1];
-        } else if (thisItem->getDataObjName().compare("z") == 0) {
-            *(float*)(result) = datarow.Pos[2];
-        } else if (thisItem->getDataObjName().compare("vx") == 0) {
-            *(float*)(result) = datarow.Vel[0];
-        } else if (thisItem->getDataObjName().compare("vy") == 0) {
-            *(float*)(result) = datarow.Vel[1];
-        } else if (thisItem->getDataObjName().compare("vz") == 0) {
-            *(float*)(result) = datarow.Vel[2];
-        } else if (thisItem->getDataObjName().compare("MstarSpheroid") == 0) {
-            *(float*)(result) = datarow.BulgeMass*1.e10;
-        } else if (thisItem->getDataObjName().compare("MstarDisk") == 0) {
-            *(float*)(result) = (datarow.StellarMass - datarow.BulgeMass)*1.e10;
-        } else if (thisItem->getDataObjName().compare("McoldDisk") == 0) {
-            *(float*)(result) = datarow.ColdGas*1.e10;
-        } else if (thisItem->getDataObjName().compare("Mhot") == 0) {
-            *(float*)(result) = datarow.HotGas*1.e10;
-        } else if (thisItem->getDataObjName().compare("Mbh") == 0) {
-            *(float*)(result) = datarow.BlackHoleMass*1.e10;
-        } else if (thisItem->getDataObjName().compare("SFRspheroid") == 0) {
-            *(float*)(result) = datarow.SfrBulge*h*1.e9;
-        } else if (thisItem->getDataObjName().compare("SFRdisk") == 0) {
-            *(float*)(result) = datarow.SfrDisk*h*1.e9;
-        } else if (thisItem->getDataObjName().compare("SFR") == 0) {
-            *(float*)(result) = (datarow.SfrBulge + datarow.SfrDisk)*h*1.e9;
-        } else if (thisItem->getDataObjName().compare("MZgasDisk") == 0) {
-            *(float*)(result) = datarow.MetalsColdGas*1e10;
-        } else if (thisItem->getDataObjName().compare("MZhotHalo") == 0) {
-            *(float*)(result) = datarow.MetalsHotGas*1.e10;
-        } else if (thisItem->getDataObjName().compare("MZstarSpheroid") == 0) {
-            *(float*)(result) = datarow.MetalsBulgeMass*1.e10;
-        } else if (thisItem->getDataObjName().compare("MZstarDisk") == 0) {
-            *(float*)(result) = (datarow.MetalsStellarMass - datarow.MetalsBulgeMass)*1.e10;
-        } else if (thisItem->getDataObjName().compare("MeanAgeStars") == 0) {
-            *(float*)(result) = datarow.MeanStarAge/h/1.e3;
-        } else if (thisItem->getDataObjName().compare("NInFile") == 0) {
-            *(long*)(result) = currRow;
-        } else if (thisItem->getDataObjName().compare("fileNum") == 0) {
-            *(int*)(result) = datarow.SnapNum * snapnumfactor + fileNum;
-        } else if (thisItem->getDataObjName().compare("ix") == 0) {
-            *(int*)(result) = 0; // if box size and ngrid was provided, we could calculate it here directly
-        } else if (thisItem->getDataObjName().compare("iy") == 0) {
-            *(int*)(result) = 0;
-        } else if (thisItem->getDataObjName().compare("iz") == 0) {
-            *(int*)(result) = 0;
-        } else if (thisItem->getDataObjName().compare("phkey") == 0) {
-            phkey = 0;
-            *(int*)(result) = phkey;
-            // better: let DBIngestor insert Null at this column
-            // => need to return 1, so that Null will be written.
-            isNull = true;
-        } else {
+    // value of an item that is not one of the reader's columns; the writer
+    // is looked up for each value here
+    bool SageReader::getDataItem(DBDataSchema::DataObjDesc * thisItem, void* result) {
+        SageColumnWriter writer = findColumnWriter(getColumnId(thisItem->getDataObjName()), thisItem->getDataObjDType(), "");
+
+        if (writer == NULL) {
             printf("Something went wrong in getDataItem(), field %s not found ...\n", thisItem->getDataObjName().c_str());
             exit(EXIT_FAILURE);
         }
 
-        return isNull;
+        return writer(*this, datarow, currRow, result);
+    }
+
+    // names of the columns in the order of SageColumnId
+    static const char * sageColumnNames[SCOL_NUMCOLUMNS] = {
+        "dbId", "snapnum", "redshift", "rockstarId", "depthFirstId",
+        "forestId", "GalaxyID", "HostHaloID", "MainHaloID", "GalaxyType",
+        "HaloMass", "Vmax", "spin", "x", "y", "z", "vx", "vy", "vz",
+        "MstarSpheroid", "MstarDisk", "McoldDisk", "Mhot", "Mbh",
+        "SFRspheroid", "SFRdisk", "SFR", "MZgasDisk", "MZhotHalo",
+        "MZstarSpheroid", "MZstarDisk", "MeanAgeStars", "NInFile",
+        "fileNum", "ix", "iy", "iz", "phkey", "globalRow"
+    };
+
+    // returns -1 for unknown columns
+    int SageReader::getColumnId(const string &columnName) {
+        for (int i=0; i<SCOL_NUMCOLUMNS; i++) {
+            if (columnName.compare(sageColumnNames[i]) == 0) {
+                return i;
+            }
+        }
+        return -1;
     }
 
     void SageReader::getConstItem(DBDataSchema::DataObjDesc * thisItem, void* result) {
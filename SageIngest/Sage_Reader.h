@@ -18,6 +18,7 @@
  */
 
 #include <Reader.h>
+#include <Schema.h>
 #include <string>
 #include <fstream>
 #include <stdio.h>
@@ -25,6 +26,10 @@
 #include <list>
 #include <sstream>
 #include <map>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "Sage_Hash.h"
+#include "Sage_ColumnWriters.h"
+#include "Sage_FileIO.h"
 
 #ifndef Sage_Sage_Reader_h
 #define Sage_Sage_Reader_h
@@ -45,6 +50,42 @@ typedef struct {
 
 namespace Sage {
 
+    class SageExpression;
+    class SageSampler;
+    class SageHaloAggregator;
+    class SageMapping;
+    class SageAffinity;
+    class SageColumnCache;
+    class SageDuplicateDetector;
+    struct SageFormat;
+    class SagePipeline;
+    struct SageBlock;
+
+    // database columns that the reader can fill (see Sage_ColumnWriters.cpp)
+    enum SageColumnId {
+        SCOL_DBID, SCOL_SNAPNUM, SCOL_REDSHIFT, SCOL_ROCKSTARID, SCOL_DEPTHFIRSTID,
+        SCOL_FORESTID, SCOL_GALAXYID, SCOL_HOSTHALOID, SCOL_MAINHALOID, SCOL_GALAXYTYPE,
+        SCOL_HALOMASS, SCOL_VMAX, SCOL_SPIN, SCOL_X, SCOL_Y, SCOL_Z, SCOL_VX, SCOL_VY, SCOL_VZ,
+        SCOL_MSTARSPHEROID, SCOL_MSTARDISK, SCOL_MCOLDDISK, SCOL_MHOT, SCOL_MBH,
+        SCOL_SFRSPHEROID, SCOL_SFRDISK, SCOL_SFR, SCOL_MZGASDISK, SCOL_MZHOTHALO,
+        SCOL_MZSTARSPHEROID, SCOL_MZSTARDISK, SCOL_MEANAGESTARS, SCOL_NINFILE,
+        SCOL_FILENUM, SCOL_IX, SCOL_IY, SCOL_IZ, SCOL_PHKEY, SCOL_GLOBALROW,
+        SCOL_NUMCOLUMNS
+    };
+
+    // values that are the same for all rows of a file, for evaluating expressions
+    typedef struct {
+        float h;
+        int fileNum;
+        long rowOffset; // rows in the files before this one (see SageManifest)
+    } SageExprContext;
+
+    // order of the values in the buffers filled by SageReader::getRows
+    enum SageBatchLayout {
+        SAGE_ROW_MAJOR,     // all values of the first row, then the second row, ...
+        SAGE_COLUMN_MAJOR   // all values of the first column, then the second column, ...
+    };
+
     // galaxy data structure
     // This structure may change with each data release!
 #pragma pack(push)  // push current alignment to stack; may not work with each
@@ -114,11 +155,13 @@ namespace Sage {
 #pragma pack(pop) // restore original alignment from stack
 
     class SageReader : public Reader {
-    private:
+    protected:
         string fileName;
         string mapFile;
 
         ifstream fileStream;
+        SageFileIO * fileIO; // reads the rows instead of fileStream, if an I/O mode is set
+        bool streaming; // reading from a pipe or stdin (with fileIO): no seeks, the number of rows may not be known
 
         SageHeader header;
 
@@ -127,10 +170,22 @@ namespace Sage {
         long numDataSets; // number of DataSets (= row fields, = columns) in each output
         long nvalues; // values in one dataset (assume the same number for each dataset of the same output group (redshift))
         long blocksize; // number of elements in one read-block, should be small enough to fit (blocksize * number of datasets) into memory
+        long maxBlocksize; // number of rows the block buffer was allocated for; blocksize may be tuned below this
+        long minBlocksize; // lower limit for the block size when tuning it at runtime
+        long nInBlock; // number of rows in the current block (less than blocksize at the end of the file)
+        long rowsRead; // number of rows read from the file so far
+        long blockStartRow; // number of rows in the file before the current block
         long maxRows; // max. number of rows per file, usually used for testing
+        long rowOffset; // number of rows in all files before this one, if known
+        long rowsReturned; // number of (selected) rows handed out so far
 
         long totalRows; // total number of rows in data file
 
+        vector<long> treeFirstRows; // first row of each tree (from GalsPerTree), and totalRows at the end
+        vector<pair<long,long> > selectedRows; // rows [first, last) of the selected trees, if any (see setTrees)
+        size_t currRange;         // index in selectedRows of the range being read
+        bool treesSelected;
+
         long snapnumfactor;
         long rowfactor;
 
@@ -145,10 +200,52 @@ namespace Sage {
         int countSnap;
 
         GalaxyData *datarows;    // for reading and storing a whole block of data
+        char *rawrows;           // block as read from file, if it needs to be decoded into datarows
+        const SageFormat * format; // record layout of the data file
+        long fileSize;
+        long headerSize; // bytes before the first record
         GalaxyData datarow; // stores one row of the read data
 
+        bool hashEnabled;  // compute a checksum of the file while reading it
+        SageCrc32c hash;
+
+        vector<string> columnNames; // database columns to be filled
+
+        SagePipeline * pipeline; // reads and transforms blocks in other threads, if started
+        SageBlock * currBlock;   // block of the pipeline that is currently handed out
+        vector<DataObjDesc *> columnItems; // schema item for each of columnNames, bound by bindSchema or on first use
+        vector<SageColumnWriter> columnWriters; // for the DType of each bound item
+        vector<SageValueWriter> valueWriters;   // instead, for the bound columns computed by an expression
+        size_t itemCursor;       // index of the next expected item in columnItems
+
+        // columns bound for getRows
+        vector<DataObjDesc *> batchItems;
+        vector<SageColumnWriter> batchWriters; // NULL for constant items
+        vector<SageValueWriter> batchValueWriters; // for columns computed by an expression, NULL otherwise
+        vector<int> batchCells;   // index of the column in the pipeline blocks, -1 if not there
+        vector<int> batchSizes;   // bytes per value
+        vector<long> batchOffsets; // of each value within a row
+        long batchRowBytes;
+
+        SageExpression * filter; // only rows matching this are returned, if given
+        SageExprContext filterContext; // also for the expressions of the mapping
+        const SageSampler * sampler; // only rows of sampled galaxies are returned, if given
+        bool selecting;          // filter or sampler given, the rows are handed out by selection
+        SageHaloAggregator * aggregator; // gets the selected rows of each block, if given
+        SageDuplicateDetector * duplicates; // also gets them, if given
+        const SageMapping * mapping; // computes some of the columns by expressions, if given
+        vector<int> columnExprs;  // expression of the mapping for each column, -1 for the built-in columns
+        vector<double> exprValues; // values of the expressions for the selected rows of the current block, maxBlocksize per expression
+        const SageAffinity * affinity; // pins the threads of the pipeline, if given
+        const SageColumnCache * cache; // the rows come from this column cache instead of the file, if given
+        vector<int> cacheColumns; // column in the cache for each of columnNames, -1 if not there
+        vector<int> batchCacheColumns; // column in the cache for each of the columns bound for getRows
+        vector<long> selection; // indices of the rows in the current block matching the filter and sample
+        long nSelected; // number of rows to return from the current block
+
         float scale;
         float redshift;
+        vector<float> snapRedshifts; // redshift for each snapnum, if a snapshot list was given
         long dbId;
         long rockstarId;
         long depthFirstId;
@@ -165,20 +262,86 @@ namespace Sage {
 
         int snapnum;
 
+        // block size auto-tuning (see tuneBlocksize)
+        bool autoBlocksize;
+        bool tuneSettled;
+        int tuneDirection; // +1 if the block was last grown, -1 if it was last shrunk
+        boost::posix_time::ptime lastReadEnd;
+
+        void copyRowSettings(const SageReader &source);
+        void init(string newFileName, int newBswap, float newH, int newFileNum, int newBlocksize, long newMaxRows);
+
+        void hashHeader();
+        void seekRow(long row);
+        long readBytes(char * data, long n);
+        void seekBytes(long offset);
+        void seekFirstTree();
+        int getNextPipelineRow();
+        int getNextCacheRow();
+        void fillRows(long first, long count, char * values, char * nulls, long row, long capacity, SageBatchLayout layout);
+        int findColumnItem(DBDataSchema::DataObjDesc * thisItem);
+        void bindColumnItem(int index, DBDataSchema::DataObjDesc * thisItem);
+
+        friend class SagePipeline;
+        friend struct SageColumns;
+
     public:
         SageReader();
         SageReader(string newFileName, int bswap, float newH, int fileNum, int newBlocksize, long maxRows, vector<string> datafileFieldNames);
         // DBDataSchema::Schema*&
-        ~SageReader();
+        virtual ~SageReader();
 
-        void openFile(string newFileName);
+        virtual void openFile(string newFileName);
 
-        void closeFile();
+        virtual void closeFile();
 
-        long getMeta();
+        virtual long getMeta();
+
+        void bindSchema(DBDataSchema::Schema * schema);
 
         int getNextRow();
         int readNextBlock(long blocksize);
+
+        virtual long readRows(long n, GalaxyData * rows, char * raw);
+        void decodeRows(long n, const char * raw, GalaxyData * rows) const;
+        virtual bool needsRawBuffer() const;
+        virtual void rewindRows();
+
+        void startPipeline(int numWorkers, int numBlocks, bool computeColumns);
+        void stopPipeline();
+
+        int setMemBudget(long memBudget, long numExpressions, bool pipelined);
+        void setAutoBlocksize(bool newAutoBlocksize, long newMinBlocksize);
+        void tuneBlocksize(long nRead, long readMicrosec, long nDrained, long drainMicrosec);
+        long getBlocksize();
+
+        void setFilter(SageExpression * newFilter);
+        void setTrees(const vector<pair<long,long> > &treeRanges);
+        static vector<pair<long,long> > parseTreeList(string treeList);
+        void writeTreeIndex(string indexFile);
+        virtual void setSampler(const SageSampler * newSampler);
+        void setAggregator(SageHaloAggregator * newAggregator);
+        void setDuplicateDetector(SageDuplicateDetector * newDuplicates);
+        void setMapping(const SageMapping * newMapping);
+        void setAffinity(const SageAffinity * newAffinity);
+        void setCache(const SageColumnCache * newCache);
+        void setIOMode(SageIOMode mode, long readahead, int queueDepth);
+        long selectRows(const GalaxyData * rows, long n, long firstRow, vector<long> &rowSelection) const;
+        void setRowOffset(long newRowOffset);
+
+        virtual void enableHash();
+        bool getHash(uint32_t &crc);
+        bool isComplete();
+        long getTotalRows();
+        void setFormat(string formatName);
+
+        static vector<float> readSnapList(string snapListFile);
+        static bool isPipe(string fileName);
+        void setSnapRedshifts(vector<float> newSnapRedshifts);
+
+        const GalaxyData & getDatarow();
+        long getCurrRow();
+        long getNumRowsReturned();
         //long* readLongDataSet(const std::string s, long &nvalues, hsize_t *nblock, hsize_t *offset);
         //int8_t* readTinyIntDataSet(const std::string s, long &nvalues, hsize_t *nblock, hsize_t *offset);
     
@@ -205,6 +368,12 @@ namespace Sage {
 
         bool getDataItem(DBDataSchema::DataObjDesc * thisItem, void* result);
 
+        void bindColumns(const vector<DBDataSchema::DataObjDesc *> &items);
+        long getRowBytes();
+        long getRows(long numRows, char * values, char * nulls, SageBatchLayout layout);
+
+        static int getColumnId(const string &columnName);
+
         void getConstItem(DBDataSchema::DataObjDesc * thisItem, void* result);
     };
     
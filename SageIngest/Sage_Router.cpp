@@ -0,0 +1,256 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <iostream>
+#include <stdio.h>
+#include <sstream>
+#include <boost/bind.hpp>
+#include "sageingest_error.h"
+#include "Sage_Router.h"
+
+namespace Sage {
+
+    SageChunkQueue::SageChunkQueue(size_t newCapacity) {
+        capacity = newCapacity;
+        closed = false;
+    }
+
+    SageChunkQueue::~SageChunkQueue() {
+        while (!chunks.empty()) {
+            delete chunks.front();
+            chunks.pop_front();
+        }
+    }
+
+    // blocks while the queue is full, so a slow route slows down the router
+    // instead of collecting all rows in memory
+    void SageChunkQueue::push(SageRowChunk * chunk) {
+        boost::mutex::scoped_lock lock(queueMutex);
+        while (chunks.size() >= capacity) {
+            notFull.wait(lock);
+        }
+        chunks.push_back(chunk);
+        notEmpty.notify_one();
+    }
+
+    // returns NULL once the queue is closed and empty
+    SageRowChunk * SageChunkQueue::pop() {
+        boost::mutex::scoped_lock lock(queueMutex);
+        SageRowChunk * chunk;
+
+        while (chunks.empty() && !closed) {
+            notEmpty.wait(lock);
+        }
+        if (chunks.empty()) {
+            return NULL;
+        }
+        chunk = chunks.front();
+        chunks.pop_front();
+        notFull.notify_one();
+
+        return chunk;
+    }
+
+    void SageChunkQueue::close() {
+        boost::mutex::scoped_lock lock(queueMutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+
+    SageRouteReader::SageRouteReader(const SageReader &source, int routeSnapnum, SageChunkQueue * newQueue) : SageReader() {
+        copyRowSettings(source);
+
+        // rows were already byteswapped by the source reader
+        bswap = 0;
+        // each route only gets rows of its own snapshot
+        snapnum = routeSnapnum;
+
+        queue = newQueue;
+        chunk = NULL;
+        countInBlock = 0;
+    }
+
+    SageRouteReader::~SageRouteReader() {
+        if (chunk) {
+            delete chunk;
+        }
+    }
+
+    void SageRouteReader::openFile(string newFileName) {
+        // nothing to open, rows come from the router
+        fileName = newFileName;
+    }
+
+    int SageRouteReader::getNextRow() {
+        if (chunk == NULL || countInBlock >= (long) chunk->rows.size()) {
+            if (chunk) {
+                delete chunk;
+            }
+            chunk = queue->pop();
+            countInBlock = 0;
+            if (chunk == NULL) {
+                return 0;
+            }
+        }
+
+        datarow = chunk->rows[countInBlock];
+        // keep the row number from the data file for dbId and NInFile
+        currRow = chunk->rowNums[countInBlock];
+        countInBlock++;
+
+        return 1;
+    }
+
+
+    SageRouter::SageRouter(SageReader * newSource, SageSchemaMapper * newSchemaMapper, SageIngestorFactory newIngestorFactory,
+                           string newDbName, string newTableTemplate, uint32_t newBufferSize) {
+        source = newSource;
+        schemaMapper = newSchemaMapper;
+        ingestorFactory = newIngestorFactory;
+        dbName = newDbName;
+        tableTemplate = newTableTemplate;
+        bufferSize = newBufferSize;
+
+        chunkSize = 4096;
+        queueCapacity = 4;
+    }
+
+    SageRouter::~SageRouter() {
+        finishRoutes();
+
+        for (map<int, Route*>::iterator it = routes.begin(); it != routes.end(); ++it) {
+            delete it->second;
+        }
+    }
+
+    // replace {snap} in the template by the snapnum; without {snap}, all
+    // routes write into the same (partitioned) table
+    string SageRouter::getTableName(string tableTemplate, int snapnum) {
+        string tableName = tableTemplate;
+        string placeholder = "{snap}";
+        ostringstream snapStr;
+        size_t pos;
+
+        snapStr << snapnum;
+        while ((pos = tableName.find(placeholder)) != string::npos) {
+            tableName.replace(pos, placeholder.length(), snapStr.str());
+        }
+
+        return tableName;
+    }
+
+    SageRouter::Route * SageRouter::getRoute(int snapnum) {
+        map<int, Route*>::iterator it = routes.find(snapnum);
+        if (it != routes.end()) {
+            return it->second;
+        }
+
+        Route * route = new Route;
+        route->snapnum = snapnum;
+        route->tableName = getTableName(tableTemplate, snapnum);
+        route->queue = new SageChunkQueue(queueCapacity);
+        route->chunk = new SageRowChunk;
+        route->chunk->rows.reserve(chunkSize);
+        route->chunk->rowNums.reserve(chunkSize);
+        route->reader = new SageRouteReader(*source, snapnum, route->queue);
+        route->schema = schemaMapper->generateSchema(dbName, route->tableName);
+        route->ingestor = ingestorFactory(route->schema, route->reader);
+        if (route->ingestor == NULL) {
+            SageIngest_error("SageRouter: Could not create ingestor for route.\n");
+        }
+
+        cout << "New route: snapnum " << snapnum << " -> table " << route->tableName << endl;
+        route->thread = new boost::thread(boost::bind(&DBIngest::DBIngestor::ingestData, route->ingestor, bufferSize));
+
+        routes[snapnum] = route;
+
+        return route;
+    }
+
+    // read all rows from the source and hand them to their routes in chunks
+    long SageRouter::run() {
+        long numRows = 0;
+        Route * route = NULL;
+        int lastSnapnum = 0;
+
+        while (source->getNextRow()) {
+            const GalaxyData & row = source->getDatarow();
+
+            // rows of one snapshot usually come in long runs
+            if (route == NULL || row.SnapNum != lastSnapnum) {
+                route = getRoute(row.SnapNum);
+                lastSnapnum = row.SnapNum;
+            }
+
+            route->chunk->rows.push_back(row);
+            route->chunk->rowNums.push_back(source->getCurrRow());
+            if (route->chunk->rows.size() >= chunkSize) {
+                route->queue->push(route->chunk);
+                route->chunk = new SageRowChunk;
+                route->chunk->rows.reserve(chunkSize);
+                route->chunk->rowNums.reserve(chunkSize);
+            }
+            numRows++;
+        }
+
+        finishRoutes();
+
+        printf("Routed %ld rows to %ld tables/partitions.\n", numRows, (long) routes.size());
+
+        return numRows;
+    }
+
+    // hand over the last partial chunks, wait for all writers to finish and
+    // clean up
+    void SageRouter::finishRoutes() {
+        for (map<int, Route*>::iterator it = routes.begin(); it != routes.end(); ++it) {
+            Route * route = it->second;
+            if (route->thread == NULL) {
+                continue;
+            }
+
+            if (route->chunk->rows.size() > 0) {
+                route->queue->push(route->chunk);
+            } else {
+                delete route->chunk;
+            }
+            route->chunk = NULL;
+            route->queue->close();
+        }
+
+        for (map<int, Route*>::iterator it = routes.begin(); it != routes.end(); ++it) {
+            Route * route = it->second;
+            if (route->thread == NULL) {
+                continue;
+            }
+
+            route->thread->join();
+            delete route->thread;
+            route->thread = NULL;
+
+            delete route->ingestor;
+            delete route->reader;
+            delete route->schema;
+            delete route->queue;
+        }
+    }
+
+}
@@ -0,0 +1,128 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include "Sage_Reader.h"
+#include "Sage_SchemaMapper.h"
+#include <DBIngestor.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+
+#ifndef Sage_Sage_Router_h
+#define Sage_Sage_Router_h
+
+namespace Sage {
+
+    // a chunk of rows for one route, with their row numbers in the data file
+    typedef struct {
+        vector<GalaxyData> rows;
+        vector<long> rowNums;
+    } SageRowChunk;
+
+    // bounded queue of row chunks between the router and one route's writer
+    class SageChunkQueue {
+    private:
+        boost::mutex queueMutex;
+        boost::condition_variable notFull;
+        boost::condition_variable notEmpty;
+
+        deque<SageRowChunk*> chunks;
+        size_t capacity;
+        bool closed;
+
+    public:
+        SageChunkQueue(size_t newCapacity);
+        ~SageChunkQueue();
+
+        void push(SageRowChunk * chunk);
+        SageRowChunk * pop();
+        void close();
+    };
+
+    // Reader for one route: gets its (already byteswapped) rows from the
+    // router instead of reading them from a file, and computes the database
+    // values with the usual SageReader logic.
+    class SageRouteReader : public SageReader {
+    private:
+        SageChunkQueue * queue;
+        SageRowChunk * chunk;
+
+    public:
+        SageRouteReader(const SageReader &source, int routeSnapnum, SageChunkQueue * newQueue);
+        ~SageRouteReader();
+
+        void openFile(string newFileName);
+
+        int getNextRow();
+    };
+
+    // callback creating a fully configured ingestor (connection settings etc.)
+    // for a route; each route needs its own database connection
+    typedef boost::function<DBIngest::DBIngestor * (DBDataSchema::Schema *, DBReader::Reader *)> SageIngestorFactory;
+
+    // Distributes the rows of a reader to one table (or partition) per
+    // snapnum. Each route has its own reader, DBIngestor and thread, so that
+    // the snapshots are loaded in parallel.
+    class SageRouter {
+    private:
+        typedef struct {
+            int snapnum;
+            string tableName;
+            SageChunkQueue * queue;
+            SageRowChunk * chunk;
+            SageRouteReader * reader;
+            DBDataSchema::Schema * schema;
+            DBIngest::DBIngestor * ingestor;
+            boost::thread * thread;
+        } Route;
+
+        SageReader * source;
+        SageSchemaMapper * schemaMapper;
+        SageIngestorFactory ingestorFactory;
+
+        string dbName;
+        string tableTemplate;
+        uint32_t bufferSize;
+
+        size_t chunkSize;
+        size_t queueCapacity;
+
+        map<int, Route*> routes;
+
+        Route * getRoute(int snapnum);
+        void finishRoutes();
+
+    public:
+        SageRouter(SageReader * newSource, SageSchemaMapper * newSchemaMapper, SageIngestorFactory newIngestorFactory,
+                   string newDbName, string newTableTemplate, uint32_t newBufferSize);
+        ~SageRouter();
+
+        static string getTableName(string tableTemplate, int snapnum);
+
+        long run();
+    };
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <sstream>
+#include "sageingest_error.h"
+#include "Sage_Sampler.h"
+
+namespace Sage {
+
+    SageSampler::SageSampler(double newFraction, uint64_t newSeed) {
+        if (!(newFraction > 0 && newFraction <= 1)) {
+            ostringstream message;
+            message << "SageSampler: Sample fraction must be in (0, 1], got " << newFraction << "." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        fraction = newFraction;
+        // spread small seeds over the whole range (golden ratio increment)
+        seed = newSeed * 0x9e3779b97f4a7c15ULL;
+        if (fraction >= 1) {
+            threshold = UINT64_MAX;
+        } else {
+            threshold = (uint64_t) (fraction * 18446744073709551616.0);
+        }
+    }
+
+    // indices of the sampled rows among the first n rows
+    long SageSampler::select(const GalaxyData * rows, long n, vector<long> &selection) const {
+        long nSelected = 0;
+
+        selection.resize(n);
+        for (long i=0; i<n; i++) {
+            selection[nSelected] = i;
+            nSelected += isSelected(rows[i].GalaxyIndex);
+        }
+
+        return nSelected;
+    }
+
+    // keep only the sampled rows of an existing selection (e.g. of a filter)
+    long SageSampler::reduce(const GalaxyData * rows, long nSelected, vector<long> &selection) const {
+        long nKept = 0;
+
+        for (long k=0; k<nSelected; k++) {
+            selection[nKept] = selection[k];
+            nKept += isSelected(rows[selection[k]].GalaxyIndex);
+        }
+
+        return nKept;
+    }
+
+    double SageSampler::getFraction() const {
+        return fraction;
+    }
+
+}
@@ -0,0 +1,60 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "Sage_Reader.h"
+
+#ifndef Sage_Sage_Sampler_h
+#define Sage_Sage_Sampler_h
+
+namespace Sage {
+
+    // Deterministic random sample of the galaxies: a galaxy is selected if a
+    // hash of its GalaxyIndex (and the seed) is below fraction of the hash
+    // range. The same galaxies are thus selected in all snapshots, files and
+    // reruns with the same seed, and nothing needs to be stored.
+    class SageSampler {
+    private:
+        double fraction;
+        uint64_t seed;
+        uint64_t threshold;
+
+    public:
+        SageSampler(double newFraction, uint64_t newSeed);
+
+        // splitmix64 finalizer, good enough mixing for consecutive indices
+        inline bool isSelected(long galaxyIndex) const {
+            uint64_t x = (uint64_t) galaxyIndex + seed;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            x = x ^ (x >> 31);
+            return x < threshold;
+        }
+
+        long select(const GalaxyData * rows, long n, vector<long> &selection) const;
+        long reduce(const GalaxyData * rows, long nSelected, vector<long> &selection) const;
+
+        double getFraction() const;
+    };
+
+}
+
+#endif
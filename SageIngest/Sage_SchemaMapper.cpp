@@ -20,6 +20,7 @@
 #include <iostream>
 
 #include "Sage_SchemaMapper.h"
+#include "sageingest_error.h"
 #include <SchemaItem.h>
 #include <DataObjDesc.h>
 #include <DType.h>
@@ -237,7 +238,45 @@ namespace Sage {
         return databaseFieldNames;
     }
 
+    // use the given columns (e.g. of a mapping file, see SageMapping)
+    // instead of the built-in ones; returns their names
+    vector<string> SageSchemaMapper::setFields(const vector<DataField> &fields) {
+        databaseFields = fields;
+        datafileFields = fields;
+        databaseFieldNames.clear();
+
+        for (size_t j=0; j<databaseFields.size(); j++) {
+            string type = databaseFields[j].type == "DOUBLE" ? "REAL" : databaseFields[j].type;
+            if (getDBType(type) == (DBType) 0 || getDType(type) == (DType) 0) {
+                string message = "SageSchemaMapper: Unknown type " + databaseFields[j].type + " for column " + databaseFields[j].name + ".\n";
+                SageIngest_error(message.c_str());
+            }
+            databaseFieldNames.push_back(databaseFields[j].name);
+        }
+
+        return databaseFieldNames;
+    }
+
     DBDataSchema::Schema * SageSchemaMapper::generateSchema(string dbName, string tblName) {
+        return generateSchemaFromFields(datafileFields, databaseFields, dbName, tblName);
+    }
+
+    // schema for the per-host-halo aggregates (see SageHaloAggregator)
+    DBDataSchema::Schema * SageSchemaMapper::generateHaloSchema(string dbName, string tblName) {
+        vector<DataField> haloFields;
+
+        haloFields.push_back(DataField("snapnum", "SMALLINT"));
+        haloFields.push_back(DataField("HostHaloID", "BIGINT"));
+        haloFields.push_back(DataField("numGalaxies", "INTEGER"));
+        haloFields.push_back(DataField("numSatellites", "INTEGER"));
+        haloFields.push_back(DataField("MstarSum", "DOUBLE"));
+        haloFields.push_back(DataField("McoldSum", "DOUBLE"));
+        haloFields.push_back(DataField("MbhSum", "DOUBLE"));
+
+        return generateSchemaFromFields(haloFields, haloFields, dbName, tblName);
+    }
+
+    DBDataSchema::Schema * SageSchemaMapper::generateSchemaFromFields(const vector<DataField> &datafileFields, const vector<DataField> &databaseFields, string dbName, string tblName) {
         DBDataSchema::Schema * returnSchema = new Schema();
 
         string datafileFieldName;
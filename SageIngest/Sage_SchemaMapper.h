@@ -66,11 +66,14 @@ namespace Sage {
         ~SageSchemaMapper();
 
         std::vector<std::string> getFieldNames();
+        std::vector<std::string> setFields(const std::vector<DataField> &fields);
 
         DBType getDBType(std::string thisDBType);
         DType  getDType(std::string thisDBType);
 
         DBDataSchema::Schema * generateSchema(std::string dbName, std::string tblName);
+        DBDataSchema::Schema * generateHaloSchema(std::string dbName, std::string tblName);
+        DBDataSchema::Schema * generateSchemaFromFields(const std::vector<DataField> &datafileFields, const std::vector<DataField> &databaseFields, std::string dbName, std::string tblName);
 
         std::vector<DataField> datafileFields, databaseFields; // make it public, so I can access it from the reader as well
     };
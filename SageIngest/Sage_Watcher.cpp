@@ -0,0 +1,286 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <algorithm>
+#include <sstream>
+#include "sageingest_error.h"
+#include "Sage_Watcher.h"
+#include "Sage_Formats.h"
+#include "Sage_HDF5Reader.h"
+
+namespace Sage {
+
+    SageWatcher::SageWatcher(string newWatchDir, string newFormatName, int newBswap, long newIdleSeconds) {
+        watchDir = newWatchDir;
+        formatName = newFormatName;
+        bswap = newBswap;
+        idleSeconds = newIdleSeconds;
+
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0 || inotify_add_watch(inotifyFd, watchDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            ostringstream message;
+            message << "SageWatcher: Cannot watch directory " << watchDir << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        // the files that are there already, in the order of their names
+        vector<string> names;
+        DIR * dir = opendir(watchDir.c_str());
+        if (dir) {
+            struct dirent * entry;
+            while ((entry = readdir(dir)) != NULL) {
+                names.push_back(entry->d_name);
+            }
+            closedir(dir);
+        }
+        sort(names.begin(), names.end());
+        for (size_t j=0; j<names.size(); j++) {
+            checkFile(watchDir + "/" + names[j], false);
+        }
+
+        lastFile = boost::posix_time::microsec_clock::universal_time();
+        lastCheck = lastFile;
+        cout << "Watching " << watchDir << " for new data files" << endl;
+    }
+
+    SageWatcher::~SageWatcher() {
+        if (inotifyFd >= 0) {
+            close(inotifyFd);
+        }
+    }
+
+    // Wait for the next complete file and append it to files; returns false
+    // when nothing came for idleSeconds.
+    bool SageWatcher::waitForFile(vector<string> &files) {
+        while (ready.empty()) {
+            long idle = (boost::posix_time::microsec_clock::universal_time() - lastFile).total_seconds();
+            if (idleSeconds > 0 && idle >= idleSeconds) {
+                cout << "No new data file in " << watchDir << " for " << idle << " s, stopping" << endl;
+                return false;
+            }
+
+            struct pollfd watchPoll;
+            watchPoll.fd = inotifyFd;
+            watchPoll.events = POLLIN;
+            watchPoll.revents = 0;
+            if (poll(&watchPoll, 1, 1000) > 0) {
+                readEvents();
+            }
+            // also while events keep coming in for other files
+            if ((boost::posix_time::microsec_clock::universal_time() - lastCheck).total_milliseconds() >= 1000) {
+                checkWaiting();
+            }
+        }
+
+        files.push_back(ready.front());
+        ready.pop_front();
+        lastFile = boost::posix_time::microsec_clock::universal_time();
+        return true;
+    }
+
+    void SageWatcher::checkWaiting() {
+        set<string> recheck = waiting;
+        for (set<string>::iterator it = recheck.begin(); it != recheck.end(); ++it) {
+            checkFile(*it, false);
+        }
+        lastCheck = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    void SageWatcher::readEvents() {
+        // aligned for the events, large enough for at least one with a name
+        char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        ssize_t n;
+
+        while ((n = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char * pos = buffer; pos < buffer + n; ) {
+                const struct inotify_event * event = (const struct inotify_event *) pos;
+                if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+                    checkFile(watchDir + "/" + event->name, true);
+                }
+                pos += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            ostringstream message;
+            message << "SageWatcher: Error reading the events of " << watchDir << " (" << strerror(errno) << ")." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+    }
+
+    // queue the file if it is complete and was not handed out before;
+    // closed is true for the files of an inotify event
+    void SageWatcher::checkFile(string path, bool closed) {
+        string name = path.substr(path.find_last_of('/') + 1);
+        if (name.empty() || name[0] == '.') {
+            return;
+        }
+        // side-car files of SageIngest itself
+        const char * skipSuffixes[] = {".trees", ".sagecache", ".tmp", ".keys"};
+        for (size_t j=0; j<sizeof(skipSuffixes)/sizeof(skipSuffixes[0]); j++) {
+            size_t len = strlen(skipSuffixes[j]);
+            if (name.length() > len && name.compare(name.length() - len, len, skipSuffixes[j]) == 0) {
+                return;
+            }
+        }
+
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) {
+            waiting.erase(path);
+            lastSeen.erase(path);
+            return;
+        }
+        pair<long,long> signature = make_pair((long) status.st_size, (long) status.st_mtime);
+
+        // its rows are in the database already (with this file's fileNum),
+        // ingesting the new contents would add them a second time
+        map<string, pair<long,long> >::iterator it = handedOut.find(path);
+        if (it != handedOut.end()) {
+            if (it->second != signature) {
+                cout << "WARNING: data file " << path << " was changed after it was ingested, it is skipped" << endl;
+                it->second = signature;
+            }
+            return;
+        }
+
+        long numRows = 0;
+        if (isComplete(path, signature, closed, numRows)) {
+            waiting.erase(path);
+            lastSeen.erase(path);
+            handedOut[path] = signature;
+            ready.push_back(path);
+            cout << "New data file " << path << " (" << numRows << " rows)" << endl;
+        } else {
+            lastSeen[path] = signature;
+            if (waiting.insert(path).second) {
+                cout << "Data file " << path << " is not complete yet, waiting" << endl;
+            }
+        }
+    }
+
+    // the size of a binary file must be the header length plus NtotGals
+    // records (of the given format, or of any format with auto); an HDF5
+    // file has no such size, it must have been closed after writing or be
+    // unchanged since the last check
+    bool SageWatcher::isComplete(string path, pair<long,long> signature, bool closed, long &numRows) {
+        long fileSize = signature.first;
+
+        if (formatName == "hdf5" || (formatName == "auto" && SageHDF5Reader::isHDF5File(path))) {
+            numRows = -1;
+            map<string, pair<long,long> >::iterator it = lastSeen.find(path);
+            return closed || (it != lastSeen.end() && it->second == signature);
+        }
+
+        ifstream fileStream(path.c_str(), ios::in | ios::binary);
+        int Ntrees;
+        int NtotGals;
+        fileStream.read((char *) &Ntrees, sizeof(Ntrees));
+        fileStream.read((char *) &NtotGals, sizeof(NtotGals));
+        if (!fileStream) {
+            return false;
+        }
+        if (bswap) {
+            Ntrees = swapValue<true>(Ntrees);
+            NtotGals = swapValue<true>(NtotGals);
+        }
+        if (Ntrees < 0 || NtotGals < 0) {
+            return false;
+        }
+
+        long headerSize = 2*sizeof(int) + (long) Ntrees*sizeof(int);
+        numRows = NtotGals;
+        if (formatName == "auto") {
+            int numMatches;
+            probeFormat(fileSize, headerSize, NtotGals, numMatches);
+            return numMatches > 0;
+        }
+        const SageFormat * format = findFormat(formatName);
+        return format && fileSize == headerSize + (long) NtotGals*(long) format->recordSize;
+    }
+
+
+    SageChainReader::SageChainReader() {
+        current = NULL;
+        sliceRows = 0;
+        sliceReturned = 0;
+        exhausted = true;
+    }
+
+    SageChainReader::~SageChainReader() {
+    }
+
+    // the rows of the next file
+    void SageChainReader::setReader(SageReader * newReader) {
+        current = newReader;
+        sliceReturned = 0;
+        exhausted = current == NULL;
+    }
+
+    // starts the next slice of at most newSliceRows rows
+    void SageChainReader::setSliceRows(long newSliceRows) {
+        sliceRows = newSliceRows;
+        sliceReturned = 0;
+    }
+
+    long SageChainReader::getSliceRowsReturned() {
+        return sliceReturned;
+    }
+
+    bool SageChainReader::isExhausted() {
+        return exhausted;
+    }
+
+    void SageChainReader::openFile(string newFileName) {
+        // the readers of the files are opened by their owner
+    }
+
+    void SageChainReader::closeFile() {
+    }
+
+    int SageChainReader::getNextRow() {
+        if (exhausted || (sliceRows > 0 && sliceReturned == sliceRows)) {
+            return 0;
+        }
+        if (!current->getNextRow()) {
+            exhausted = true;
+            return 0;
+        }
+        sliceReturned++;
+        return 1;
+    }
+
+    bool SageChainReader::getItemInRow(DBDataSchema::DataObjDesc * thisItem, bool applyAsserters, bool applyConverters, void* result) {
+        return current->getItemInRow(thisItem, applyAsserters, applyConverters, result);
+    }
+
+    void SageChainReader::getConstItem(DBDataSchema::DataObjDesc * thisItem, void* result) {
+        current->getConstItem(thisItem, result);
+    }
+
+}
@@ -0,0 +1,104 @@
+/*  
+ *  Copyright (c) 2016, Kristin Riebe <kriebe@aip.de>,
+ *                      E-Science team AIP Potsdam
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  See the NOTICE file distributed with this work for additional
+ *  information regarding copyright ownership. You may obtain a copy
+ *  of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+#include <Reader.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "Sage_Reader.h"
+
+#ifndef Sage_Sage_Watcher_h
+#define Sage_Sage_Watcher_h
+
+using namespace std;
+
+namespace Sage {
+
+    // Watches a directory (with inotify) for data files that were closed
+    // after writing or moved into it, e.g. the snapshot files of a running
+    // SAGE model. A binary file is handed out once it is complete, i.e. its
+    // size is the header length plus NtotGals records; an HDF5 file once it
+    // was closed after writing, or its size and mtime stayed the same for
+    // one check. Files that are not complete yet are checked again when they
+    // are closed again and once per second. Files already in the directory
+    // are handed out first. Each file is handed out only once; a file that
+    // is changed afterwards is skipped with a warning.
+    class SageWatcher {
+    private:
+        string watchDir;
+        string formatName;
+        int bswap;
+        long idleSeconds;   // stop after this long without a new file, 0 = never
+
+        int inotifyFd;
+        deque<string> ready;          // complete files, not handed out yet
+        set<string> waiting;          // closed, but not complete yet
+        map<string, pair<long,long> > handedOut; // size and mtime of each file handed out
+        map<string, pair<long,long> > lastSeen;  // size and mtime of waiting files at their last check
+        boost::posix_time::ptime lastFile;
+        boost::posix_time::ptime lastCheck;
+
+        void readEvents();
+        void checkWaiting();
+        void checkFile(string path, bool closed);
+        bool isComplete(string path, pair<long,long> signature, bool closed, long &numRows);
+
+    public:
+        SageWatcher(string newWatchDir, string newFormatName, int newBswap, long newIdleSeconds);
+        ~SageWatcher();
+
+        bool waitForFile(vector<string> &files);
+    };
+
+    // Hands out the rows of the reader of the current file, so that one
+    // DBIngestor (with its database connection) is used for all files:
+    // ingestData is called once per file. With setSliceRows, the rows of a
+    // file are handed out in slices, ingestData returning after each one,
+    // e.g. for adapting the buffer size within a file.
+    class SageChainReader : public DBReader::Reader {
+    private:
+        SageReader * current;
+        long sliceRows;     // 0 for all rows of the file at once
+        long sliceReturned; // rows of the current slice so far
+        bool exhausted;     // no rows left in the current file
+
+    public:
+        SageChainReader();
+        ~SageChainReader();
+
+        void setReader(SageReader * newReader);
+        void setSliceRows(long newSliceRows);
+        long getSliceRowsReturned();
+        bool isExhausted();
+
+        void openFile(string newFileName);
+        void closeFile();
+
+        int getNextRow();
+        bool getItemInRow(DBDataSchema::DataObjDesc * thisItem, bool applyAsserters, bool applyConverters, void* result);
+        void getConstItem(DBDataSchema::DataObjDesc * thisItem, void* result);
+    };
+
+}
+
+#endif
@@ -22,6 +22,24 @@
 
 #include <iostream>
 #include "Sage_Reader.h"
+#include "Sage_BlockPool.h"
+#include "Sage_Router.h"
+#include "Sage_Manifest.h"
+#include "Sage_Ledger.h"
+#include "Sage_MemoryIngest.h"
+#include "Sage_BulkIngest.h"
+#include "Sage_Expression.h"
+#include "Sage_Sampler.h"
+#include "Sage_HaloAggregator.h"
+#include "Sage_Mapping.h"
+#include "Sage_BatchSizer.h"
+#include "Sage_Affinity.h"
+#include "Sage_ColumnCache.h"
+#include "Sage_Fanout.h"
+#include "Sage_Watcher.h"
+#include "Sage_Duplicates.h"
+#include "Sage_Formats.h"
+#include "Sage_HDF5Reader.h"
 #include "Sage_SchemaMapper.h"
 #include "sageingest_error.h"
 #include <Schema.h>
@@ -30,18 +48,187 @@
 #include <AsserterFactory.h>
 #include <ConverterFactory.h>
 #include <boost/program_options.hpp>
+#include <boost/bind.hpp>
 
 #include <sstream>
 #include <vector>
+#include <algorithm>
 
 using namespace Sage;
 using namespace std;
 namespace po = boost::program_options;
 
 
+// connection settings for one database target
+typedef struct {
+    string system;
+    string dbase;
+    string table;
+    string socket;
+    string user;
+    string pwd;
+    string port;
+    string host;
+    string path;
+    bool resumeMode;
+    bool isDryRun;
+    uint32_t outputFreq;
+    bool memoryStore;       // -s memory only
+    long memoryLatency;
+} DBTarget;
+
+//settings for different DBs (copy&paste from AsciiIngest); the ones not
+//needed by the system stay empty
+void getConnection(const DBTarget & target, string & socket, string & port, string & host) {
+    socket = "";
+    port = "";
+    host = "";
+
+    if(target.system.compare("mysql") == 0) {
+        socket = target.socket;
+        port = target.port;
+        host = target.host;
+    } else if (target.system.compare("sqlite3") == 0) {
+        host = target.path;
+    } else if (target.system.compare("unix_sqlsrv_odbc") == 0) {
+        socket = "DRIVER=FreeTDS;TDS_Version=7.0;";
+        //socket = "DRIVER=SQL Server Native Client 10.0;";
+        port = target.port;
+        host = target.host;
+    } else if (target.system.compare("sqlsrv_odbc") == 0) {
+        socket = "DRIVER=SQL Server Native Client 10.0;";
+        port = target.port;
+        host = target.host;
+    } else if (target.system.compare("sqlsrv_odbc_bulk") == 0) {
+        //TESTS ON SQL SERVER SHOWED THIS IS VERY SLOW. BUT NO CLUE WHY, DID NOT BOTHER TO LOOK AT PROFILER YET
+        socket = "DRIVER=SQL Server Native Client 10.0;";
+        port = target.port;
+        host = target.host;
+    }  else if (target.system.compare("cust_odbc") == 0) {
+        socket = target.socket;
+        port = target.port;
+        host = target.host;
+    } else if (target.system.compare("cust_odbc_bulk") == 0) {
+        //TESTS ON SQL SERVER SHOWED THIS IS VERY SLOW. BUT NO CLUE WHY, DID NOT BOTHER TO LOOK AT PROFILER YET
+        socket = target.socket;
+        port = target.port;
+        host = target.host;
+    }
+}
+
+void setupConnection(DBIngest::DBIngestor * sageIngestor, const DBTarget & target) {
+    string socket, port, host;
+
+    sageIngestor->setUsrName(target.user);
+    sageIngestor->setPasswd(target.pwd);
+
+    getConnection(target, socket, port, host);
+    sageIngestor->setSocket(socket);
+    sageIngestor->setPort(port);
+    sageIngestor->setHost(host);
+
+    // setup resume option, if desired
+    sageIngestor->setResumeMode(target.resumeMode);
+    sageIngestor->setIsDryRun(target.isDryRun);
+    sageIngestor->setPerformanceMeter(target.outputFreq);	// after how many lines should I print the status?
+}
+
+// the database adaptor of a target; -s memory has its own, the others
+// come from the DBIngestor library
+DBServer::DBAbstractor * newDBAdaptor(const DBTarget & target) {
+    DBServer::DBAdaptorsFactory adaptorFac;
+
+    if (target.system == "memory") {
+        return new SageMemoryAdaptor(target.memoryStore, target.memoryLatency);
+    }
+    return adaptorFac.getDBAdaptors(target.system);
+}
+
+// after the ingest with an adaptor of newDBAdaptor: prints the summary of
+// -s memory and deletes its adaptor
+void finishDBAdaptor(DBServer::DBAbstractor * adaptor) {
+    SageMemoryAdaptor * memoryAdaptor = dynamic_cast<SageMemoryAdaptor *>(adaptor);
+
+    if (memoryAdaptor) {
+        memoryAdaptor->report();
+        delete memoryAdaptor;
+    }
+}
+
+// create an ingestor for a target with the given adaptor
+DBIngest::DBIngestor * newTargetIngestor(const DBTarget & target, DBServer::DBAbstractor * adaptor, DBDataSchema::Schema * schema, DBReader::Reader * reader) {
+    DBIngest::DBIngestor * targetIngestor;
+
+    targetIngestor = new DBIngest::DBIngestor(schema, reader, adaptor);
+    setupConnection(targetIngestor, target);
+    // the routes and targets are started in parallel, cannot ask the user for each one
+    targetIngestor->setAskUserToValidateRead(false);
+
+    return targetIngestor;
+}
+
+// create an ingestor with its own database connection, used for each route
+// when routing rows to per-snapnum tables
+DBIngest::DBIngestor * newRouteIngestor(const DBTarget & target, DBDataSchema::Schema * schema, DBReader::Reader * reader) {
+    return newTargetIngestor(target, newDBAdaptor(target), schema, reader);
+}
+
+// Connection settings of another target (--target), given as a comma
+// separated list of option=value, e.g. system=sqlite3,path=sage.db; the
+// settings not given are taken from the main target.
+DBTarget parseTarget(string spec, const DBTarget & defaults) {
+    DBTarget target = defaults;
+    istringstream specStream(spec);
+    string setting;
+
+    while (getline(specStream, setting, ',')) {
+        size_t pos = setting.find('=');
+        string name = setting.substr(0, pos);
+        string value = pos == string::npos ? "" : setting.substr(pos + 1);
+
+        if (pos == string::npos) {
+            SageIngest_error(("SageIngest: Expected option=value in --target " + spec + ".\n").c_str());
+        } else if (name == "system") {
+            target.system = value;
+        } else if (name == "dbase") {
+            target.dbase = value;
+        } else if (name == "table") {
+            target.table = value;
+        } else if (name == "socket") {
+            target.socket = value;
+        } else if (name == "user") {
+            target.user = value;
+        } else if (name == "pwd") {
+            target.pwd = value;
+        } else if (name == "port") {
+            target.port = value;
+        } else if (name == "host") {
+            target.host = value;
+        } else if (name == "path") {
+            target.path = value;
+        } else {
+            SageIngest_error(("SageIngest: Unknown setting " + name + " in --target " + spec + ".\n").c_str());
+        }
+    }
+
+    return target;
+}
+
+// print how far the ingest of the files in the manifest got, and estimate
+// the remaining time from the rows per second so far
+void reportProgress(SageManifest & manifest, size_t filesDone, long rowsDone, boost::posix_time::ptime startTime) {
+    long totalRows = manifest.getTotalRows();
+    double elapsed = (boost::posix_time::microsec_clock::universal_time() - startTime).total_milliseconds()/1000.;
+    double remaining = rowsDone > 0 ? elapsed*(totalRows - rowsDone)/rowsDone : 0;
+
+    printf("Progress: %ld of %ld rows (%.1f%%), %ld of %ld files, %.0f s elapsed, about %.0f s to go\n",
+        rowsDone, totalRows, totalRows > 0 ? 100.*rowsDone/totalRows : 100., (long) filesDone, (long) manifest.size(),
+        elapsed, remaining);
+}
+
 int main (int argc, const char * argv[])
 {
-    string dataFile;
+    vector<string> dataFiles;
     string mapFile;
     int ngrid;
     int fileNum;
@@ -50,6 +237,48 @@ int main (int argc, const char * argv[])
     float h;
     
     int user_blocksize;
+    long memBudget;
+    int numBuffers = 0;
+    bool autoBlocksize;
+    long minBlocksize;
+    bool hugePages;
+    string routeTable;
+    string snapList;
+    string where;
+    double sampleFraction;
+    long sampleSeed;
+    string formatName;
+    string hdf5Group;
+    bool prefault;
+    int transformThreads;
+    string ioCpus;
+    string transformCpus;
+    string ingestCpus;
+    string ioModeName;
+    long readahead;
+    int queueDepth;
+    bool ioBenchmark;
+    bool scan;
+    string manifestFile;
+    int scanThreads;
+    int part;
+    int numParts;
+    string ledgerFile;
+    long memoryLatency;
+    bool memoryStore;
+    bool batchRows;
+    string trees;
+    bool treeIndex;
+    string haloTable;
+    string haloFile;
+    long haloMemory;
+    string haloSpillDir;
+    string cacheDir;
+    vector<string> targetSpecs;
+    string watchDir;
+    string duplicateFilter;
+    long duplicateRows;
+    long watchIdle;
 
     string dbase;
     string table;
@@ -61,6 +290,9 @@ int main (int argc, const char * argv[])
     string host;
     string path;
     uint32_t bufferSize;
+    bool adaptiveBuffer;
+    uint32_t minBufferSize;
+    uint32_t maxBufferSize;
     uint32_t outputFreq;
 
 //    bool greedyDelim;
@@ -69,8 +301,7 @@ int main (int argc, const char * argv[])
     bool askUserToValidateRead = true; // can be overwritten by options below
     
     DBServer::DBAbstractor * dbServer;
-    DBIngest::DBIngestor * sageIngestor;
-    DBServer::DBAdaptorsFactory adaptorFac;
+    DBIngest::DBIngestor * sageIngestor = NULL;
 
 
     //build database string
@@ -91,17 +322,23 @@ int main (int argc, const char * argv[])
     dbSystemDesc.append("cust_odbc, ");
     dbSystemDesc.append("cust_odbc_bulk, ");
 #endif
+
+    // no database, see SageMemoryAdaptor
+    dbSystemDesc.append("memory, ");
     
     dbSystemDesc.append(") - [default: mysql]");
     
     
-    po::options_description progDesc("SageIngest - Ingest binary HDF5 SAGE files into databases\n\nSageIngest [OPTIONS] [dataFile]\n\nCommand line options:");
+    po::options_description progDesc("SageIngest - Ingest binary or HDF5 SAGE files into databases\n\nSageIngest [OPTIONS] [dataFile ...]\n\nCommand line options:");
         
     progDesc.add_options()
                 ("help,?", "output help")
-                ("data,d", po::value<string>(&dataFile), "datafile to ingest")
+                ("data,d", po::value<vector<string> >(&dataFiles), "datafile(s) to ingest; - or a named pipe is read as a stream")
                 ("system,s", po::value<string>(&system)->default_value("mysql"), dbSystemDesc.c_str())
                 ("bufferSize,B", po::value<uint32_t>(&bufferSize)->default_value(128), "ingest buffer size (will be reduced to sytem maximum if needed) [default: 128]")
+                ("adaptiveBuffer", po::value<bool>(&adaptiveBuffer)->default_value(0), "adapt the ingest buffer size to the measured rows/s (AIMD), starting at bufferSize, after every 8 batches (DBIngestor without batchRows is called once per 8 batches) [default: 0]")
+                ("minBufferSize", po::value<uint32_t>(&minBufferSize)->default_value(0), "lower bound for the adaptive buffer size [default: 0 = bufferSize/8]")
+                ("maxBufferSize", po::value<uint32_t>(&maxBufferSize)->default_value(0), "upper bound for the adaptive buffer size [default: 0 = 16*bufferSize]")
                 ("outputFreq,F", po::value<uint32_t>(&outputFreq)->default_value(100000), "number of rows after which a performance measurement is output [default: 100000]")
                 ("dbase,D", po::value<string>(&dbase)->default_value(""), "name of the database where the data is added to (where applicable)")
                 ("table,T", po::value<string>(&table)->default_value(""), "name of the table where the data is added to")
@@ -111,10 +348,51 @@ int main (int argc, const char * argv[])
                 ("port,O", po::value<string>(&port)->default_value("3306"), "port to use for database access (where applicable) [default: 3306 (mysql)]")
                 ("host,H", po::value<string>(&host)->default_value("localhost"), "host to use for database access (where applicable) [default: localhost]")
                 ("path,p", po::value<string>(&path)->default_value(""), "path to a database file (mainly for sqlite3, where applicable)")
-                ("mapFile,f", po::value<string>(&mapFile)->default_value(""), "path to the mapping file")
+                ("duplicateFilter", po::value<string>(&duplicateFilter)->default_value(""), "detect GalaxyIndex values ingested more than once per snapnum (e.g. the same file with another fileNum) with this filter file (and key logs <file>.*.keys, 16 bytes per row), shared by all runs and processes using it [default: \"\" = no detection]")
+                ("duplicateRows", po::value<long>(&duplicateRows)->default_value(0), "number of rows the duplicate filter is sized for when it is created [default: 0 = from the headers of the data files]")
+                ("watch", po::value<string>(&watchDir)->default_value(""), "after the given data files, ingest each data file in this directory once it is complete (closed after writing, file size matching the header), e.g. while SAGE is running; files already there are ingested first [default: \"\" = do not watch]")
+                ("watchIdle", po::value<long>(&watchIdle)->default_value(0), "stop watching (--watch) after this many seconds without a new data file [default: 0 = watch until stopped]")
+                ("target", po::value<vector<string> >(&targetSpecs), "another database target, fed from the same pass over the data files with its own connection and thread, given as option=value list, e.g. system=sqlite3,path=sage.db,table=SAGE; settings not given are taken from the main target; may be given several times")
+                ("routeTable", po::value<string>(&routeTable)->default_value(""), "route each row to a table per snapnum, given as name template with {snap} as placeholder, e.g. SAGE_{snap} (without {snap}: one partitioned table); each table is loaded by its own connection in parallel [default: \"\" = no routing, use --table]")
+                ("snapList", po::value<string>(&snapList)->default_value(""), "file with the scale factor of each snapshot (one per line, the n-th scale factor is snapnum n, counting from 0; empty lines and lines starting with # are skipped), used for the redshift column [default: \"\" = redshift -1]")
+                ("where", po::value<string>(&where)->default_value(""), "only ingest rows for which this expression over GalaxyData fields and derived columns is true, e.g. \"StellarMass*1e10 > 1e9 && Type == 0\" [default: \"\" = all rows]")
+                ("sampleFraction", po::value<double>(&sampleFraction)->default_value(1), "only ingest this fraction of the galaxies, chosen by a hash of GalaxyIndex, so that the same galaxies are taken from all snapshots [default: 1 = all galaxies]")
+                ("sampleSeed", po::value<long>(&sampleSeed)->default_value(0), "seed for --sampleFraction; another seed gives another sample [default: 0]")
+                ("scan", po::value<bool>(&scan)->default_value(0), "only read the headers of the given data files (in parallel) and write the manifest file given with --manifest, then stop [default: 0]")
+                ("manifest", po::value<string>(&manifestFile)->default_value(""), "manifest file written by --scan; when ingesting, the data files are taken from it, fileNum counts the files in the manifest (starting at --fileNum), globalRow in expressions numbers the rows over all files and the progress is reported [default: \"\" = no manifest]")
+                ("scanThreads", po::value<int>(&scanThreads)->default_value(8), "number of threads for --scan [default: 8]")
+                ("part", po::value<int>(&part)->default_value(0), "ingest only this part (0, ..., numParts-1) of the files in the manifest, for running several ingests in parallel [default: 0]")
+                ("numParts", po::value<int>(&numParts)->default_value(1), "number of parts the files in the manifest are split into, with about the same number of rows each [default: 1]")
+                ("ledger", po::value<string>(&ledgerFile)->default_value(""), "ledger file recording the completely ingested data files (path, size, modification time, CRC32C checksum); files that are in it with the same size and modification time are skipped [default: \"\" = no ledger]")
+                ("memoryLatency", po::value<long>(&memoryLatency)->default_value(0), "with -s memory: simulated latency per insert batch in microseconds [default: 0]")
+                ("memoryStore", po::value<bool>(&memoryStore)->default_value(0), "with -s memory: keep the ingested rows in memory (column by column) instead of only checksumming them [default: 0]")
+                ("batchRows", po::value<bool>(&batchRows)->default_value(1), "get the values from the reader for a whole batch of rows at once and insert them with one multi-row statement of the database adaptor, instead of DBIngestor reading value by value; not for resumeMode, isDryRun and the first file with validateSchema [default: 1]")
+                ("trees", po::value<string>(&trees)->default_value(""), "only read these trees of each file, given by their index in the file, e.g. 3,17,100-120; the reader seeks directly to their records [default: \"\" = all trees]")
+                ("treeIndex", po::value<bool>(&treeIndex)->default_value(0), "write a side-car index of the trees (tree, number of galaxies, byte offset) next to each data file, as <file>.trees [default: 0]")
+                ("haloTable", po::value<string>(&haloTable)->default_value(""), "also aggregate the galaxies per host halo (number of galaxies and satellites, sums of stellar, cold gas and black hole mass) and ingest the aggregates of each file into this table, e.g. SAGE_halos [default: \"\" = no aggregates]")
+                ("haloFile", po::value<string>(&haloFile)->default_value(""), "write the host halo aggregates (see --haloTable) into this text file instead [default: \"\" = no aggregates]")
+                ("haloMemory", po::value<long>(&haloMemory)->default_value(512), "memory for the host halo aggregates in MB, more halos are spilled to disk [default: 512]")
+                ("haloSpillDir", po::value<string>(&haloSpillDir)->default_value("/tmp"), "directory for spilled host halo aggregates [default: /tmp]")
+                ("cacheDir", po::value<string>(&cacheDir)->default_value(""), "directory for column caches: the database columns of each data file are written there (native-endian, one array per column) when it is first ingested, later runs with the same file and options ingest from the cache without reading the file [default: \"\" = no cache]")
+                ("mapFile,f", po::value<string>(&mapFile)->default_value(""), "mapping file with one database column per line: name, type (e.g. FLOAT) and optionally an expression computing it, e.g. HaloMass FLOAT Mvir*1e10/h [default: \"\" = built-in columns]")
                 ("isDryRun", po::value<bool>(&isDryRun)->default_value(0), "should this run be carried out as a dry run (no data added to database)? [default: 0]")
-                ("fileNum", po::value<int>(&fileNum)->default_value(0), "number of the data file (e.g. if multiple files per snapshot, mainly for checking purposes)")
+                ("fileNum", po::value<int>(&fileNum)->default_value(0), "number of the data file (e.g. if multiple files per snapshot, mainly for checking purposes); with several data files, this is the number of the first one and the others are numbered consecutively")
                 ("blocksize", po::value<int32_t>(&user_blocksize)->default_value(10000), "number of rows to be read in one block (for each dataset); dataset * blocksize * dataType must fit into memory [default: 10000]")
+                ("memBudget", po::value<long>(&memBudget)->default_value(0), "memory budget for the block buffers of the reader and the pipeline in MB, counting the rows, raw rows, column values and expression values of each block; if given, block size and number of blocks are derived from it for each file and --blocksize is ignored [default: 0 = use blocksize]")
+                ("autoBlocksize", po::value<bool>(&autoBlocksize)->default_value(0), "adapt the block size at runtime to the smallest one that keeps reading ahead of the ingest (within minBlocksize and blocksize) [default: 0]")
+                ("minBlocksize", po::value<long>(&minBlocksize)->default_value(1000), "smallest block size (rows) to start from when autoBlocksize is used [default: 1000]")
+                ("hugePages", po::value<bool>(&hugePages)->default_value(0), "use transparent huge pages for the block buffers [default: 0]")
+                ("prefault", po::value<bool>(&prefault)->default_value(1), "pre-fault the block buffers when allocating them [default: 1]")
+                ("threads", po::value<int>(&transformThreads)->default_value(0), "number of threads for decoding, filtering and computing the column values of the blocks, while another thread reads the file ahead and the ingest gets the blocks in file order; the number of blocks in flight is derived from memBudget (at least 3), otherwise 2*threads+2 [default: 0 = read and compute everything in the ingest thread]")
+                ("ioCpus", po::value<string>(&ioCpus)->default_value(""), "CPUs for the read thread of the pipeline, e.g. 0-3,8 [default: \"\" = not pinned]")
+                ("transformCpus", po::value<string>(&transformCpus)->default_value(""), "CPUs for the transform threads, one per thread in turn; the block buffers are placed on their NUMA nodes [default: \"\" = not pinned]")
+                ("ingestCpus", po::value<string>(&ingestCpus)->default_value(""), "CPUs for the thread writing to the database [default: \"\" = not pinned]")
+                ("ioMode", po::value<string>(&ioModeName)->default_value("stream"), "how the rows of binary files are read: stream (ifstream), fadvise (sequential readahead, read pages dropped from the page cache), direct (O_DIRECT, bypassing the page cache) or uring (io_uring with queueDepth block-sized reads in flight; fadvise if not available) [default: stream]")
+                ("readahead", po::value<long>(&readahead)->default_value(64), "readahead in MB for --ioMode fadvise, size of the aligned reads for direct [default: 64]")
+                ("queueDepth", po::value<int>(&queueDepth)->default_value(4), "number of reads in flight for --ioMode uring [default: 4]")
+                ("ioBenchmark", po::value<bool>(&ioBenchmark)->default_value(0), "only read the given data files synchronously and with io_uring at queue depths 1, 2, 4, ... up to queueDepth, reads of blocksize rows, print the MB/s of each and stop [default: 0]")
+                ("format", po::value<string>(&formatName)->default_value("auto"), (string("record layout of the data files (") + getFormatNames() + ", hdf5, or auto to determine it from the file) [default: auto]").c_str())
+                ("hdf5Group", po::value<string>(&hdf5Group)->default_value(""), "group containing the datasets in HDF5 files, e.g. Snap_63 [default: \"\" = root group]")
                 ("swap,w", po::value<int32_t>(&swap)->default_value(0), "flag for byte swapping (default 0)")
                 ("Planck,h", po::value<float>(&h)->default_value(0.6777), "Planck's constant h (e.g. 0.6777 [default] for simulation MDPL2)")
                 ("maxRows,m", po::value<int64_t>(&maxRows)->default_value(-1), "maximum number of rows to be read (default: -1 = read all)")
@@ -126,7 +404,7 @@ int main (int argc, const char * argv[])
     // required options: dbase, table, mapFile, fileNum
 
     po::positional_options_description posDesc;
-    posDesc.add("data", 1);
+    posDesc.add("data", -1);
 
     //read out the options
     po::variables_map varMap;
@@ -135,18 +413,63 @@ int main (int argc, const char * argv[])
     // --> only compiles at erebos if I include the (char **) cast
     po::notify(varMap);
     
-    if (varMap.count("help") || varMap.count("?") || dataFile.length() == 0) {
+    if (varMap.count("help") || varMap.count("?") || (dataFiles.size() == 0 && manifestFile == "" && watchDir == "")) {
         cout << progDesc;
         return EXIT_SUCCESS;
     }
+
+    if (ioBenchmark) {
+        for (size_t i=0; i<dataFiles.size(); i++) {
+            SageFileIO::benchmark(dataFiles[i], user_blocksize*sizeof(GalaxyData), queueDepth);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (scan) {
+        if (manifestFile == "") {
+            SageIngest_error("Please give the name of the manifest file to write with --manifest.\n");
+        }
+        cout << "Scanning " << dataFiles.size() << " data files with " << scanThreads << " threads" << endl;
+        SageManifest::scan(dataFiles, swap, scanThreads).write(manifestFile);
+        cout << "Manifest written to " << manifestFile << endl;
+        return EXIT_SUCCESS;
+    }
+
+    // take the files (of this part) from the manifest
+    SageManifest manifest;
+    if (manifestFile != "") {
+        manifest.read(manifestFile);
+        if (dataFiles.size() > 0) {
+            cout << "WARNING: data files are taken from the manifest, ignoring the ones given on the command line." << endl;
+        }
+        manifest = manifest.getPart(part, numParts);
+        dataFiles.clear();
+        for (size_t i=0; i<manifest.size(); i++) {
+            dataFiles.push_back(manifest.getEntry(i).path);
+        }
+    }
     
     cout << "You have entered the following parameters:" << endl;
-    cout << "Data file: " << dataFile << endl;
+    if (manifestFile != "") {
+        cout << "Manifest: " << manifestFile << ", part " << part << " of " << numParts
+             << " (" << manifest.getTotalRows() << " rows)" << endl;
+    }
+    for (size_t i=0; i<dataFiles.size(); i++) {
+        cout << "Data file: " << dataFiles[i] << endl;
+    }
     cout << "DB system: " << system << endl;
     cout << "Buffer size: " << bufferSize << endl;
+    if (adaptiveBuffer) {
+        minBufferSize = minBufferSize > 0 ? minBufferSize : max(bufferSize/8, (uint32_t) 1);
+        maxBufferSize = maxBufferSize > 0 ? maxBufferSize : 16*bufferSize;
+        cout << "Adaptive buffer size: " << minBufferSize << " to " << maxBufferSize << endl;
+    }
     cout << "Performance output frequency: " << outputFreq << endl;
     cout << "Database name: " << dbase << endl;
     cout << "Table name: " << table << endl;
+    if (routeTable != "") {
+        cout << "Route table template: " << routeTable << endl;
+    }
     cout << "Socket: " << socket << endl;
     cout << "User: " << user << endl;
     if (pwd.compare("") == 0) {
@@ -159,11 +482,37 @@ int main (int argc, const char * argv[])
     if (path != "") {
         cout << "Path: " << path << endl;
     }
+    if (memBudget > 0) {
+        cout << "Memory budget: " << memBudget << " MB" << endl;
+    }
     cout << "Block size: " << user_blocksize << endl;
+    cout << "Auto block size: " << autoBlocksize << endl;
+    if (transformThreads > 0) {
+        cout << "Transform threads: " << transformThreads << endl;
+    }
+    if (ioCpus != "" || transformCpus != "" || ingestCpus != "") {
+        cout << "CPUs (io/transform/ingest): " << (ioCpus != "" ? ioCpus : "-") << " / "
+             << (transformCpus != "" ? transformCpus : "-") << " / " << (ingestCpus != "" ? ingestCpus : "-") << endl;
+    }
     cout << "File number: " << fileNum << endl;
     cout << "Byte swap: " << swap << endl;
+    cout << "Format: " << formatName << endl;
+    SageIOMode ioMode = SageFileIO::parseMode(ioModeName);
+    if (ioMode != SAGE_IO_STREAM) {
+        cout << "I/O mode: " << ioModeName << ", readahead " << readahead << " MB";
+        if (ioMode == SAGE_IO_URING) {
+            cout << ", queue depth " << queueDepth;
+        }
+        cout << endl;
+    }
     cout << "Planck h: " << h << endl;
     cout << "max. rows: " << maxRows << endl;
+    if (where != "") {
+        cout << "Filter: " << where << endl;
+    }
+    if (mapFile != "") {
+        cout << "Mapping file: " << mapFile << endl;
+    }
 
     cout << endl;
    
@@ -173,65 +522,467 @@ int main (int argc, const char * argv[])
     // setup schema mapper; need dataset-names in reader to filter out what
     // we won't need
     SageSchemaMapper * thisSchemaMapper = new SageSchemaMapper(assertFac, convFac);     //registering the converter and asserter factories
-    //cout << "Mapping file: " << mapFile << endl;
     vector<string> databaseFieldNames;
-    databaseFieldNames = thisSchemaMapper->getFieldNames();
+    SageMapping * mapping = NULL;
+    if (mapFile != "") {
+        if (routeTable != "") {
+            SageIngest_error("A mapping file (--mapFile) is not supported with --routeTable.\n");
+        }
+        mapping = new SageMapping(mapFile);
+        databaseFieldNames = thisSchemaMapper->setFields(mapping->getFields());
+    } else {
+        databaseFieldNames = thisSchemaMapper->getFieldNames();
+    }
 
     DBDataSchema::Schema * thisSchema;
     thisSchema = thisSchemaMapper->generateSchema(dbase, table);
 
-    //now setup the file reader
-    SageReader *thisReader = new SageReader(dataFile, swap, h, fileNum, user_blocksize, maxRows, databaseFieldNames);
-    dbServer = adaptorFac.getDBAdaptors(system);
-    
-    sageIngestor = new DBIngest::DBIngestor(thisSchema, thisReader, dbServer);
-    sageIngestor->setUsrName(user);
-    sageIngestor->setPasswd(pwd);
-
-    //settings for different DBs (copy&paste from AsciiIngest)
-    if(system.compare("mysql") == 0) {
-        sageIngestor->setSocket(socket);
-        sageIngestor->setPort(port);
-        sageIngestor->setHost(host);
-    } else if (system.compare("sqlite3") == 0) {
-        sageIngestor->setHost(path);
-    } else if (system.compare("unix_sqlsrv_odbc") == 0) {
-        sageIngestor->setSocket("DRIVER=FreeTDS;TDS_Version=7.0;");
-        //sageIngestor->setSocket("DRIVER=SQL Server Native Client 10.0;");
-        sageIngestor->setPort(port);
-        sageIngestor->setHost(host);
-    } else if (system.compare("sqlsrv_odbc") == 0) {
-        sageIngestor->setSocket("DRIVER=SQL Server Native Client 10.0;");
-        sageIngestor->setPort(port);
-        sageIngestor->setHost(host);
-    } else if (system.compare("sqlsrv_odbc_bulk") == 0) {
-        //TESTS ON SQL SERVER SHOWED THIS IS VERY SLOW. BUT NO CLUE WHY, DID NOT BOTHER TO LOOK AT PROFILER YET
-        sageIngestor->setSocket("DRIVER=SQL Server Native Client 10.0;");
-        sageIngestor->setPort(port);
-        sageIngestor->setHost(host);
-    }  else if (system.compare("cust_odbc") == 0) {
-        sageIngestor->setSocket(socket);
-        sageIngestor->setPort(port);
-        sageIngestor->setHost(host);
-    } else if (system.compare("cust_odbc_bulk") == 0) {
-        //TESTS ON SQL SERVER SHOWED THIS IS VERY SLOW. BUT NO CLUE WHY, DID NOT BOTHER TO LOOK AT PROFILER YET
-        sageIngestor->setSocket(socket);
-        sageIngestor->setPort(port);
-        sageIngestor->setHost(host);
+    if (system == "memory" && routeTable != "") {
+        SageIngest_error("Routing (--routeTable) is not supported with -s memory.\n");
+    }
+
+    DBTarget target;
+    target.system = system;
+    target.dbase = dbase;
+    target.table = table;
+    target.socket = socket;
+    target.user = user;
+    target.pwd = pwd;
+    target.port = port;
+    target.host = host;
+    target.path = path;
+    target.resumeMode = resumeMode;
+    target.isDryRun = isDryRun;
+    target.outputFreq = outputFreq;
+    target.memoryStore = memoryStore;
+    target.memoryLatency = memoryLatency;
+    dbServer = newDBAdaptor(target);
+
+    // all targets are fed from the same pass over each data file
+    vector<DBTarget> targets(1, target);
+    for (size_t t=0; t<targetSpecs.size(); t++) {
+        targets.push_back(parseTarget(targetSpecs[t], target));
+        cout << "Target " << t+2 << ": " << targets.back().system << " " << targets.back().dbase << " "
+             << targets.back().table << (targets.back().path != "" ? " " + targets.back().path : "") << endl;
+    }
+    if (targets.size() > 1 && routeTable != "") {
+        SageIngest_error("SageIngest: Several targets (--target) are not supported with --routeTable.\n");
+    }
+
+    // compile the filter only once, it is used for all files
+    SageExpression * filter = NULL;
+    if (where != "") {
+        filter = new SageExpression(where);
+    }
+
+    vector<pair<long,long> > treeRanges;
+    if (trees != "") {
+        treeRanges = SageReader::parseTreeList(trees);
+    }
+
+    SageSampler * sampler = NULL;
+    if (sampleFraction != 1) {
+        sampler = new SageSampler(sampleFraction, sampleSeed);
+        printf("Sampling %g%% of the galaxies (seed %ld)\n", sampleFraction*100, sampleSeed);
+    }
+
+    vector<float> snapRedshifts;
+    if (snapList != "") {
+        snapRedshifts = SageReader::readSnapList(snapList);
+        cout << "Read redshifts for " << snapRedshifts.size() << " snapshots from " << snapList << endl;
+    }
+
+    // ingest the files one after another; the block buffers are borrowed from
+    // the block pool, so they stay allocated (and faulted in) between files
+    SageBlockPool::instance().setUseHugePages(hugePages);
+    SageBlockPool::instance().setPrefault(prefault);
+
+    SageLedger * ledger = NULL;
+    if (ledgerFile != "") {
+        ledger = new SageLedger(ledgerFile);
+    }
+
+    SageHaloAggregator * aggregator = NULL;
+    DBDataSchema::Schema * haloSchema = NULL;
+    ofstream haloStream;
+    if (cacheDir != "" && (routeTable != "" || haloTable != "" || haloFile != "")) {
+        SageIngest_error("SageIngest: A column cache (--cacheDir) is not supported with --routeTable, --haloTable or --haloFile.\n");
+    }
+
+    if (haloTable != "" && haloFile != "") {
+        SageIngest_error("SageIngest: Please give either --haloTable or --haloFile, not both.\n");
+    }
+    if (haloTable != "" || haloFile != "") {
+        aggregator = new SageHaloAggregator(haloMemory*1024*1024, haloSpillDir);
+    }
+    if (haloTable != "") {
+        haloSchema = thisSchemaMapper->generateHaloSchema(dbase, haloTable);
+    }
+    if (haloFile != "") {
+        haloStream.open(haloFile.c_str(), ios::trunc);
+        if (!haloStream.is_open()) {
+            SageIngest_error("SageIngest: Cannot open the file given by --haloFile.\n");
+        }
+        haloStream << "# snapnum HostHaloID numGalaxies numSatellites MstarSum McoldSum MbhSum" << endl;
+    }
+
+    // the batch size is measured over batchWindow batches: with --batchRows
+    // batch by batch, otherwise DBIngestor is given batchWindow batches of
+    // rows per ingestData call (it takes the buffer size only per call)
+    const int batchWindow = 8;
+    SageBatchSizer * batchSizer = NULL;
+    if (adaptiveBuffer && routeTable == "" && targets.size() == 1) {
+        batchSizer = new SageBatchSizer(bufferSize, minBufferSize, maxBufferSize, batchRows && !resumeMode && !isDryRun ? batchWindow : 1);
+    } else if (adaptiveBuffer) {
+        cout << "WARNING: the buffer size is not adapted with --routeTable or several targets" << endl;
+    }
+
+    // the main thread is the ingest thread; the pipeline threads are
+    // pinned when they start
+    SageAffinity * affinity = NULL;
+    if (ioCpus != "" || transformCpus != "" || ingestCpus != "") {
+        affinity = new SageAffinity(ioCpus, transformCpus, ingestCpus);
+        affinity->pinIngest();
+        if (transformThreads <= 0 && (ioCpus != "" || transformCpus != "")) {
+            cout << "WARNING: --ioCpus and --transformCpus are only used with --threads" << endl;
+        }
+    }
+
+    // sized for the rows of all files (of all parts of a manifest), unless
+    // it exists already
+    SageDuplicateDetector * duplicates = NULL;
+    if (duplicateFilter != "") {
+        if (cacheDir != "") {
+            SageIngest_error("SageIngest: Duplicates (--duplicateFilter) cannot be detected with a column cache (--cacheDir).\n");
+        }
+        long expectedRows = duplicateRows;
+        if (expectedRows <= 0 && manifestFile != "") {
+            SageManifest wholeManifest;
+            wholeManifest.read(manifestFile);
+            expectedRows = wholeManifest.getTotalRows();
+        } else if (expectedRows <= 0) {
+            vector<string> binaryFiles;
+            for (size_t i=0; i<dataFiles.size(); i++) {
+                if (!SageReader::isPipe(dataFiles[i]) && !SageHDF5Reader::isHDF5File(dataFiles[i])) {
+                    binaryFiles.push_back(dataFiles[i]);
+                }
+            }
+            expectedRows = SageManifest::scan(binaryFiles, swap, scanThreads).getTotalRows();
+        }
+        if (duplicateRows <= 0 && expectedRows < 1000000) {
+            cout << "WARNING: sizing the duplicate filter for 1000000 rows, use --duplicateRows for more" << endl;
+            expectedRows = 1000000;
+        }
+        duplicates = new SageDuplicateDetector(duplicateFilter, expectedRows);
+    }
+
+    // new files are appended to dataFiles as they are completed; the DB
+    // ingestor is then kept for all files, getting the rows of each file
+    // through the chain reader
+    SageWatcher * watcher = NULL;
+    SageChainReader chainReader;
+    if (watchDir != "") {
+        if (manifestFile != "") {
+            SageIngest_error("SageIngest: Please give either --watch or --manifest, not both.\n");
+        }
+        watcher = new SageWatcher(watchDir, formatName, swap, watchIdle);
+    }
+
+    boost::posix_time::ptime ingestStart = boost::posix_time::microsec_clock::universal_time();
+    long rowsDone = 0;
+
+    for (int i=0; i<(int) dataFiles.size() || (watcher && watcher->waitForFile(dataFiles)); i++) {
+        // with a manifest, files are numbered by their position in it, so
+        // that the numbers are the same for all parts
+        int thisFileNum = fileNum + (manifestFile != "" ? manifest.getEntry(i).index : i);
+        cout << "Ingesting file " << dataFiles[i] << " (fileNum " << thisFileNum << ")" << endl;
+        // dbId and the fileNum column leave room for 1000 files per snapnum
+        if (thisFileNum >= 1000 && (find(databaseFieldNames.begin(), databaseFieldNames.end(), "dbId") != databaseFieldNames.end()
+                || find(databaseFieldNames.begin(), databaseFieldNames.end(), "fileNum") != databaseFieldNames.end())) {
+            ostringstream message;
+            message << "SageIngest: fileNum " << thisFileNum << " of " << dataFiles[i] << " is 1000 or more, dbId and fileNum would not be unique." << endl
+                << "Please use a mapping file (--mapFile) with the globalRow column instead of dbId and fileNum." << endl;
+            SageIngest_error(message.str().c_str());
+        }
+
+        // "-" or a named pipe, e.g. from a running SAGE model; there is no
+        // file to record in the ledger or to look at before reading
+        bool pipeInput = SageReader::isPipe(dataFiles[i]);
+        if (pipeInput && ledger) {
+            cout << "WARNING: " << dataFiles[i] << " is a pipe, it is not recorded in the ledger" << endl;
+        }
+
+        SageLedgerEntry ledgerEntry;
+        if (ledger && !pipeInput) {
+            if (!SageLedger::statFile(dataFiles[i], ledgerEntry)) {
+                SageIngest_error(("Cannot access data file " + dataFiles[i] + ".\n").c_str());
+            }
+            if (ledger->isDone(ledgerEntry)) {
+                cout << "Skipping " << dataFiles[i] << ", it was ingested before (see ledger)" << endl;
+                if (manifestFile != "") {
+                    rowsDone += manifest.getEntry(i).numRows;
+                    reportProgress(manifest, i+1, rowsDone, ingestStart);
+                }
+                continue;
+            }
+        }
+
+        //now setup the file reader
+        SageReader *thisReader;
+        bool hdf5Input = formatName == "hdf5" || (formatName == "auto" && !pipeInput && SageHDF5Reader::isHDF5File(dataFiles[i]));
+        if (hdf5Input) {
+            thisReader = new SageHDF5Reader(dataFiles[i], hdf5Group, h, thisFileNum, user_blocksize, maxRows, databaseFieldNames);
+            if (ioMode != SAGE_IO_STREAM) {
+                cout << "WARNING: --ioMode is not used for HDF5 files" << endl;
+            }
+        } else {
+            thisReader = new SageReader(dataFiles[i], swap, h, thisFileNum, user_blocksize, maxRows, databaseFieldNames);
+            thisReader->setAutoBlocksize(autoBlocksize, minBlocksize);
+            thisReader->setFormat(formatName);
+        }
+        // the block size from the budget depends on the format, the columns
+        // and the rows of the file; the I/O buffers are sized for it
+        if (memBudget > 0) {
+            numBuffers = thisReader->setMemBudget(memBudget*1024*1024, mapping ? mapping->getNumExpressions() : 0, transformThreads > 0);
+        }
+        if (!hdf5Input) {
+            thisReader->setIOMode(ioMode, readahead*1024*1024, queueDepth);
+        }
+
+        if (snapList != "") {
+            thisReader->setSnapRedshifts(snapRedshifts);
+        }
+        if (manifestFile != "") {
+            thisReader->setRowOffset(manifest.getEntry(i).rowOffset);
+        }
+        if (ledger && !pipeInput) {
+            thisReader->enableHash();
+        }
+        if (filter) {
+            thisReader->setFilter(filter);
+        }
+        if (sampler) {
+            thisReader->setSampler(sampler);
+        }
+        if (treeIndex) {
+            thisReader->writeTreeIndex(dataFiles[i] + ".trees");
+        }
+        if (trees != "") {
+            thisReader->setTrees(treeRanges);
+        }
+        if (aggregator) {
+            thisReader->setAggregator(aggregator);
+        }
+        if (duplicates) {
+            duplicates->setFileNum(thisFileNum);
+            thisReader->setDuplicateDetector(duplicates);
+        }
+        if (mapping) {
+            thisReader->setMapping(mapping);
+        }
+        if (routeTable == "") {
+            // choose the column writers for the types of the schema
+            thisReader->bindSchema(thisSchema);
+        }
+        // the values in a column cache depend on the file and on everything
+        // that selects or computes the rows; a cache for another key is
+        // written again
+        SageColumnCache * cache = NULL;
+        bool cached = false;
+        if (cacheDir != "" && pipeInput) {
+            cout << "WARNING: " << dataFiles[i] << " is a pipe, it is not cached" << endl;
+        } else if (cacheDir != "") {
+            SageLedgerEntry fileEntry = SageLedgerEntry();
+            SageLedgerEntry mapEntry = SageLedgerEntry();
+            SageLedgerEntry snapEntry = SageLedgerEntry();
+            SageLedger::statFile(dataFiles[i], fileEntry);
+            SageLedger::statFile(mapFile, mapEntry);
+            SageLedger::statFile(snapList, snapEntry);
+            ostringstream key;
+            key << "file=" << fileEntry.path << " size=" << fileEntry.fileSize << " mtime=" << fileEntry.mtime
+                << " format=" << formatName << " hdf5Group=" << hdf5Group << " swap=" << swap << " h=" << h
+                << " fileNum=" << thisFileNum << " rowOffset=" << (manifestFile != "" ? manifest.getEntry(i).rowOffset : 0)
+                << " maxRows=" << maxRows << " where=" << where << " sample=" << sampleFraction << "/" << sampleSeed
+                << " trees=" << trees << " mapFile=" << mapFile << "/" << mapEntry.mtime
+                << " snapList=" << snapList << "/" << snapEntry.mtime;
+            cache = new SageColumnCache(cacheDir, dataFiles[i], key.str());
+            cached = cache->load(thisSchema);
+        }
+
+        if (transformThreads > 0 && !cached) {
+            // the router only needs the rows, it computes the values itself
+            int numBlocks = memBudget > 0 ? numBuffers : 2*transformThreads + 2;
+            if (affinity) {
+                thisReader->setAffinity(affinity);
+            }
+            thisReader->startPipeline(transformThreads, numBlocks, routeTable == "");
+        }
+
+        if (cache) {
+            if (!cached) {
+                cache->write(thisReader, thisSchema);
+                if (!cache->load(thisSchema)) {
+                    SageIngest_error(("SageIngest: Cannot use the column cache " + cache->getFileName() + " just written.\n").c_str());
+                }
+            }
+            thisReader->setCache(cache);
+        }
+
+        if (routeTable != "") {
+            // one table/partition per snapnum, each with its own ingestor
+            SageRouter router(thisReader, thisSchemaMapper, boost::bind(&newRouteIngestor, boost::cref(target), _1, _2),
+                              dbase, routeTable, bufferSize);
+            cout << "Go now!" << endl;
+            router.run();
+        } else if (targets.size() > 1) {
+            // one reader pass for all targets; each target has its own
+            // schema, reader, ingestor (connection) and thread
+            SageFanout fanout(thisReader, thisSchema);
+            vector<DBDataSchema::Schema *> targetSchemas;
+            vector<DBServer::DBAbstractor *> targetAdaptors;
+            vector<DBIngest::DBIngestor *> targetIngestors;
+            vector<SageFanoutWriter> writers;
+            for (size_t t=0; t<targets.size(); t++) {
+                targetSchemas.push_back(thisSchemaMapper->generateSchema(targets[t].dbase, targets[t].table));
+                SageFanoutReader * targetReader = fanout.addTarget(targetSchemas[t]);
+                targetAdaptors.push_back(newDBAdaptor(targets[t]));
+                targetIngestors.push_back(newTargetIngestor(targets[t], targetAdaptors[t], targetSchemas[t], targetReader));
+                writers.push_back(boost::bind(&DBIngest::DBIngestor::ingestData, targetIngestors[t], bufferSize));
+            }
+            cout << "Go now!" << endl;
+            fanout.run(writers);
+
+            for (size_t t=0; t<targetIngestors.size(); t++) {
+                delete targetIngestors[t];
+                finishDBAdaptor(targetAdaptors[t]);
+            }
+            for (size_t t=0; t<targetSchemas.size(); t++) {
+                delete targetSchemas[t];
+            }
+        } else if (batchRows && !resumeMode && !isDryRun && (system == "memory" || !askUserToValidateRead || i > 0)) {
+            // DBIngestor is still used for resuming, dry runs and asking
+            // the user to validate the schema mapping with the first file
+            SageBulkIngestor bulkIngestor(thisSchema, thisReader, dbServer);
+            string socket, port, host;
+            getConnection(target, socket, port, host);
+            bulkIngestor.setConnection(target.user, target.pwd, host, port, socket);
+            bulkIngestor.setPerformanceMeter(outputFreq);
+            bulkIngestor.setBatchSizer(batchSizer);
+            cout << "Go now!" << endl;
+            bulkIngestor.ingestData(bufferSize);
+            if (system == "memory") {
+                ((SageMemoryAdaptor *) dbServer)->report();
+            }
+        } else {
+            if (watcher == NULL || sageIngestor == NULL) {
+                sageIngestor = new DBIngest::DBIngestor(thisSchema, watcher || batchSizer ? (DBReader::Reader *) &chainReader : thisReader, dbServer);
+                setupConnection(sageIngestor, target);
+                // only ask once, the schema is the same for all files
+                sageIngestor->setAskUserToValidateRead(askUserToValidateRead && i == 0);
+            }
+            chainReader.setReader(thisReader);
+
+            cout << "now everything ready to ingest ..." << endl;
+
+            //now ingest data after setup
+            cout << "Go now!" << endl;
+            if (batchSizer == NULL) {
+                sageIngestor->ingestData(bufferSize);  		// buffer size (in bytes??)
+            }
+            while (batchSizer && !chainReader.isExhausted()) {
+                // one window of batches per call on the same ingestor
+                chainReader.setSliceRows(batchWindow*batchSizer->getSize());
+                boost::posix_time::ptime sliceStart = boost::posix_time::microsec_clock::universal_time();
+                sageIngestor->ingestData(batchSizer->getSize());
+                boost::posix_time::ptime sliceEnd = boost::posix_time::microsec_clock::universal_time();
+                sageIngestor->setAskUserToValidateRead(false);
+                if (chainReader.getSliceRowsReturned() > 0) {
+                    batchSizer->record(chainReader.getSliceRowsReturned(), (sliceEnd-sliceStart).total_microseconds());
+                }
+            }
+
+            if (watcher == NULL) {
+                delete sageIngestor;
+            }
+            if (system == "memory") {
+                ((SageMemoryAdaptor *) dbServer)->report();
+            }
+        }
+
+        if (aggregator) {
+            // each file contains whole trees, so the host halos of its
+            // galaxies are complete now
+            aggregator->finish();
+            SageHaloReader haloReader(aggregator);
+            if (haloFile != "") {
+                long numHalos = haloReader.writeText(haloStream);
+                cout << "Wrote " << numHalos << " host halo aggregates to " << haloFile << endl;
+            } else {
+                DBServer::DBAbstractor * haloAdaptor = newDBAdaptor(target);
+                DBIngest::DBIngestor * haloIngestor = newTargetIngestor(target, haloAdaptor, haloSchema, &haloReader);
+                haloIngestor->ingestData(bufferSize);
+                delete haloIngestor;
+                finishDBAdaptor(haloAdaptor);
+            }
+            aggregator->clear();
+        }
+
+        // only files that were read completely are done
+        if (ledger && !pipeInput && !isDryRun) {
+            if (thisReader->isComplete()) {
+                ledgerEntry.hasCrc = thisReader->getHash(ledgerEntry.crc);
+                ledgerEntry.numRows = thisReader->getTotalRows();
+                ledger->record(ledgerEntry);
+            } else {
+                cout << "WARNING: " << dataFiles[i] << " was not read completely, not recording it in the ledger" << endl;
+            }
+        }
+        delete thisReader;
+        if (cache) {
+            delete cache;
+        }
+
+        if (manifestFile != "") {
+            rowsDone += manifest.getEntry(i).numRows;
+            reportProgress(manifest, i+1, rowsDone, ingestStart);
+        }
+    }
+
+    if (duplicates) {
+        duplicates->check();
+        delete duplicates;
+    }
+    if (watcher) {
+        if (sageIngestor) {
+            delete sageIngestor;
+        }
+        delete watcher;
+    }
+    if (filter) {
+        delete filter;
+    }
+    if (sampler) {
+        delete sampler;
+    }
+    if (mapping) {
+        delete mapping;
+    }
+    if (batchSizer) {
+        batchSizer->report();
+        delete batchSizer;
+    }
+    if (affinity) {
+        delete affinity;
+    }
+    if (aggregator) {
+        delete aggregator;
+    }
+    if (haloSchema) {
+        delete haloSchema;
+    }
+    if (ledger) {
+        delete ledger;
     }
-    
-    // setup resume option, if desired
-    sageIngestor->setResumeMode(resumeMode); 
-    sageIngestor->setIsDryRun(isDryRun);
-    sageIngestor->setAskUserToValidateRead(askUserToValidateRead); 
-   
-    cout << "now everything ready to ingest ..." << endl;
-   
-    //now ingest data after setup
-    sageIngestor->setPerformanceMeter(outputFreq);	// after how many lines should I print the status?
-    cout << "Go now!" << endl;
-    sageIngestor->ingestData(bufferSize);  		// buffer size (in bytes??)
-    
     delete thisSchemaMapper;
     delete thisSchema;
     //delete assertFac;
@@ -239,4 +990,3 @@ int main (int argc, const char * argv[])
 
     return 0;
 }
-